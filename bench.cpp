@@ -0,0 +1,797 @@
+// pixie_bench: times Pixie's drawing primitives against the window's backing buffer at
+// several resolutions, and optionally writes the results as JSON so they can be tracked
+// over time.
+//
+//   pixie_bench [--reps N] [--min-time MS] [--simd scalar|sse2|avx2] [--filter NAME]
+//               [--json FILE] [--ttf FILE] [--pad-rows] [--huge-pages]
+//
+// Each benchmark is calibrated so that one repetition takes at least --min-time
+// milliseconds, then repeated --reps times. The median time per operation is reported
+// along with the spread, so a change can be judged against the noise. The TrueTypeFont
+// benchmarks only run when given a font with --ttf. --pad-rows and --huge-pages open the
+// windows with those buffer flags.
+
+#include "pixie.h"
+#include "font.h"
+#include "truetype.h"
+#include "imgui.h"
+#include "jobs.h"
+#include "simd.h"
+#include "scaler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+struct Resolution
+{
+    int width;
+    int height;
+};
+
+static const Resolution Resolutions[] =
+{
+    { 640, 400 },
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 3840, 2160 },
+};
+
+struct Context
+{
+    Pixie::Window* window;
+    Pixie::Font* font;
+    Pixie::TrueTypeFont* trueTypeFont;  // 0 without --ttf.
+    Pixie::JobSystem* jobs;
+    int width;
+    int height;
+};
+
+// The amount of work done by one operation of a benchmark.
+struct Work
+{
+    uint64_t pixels;
+    uint64_t glyphs;
+};
+
+typedef Work(*BenchFunc)(Context& context, int iterations);
+
+struct Benchmark
+{
+    const char* name;
+    BenchFunc fn;
+};
+
+struct Result
+{
+    const char* name;
+    int width;
+    int height;
+    int iterations;
+    double medianNs;    // Per operation.
+    double minNs;
+    double meanNs;
+    double stddevNs;
+    Work work;
+};
+
+static const char* SimdLevelNames[Pixie::Simd::Level_Num] = { "scalar", "sse2", "avx2" };
+
+// Text long enough to fill a row at any of the resolutions.
+static char s_text[512];
+
+// A sprite for the blit benchmarks: a disc on a key coloured background, with the
+// alpha fading out towards its edge.
+enum { SpriteSize = 64 };
+static const uint32_t SpriteKey = MAKE_RGB(255, 0, 255);
+static uint32_t s_sprite[SpriteSize * SpriteSize];
+
+static void MakeSprite()
+{
+    const float radius = SpriteSize / 2.0f;
+    for (int y = 0; y < SpriteSize; y++)
+    {
+        for (int x = 0; x < SpriteSize; x++)
+        {
+            float dx = x + 0.5f - radius, dy = y + 0.5f - radius;
+            float d = sqrtf(dx * dx + dy * dy) / radius;
+            int alpha = d >= 1.0f ? 0 : d < 0.75f ? 255 : (int)((1.0f - d) * 4.0f * 255.0f);
+            s_sprite[y * SpriteSize + x] = alpha ? MAKE_ARGB(alpha, x * 4, y * 4, 128) : SpriteKey;
+        }
+    }
+}
+
+// Positions for the benchmarks that draw many small things, spread over the buffer.
+static void GetPosition(const Context& context, int i, int width, int height, int& x, int& y)
+{
+    x = (int)(((uint32_t)i * 2654435761u) % (uint32_t)(context.width - width));
+    y = (int)(((uint32_t)i * 40503u + 17) % (uint32_t)(context.height - height));
+}
+
+static Work BenchClear(Context& context, int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+        context.jobs->Clear(context.window, MAKE_RGB(i & 255, 0, 0));
+
+    Work work = { (uint64_t)context.width * context.height, 0 };
+    return work;
+}
+
+// ImGui draws at End, so the ImGui benchmarks time a Begin and End per iteration.
+static Work BenchFilledRectFull(Context& context, int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        uint32_t colour = MAKE_RGB(i & 255, 0, 0);
+        Pixie::ImGui::Begin(context.window, context.font);
+        Pixie::ImGui::FilledRect(0, 0, context.width, context.height, colour, colour);
+        Pixie::ImGui::End();
+    }
+
+    Work work = { (uint64_t)context.width * context.height, 0 };
+    return work;
+}
+
+static Work BenchFilledRectBlend(Context& context, int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        uint32_t colour = MAKE_ARGB(128, i & 255, 0, 0);
+        Pixie::ImGui::Begin(context.window, context.font);
+        Pixie::ImGui::FilledRect(0, 0, context.width, context.height, colour, colour, Pixie::BlendMode_SrcOver);
+        Pixie::ImGui::End();
+    }
+
+    Work work = { (uint64_t)context.width * context.height, 0 };
+    return work;
+}
+
+static Work BenchFilledRect(Context& context, int iterations)
+{
+    const int Count = 64, Size = 100;
+    for (int i = 0; i < iterations; i++)
+    {
+        Pixie::ImGui::Begin(context.window, context.font);
+        for (int j = 0; j < Count; j++)
+        {
+            int x, y;
+            GetPosition(context, j, Size, Size, x, y);
+            Pixie::ImGui::FilledRect(x, y, Size, Size, MAKE_RGB(255, 0, 0), MAKE_RGB(128, 0, 0));
+        }
+        Pixie::ImGui::End();
+    }
+
+    Work work = { (uint64_t)Count * Size * Size, 0 };
+    return work;
+}
+
+static Work BenchRect(Context& context, int iterations)
+{
+    const int Count = 64, Size = 100;
+    for (int i = 0; i < iterations; i++)
+    {
+        Pixie::ImGui::Begin(context.window, context.font);
+        for (int j = 0; j < Count; j++)
+        {
+            int x, y;
+            GetPosition(context, j, Size, Size, x, y);
+            Pixie::ImGui::Rect(x, y, Size, Size, MAKE_RGB(255, 0, 0));
+        }
+        Pixie::ImGui::End();
+    }
+
+    Work work = { (uint64_t)Count * ((Size * 4) - 4), 0 };
+    return work;
+}
+
+static Work BenchButton(Context& context, int iterations)
+{
+    const int Count = 16, Width = 100, Height = 30;
+    for (int i = 0; i < iterations; i++)
+    {
+        Pixie::ImGui::Begin(context.window, context.font);
+        for (int j = 0; j < Count; j++)
+        {
+            int x, y;
+            GetPosition(context, j, Width, Height, x, y);
+            Pixie::ImGui::Button("Button", x, y, Width, Height);
+        }
+        Pixie::ImGui::End();
+    }
+
+    int glyphs = (int)strlen("Button");
+    Work work = { (uint64_t)Count * Width * Height, (uint64_t)Count * glyphs };
+    return work;
+}
+
+static Work BenchInput(Context& context, int iterations)
+{
+    const int Count = 16, Width = 200, Height = 20;
+    char text[32];
+    strcpy_s(text, sizeof(text), "Hello, World!");
+
+    for (int i = 0; i < iterations; i++)
+    {
+        Pixie::ImGui::Begin(context.window, context.font);
+        for (int j = 0; j < Count; j++)
+        {
+            int x, y;
+            GetPosition(context, j, Width, Height, x, y);
+            Pixie::ImGui::Input(text, sizeof(text), x, y, Width, Height);
+        }
+        Pixie::ImGui::End();
+    }
+
+    int glyphs = (int)strlen(text);
+    Work work = { (uint64_t)Count * Width * Height, (uint64_t)Count * glyphs };
+    return work;
+}
+
+// Panels of buttons stacked on top of each other, like a set of tabs, so that only the
+// top one ends up visible.
+static Work BenchPanels(Context& context, int iterations)
+{
+    const int Count = 8, Width = 300, Height = 200, ButtonsX = 3, ButtonsY = 4;
+    const int ButtonWidth = 90, ButtonHeight = 40;
+    for (int i = 0; i < iterations; i++)
+    {
+        Pixie::ImGui::Begin(context.window, context.font);
+        for (int j = 0; j < Count; j++)
+        {
+            Pixie::ImGui::FilledRect(20, 20, Width, Height, MAKE_RGB(40, 40, 40), MAKE_RGB(68, 79, 103));
+            for (int k = 0; k < ButtonsX * ButtonsY; k++)
+                Pixie::ImGui::Button("Button", 30 + ((k % ButtonsX) * (ButtonWidth + 5)), 30 + ((k / ButtonsX) * (ButtonHeight + 5)), ButtonWidth, ButtonHeight);
+        }
+        Pixie::ImGui::End();
+    }
+
+    Work work = { (uint64_t)Width * Height, ButtonsX * ButtonsY * strlen("Button") };
+    return work;
+}
+
+// A panel that doesn't change between frames, drawn with dirty rectangle tracking on so
+// that ImGui can skip the widgets it drew last frame. Update is timed too, as the cache
+// relies on it to know what has been presented.
+static Work DrawStaticPanel(Context& context, int iterations, bool caching)
+{
+    const int Width = 300, Height = 200, ButtonsX = 3, ButtonsY = 4;
+    const int ButtonWidth = 90, ButtonHeight = 40;
+
+    bool wasCaching = Pixie::ImGui::IsCachingEnabled();
+    Pixie::ImGui::SetCaching(caching);
+    context.window->SetDirtyRectTracking(true);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        Pixie::ImGui::Begin(context.window, context.font);
+        Pixie::ImGui::FilledRect(20, 20, Width, Height, MAKE_RGB(40, 40, 40), MAKE_RGB(68, 79, 103));
+        for (int k = 0; k < ButtonsX * ButtonsY; k++)
+            Pixie::ImGui::Button("Button", 30 + ((k % ButtonsX) * (ButtonWidth + 5)), 30 + ((k / ButtonsX) * (ButtonHeight + 5)), ButtonWidth, ButtonHeight);
+        Pixie::ImGui::End();
+        context.window->Update();
+    }
+
+    context.window->SetDirtyRectTracking(false);
+    Pixie::ImGui::SetCaching(wasCaching);
+
+    Work work = { (uint64_t)Width * Height, ButtonsX * ButtonsY * strlen("Button") };
+    return work;
+}
+
+static Work BenchStaticPanel(Context& context, int iterations)
+{
+    return DrawStaticPanel(context, iterations, false);
+}
+
+static Work BenchStaticPanelCached(Context& context, int iterations)
+{
+    return DrawStaticPanel(context, iterations, true);
+}
+
+// Fills the buffer with rows of text.
+static Work DrawTextRows(Context& context, int iterations, bool useColour, Pixie::BlendMode mode)
+{
+    Pixie::Font* font = context.font;
+    int charWidth = font->GetCharacterWidth();
+    int charHeight = font->GetCharacterHeight();
+    int columns = std::min(context.width / charWidth, (int)sizeof(s_text) - 1);
+    int rows = context.height / charHeight;
+
+    char line[sizeof(s_text)];
+    memcpy(line, s_text, columns);
+    line[columns] = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int j = 0; j < rows; j++)
+        {
+            if (useColour)
+                font->DrawColour(line, 0, j * charHeight, MAKE_ARGB(160, 255, 255, 0), context.window, mode);
+            else
+                font->Draw(line, 0, j * charHeight, context.window);
+        }
+    }
+
+    uint64_t glyphs = (uint64_t)columns * rows;
+    Work work = { glyphs * charWidth * charHeight, glyphs };
+    return work;
+}
+
+static Work BenchFontDraw(Context& context, int iterations)
+{
+    return DrawTextRows(context, iterations, false, Pixie::BlendMode_Opaque);
+}
+
+static Work BenchFontDrawColour(Context& context, int iterations)
+{
+    return DrawTextRows(context, iterations, true, Pixie::BlendMode_Opaque);
+}
+
+static Work BenchFontDrawBlend(Context& context, int iterations)
+{
+    return DrawTextRows(context, iterations, true, Pixie::BlendMode_SrcOver);
+}
+
+// Fills the buffer with rows of anti-aliased text. After the first iteration the layouts
+// and glyphs all come from the font's caches.
+static Work BenchTrueTypeDraw(Context& context, int iterations)
+{
+    const int Size = 16;
+    Pixie::TrueTypeFont* font = context.trueTypeFont;
+    int lineHeight = font->GetLineHeight(Size);
+    int rows = context.height / lineHeight;
+
+    // As many characters as fit in a row.
+    char line[sizeof(s_text)];
+    int columns = 0;
+    for (int width = 0; columns < (int)sizeof(s_text) - 1; columns++)
+    {
+        char c[2] = { s_text[columns], 0 };
+        width += font->GetStringWidth(c, Size);
+        if (width > context.width)
+            break;
+    }
+    memcpy(line, s_text, columns);
+    line[columns] = 0;
+    int lineWidth = font->GetStringWidth(line, Size);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int j = 0; j < rows; j++)
+            font->DrawColour(line, 0, j * lineHeight, Size, MAKE_RGB(255, 255, 0), context.window);
+    }
+
+    Work work = { (uint64_t)lineWidth * lineHeight * rows, (uint64_t)columns * rows };
+    return work;
+}
+
+// Draws every printable character at a different size each iteration. There are more
+// sizes than fit in the glyph cache, so every glyph is rasterized.
+static Work BenchTrueTypeRasterize(Context& context, int iterations)
+{
+    const int MinSize = 16, NumSizes = 32, Glyphs = 95;
+    Pixie::TrueTypeFont* font = context.trueTypeFont;
+
+    char line[Glyphs + 1];
+    memcpy(line, s_text, Glyphs);
+    line[Glyphs] = 0;
+
+    static int s_size = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        font->DrawColour(line, 0, 0, MinSize + s_size, MAKE_RGB(255, 255, 0), context.window);
+        s_size = (s_size + 1) % NumSizes;
+    }
+
+    Work work = { 0, Glyphs };
+    return work;
+}
+
+// Blits 64 sprites spread over the buffer, as the ImGui benchmarks draw rectangles.
+enum BlitType
+{
+    BlitType_Opaque,
+    BlitType_Keyed,
+    BlitType_Alpha,
+    BlitType_Scaled,
+};
+
+static Work BlitSprites(Context& context, int iterations, BlitType type)
+{
+    const int Count = 64;
+    Pixie::Surface sprite(s_sprite, SpriteSize, SpriteSize, SpriteSize);
+    Pixie::Surface surface = context.window->GetSurface();
+    int size = type == BlitType_Scaled ? SpriteSize * 2 : SpriteSize;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int j = 0; j < Count; j++)
+        {
+            int x, y;
+            GetPosition(context, j, size, size, x, y);
+            switch (type)
+            {
+                case BlitType_Opaque: Pixie::Blit(surface, x, y, sprite); break;
+                case BlitType_Keyed: Pixie::BlitKeyed(surface, x, y, sprite, SpriteKey); break;
+                case BlitType_Alpha: Pixie::BlitAlpha(surface, x, y, sprite); break;
+                case BlitType_Scaled: Pixie::BlitScaled(surface, x, y, size, size, sprite); break;
+            }
+        }
+    }
+
+    Work work = { (uint64_t)Count * size * size, 0 };
+    return work;
+}
+
+static Work BenchBlit(Context& context, int iterations)
+{
+    return BlitSprites(context, iterations, BlitType_Opaque);
+}
+
+static Work BenchBlitKeyed(Context& context, int iterations)
+{
+    return BlitSprites(context, iterations, BlitType_Keyed);
+}
+
+static Work BenchBlitAlpha(Context& context, int iterations)
+{
+    return BlitSprites(context, iterations, BlitType_Alpha);
+}
+
+static Work BenchBlitScaled(Context& context, int iterations)
+{
+    return BlitSprites(context, iterations, BlitType_Scaled);
+}
+
+// Scales a smaller frame up to fill the buffer, as Window does when presenting to a
+// window larger than its buffer. divisor is in tenths, so 20 scales a half size frame by
+// a whole number and 25 doesn't.
+static Work ScaleFrame(Context& context, int iterations, Pixie::ScaleFilter filter, int divisor)
+{
+    static std::vector<uint32_t> s_frame;
+    int width = (context.width * 10) / divisor;
+    int height = (context.height * 10) / divisor;
+    if (s_frame.size() < (size_t)width * height)
+        s_frame.resize((size_t)width * height);
+    for (size_t i = 0; i < (size_t)width * height; i++)
+        s_frame[i] = (uint32_t)i * 2654435761u;
+
+    Pixie::Scaler scaler;
+    scaler.Init(width, height, context.width, context.height, filter, false);
+    Pixie::Surface frame(s_frame.data(), width, height, width);
+    Pixie::Surface surface = context.window->GetSurface();
+    Pixie::SurfaceRect rect = { 0, 0, context.width, context.height };
+    for (int i = 0; i < iterations; i++)
+        scaler.Scale(surface, frame, rect);
+
+    Work work = { (uint64_t)context.width * context.height, 0 };
+    return work;
+}
+
+static Work BenchScaleNearest2(Context& context, int iterations)
+{
+    return ScaleFrame(context, iterations, Pixie::ScaleFilter_Nearest, 20);
+}
+
+static Work BenchScaleNearest25(Context& context, int iterations)
+{
+    return ScaleFrame(context, iterations, Pixie::ScaleFilter_Nearest, 25);
+}
+
+static Work BenchScaleBilinear25(Context& context, int iterations)
+{
+    return ScaleFrame(context, iterations, Pixie::ScaleFilter_Bilinear, 25);
+}
+
+static void OnKey(Pixie::Key key, bool down)
+{
+    (void)key;
+    (void)down;
+}
+
+// A key tapped each frame and the questions ImGui::Input asks of the key state. With no
+// key left down, IsAnyKeyDown and HasAnyKeyGoneDown have to look at every key.
+static Work BenchKeyState(Context& context, int iterations)
+{
+    Pixie::Window* window = context.window;
+    window->SetKeyCallback(OnKey);
+
+    // Each tap queues two input events, which are taken as an app would so that the
+    // queue doesn't fill up and start dropping them.
+    int anyKey = 0;
+    Pixie::InputEvent event;
+    for (int i = 0; i < iterations; i++)
+    {
+        int key = 'A' + (i & 15);
+        window->SetKeyDown(key, true);
+        window->SetKeyDown(key, false);
+        anyKey += window->IsAnyKeyDown();
+        anyKey += window->HasAnyKeyGoneDown();
+        anyKey += window->IsKeyDown(Pixie::Key_Left);
+        while (window->PollInputEvent(event))
+            anyKey += event.code;
+    }
+
+    // Keep the answers from being optimised away.
+    window->GetPixels()[0] = anyKey;
+
+    window->SetKeyCallback(0);
+    Work work = { 0, 0 };
+    return work;
+}
+
+static Work BenchUpdate(Context& context, int iterations)
+{
+    // Without dirty rectangle tracking every Update presents the whole buffer.
+    for (int i = 0; i < iterations; i++)
+        context.window->Update();
+
+    // The headless platform has nothing to present to, so no pixels are moved and only
+    // the time is reported.
+#if PIXIE_PLATFORM_HEADLESS
+    Work work = { 0, 0 };
+#else
+    Work work = { (uint64_t)context.width * context.height, 0 };
+#endif
+    return work;
+}
+
+static const Benchmark Benchmarks[] =
+{
+    { "JobSystem::Clear", BenchClear },
+    { "ImGui::FilledRect/full", BenchFilledRectFull },
+    { "ImGui::FilledRect/blend", BenchFilledRectBlend },
+    { "ImGui::FilledRect/100x100", BenchFilledRect },
+    { "ImGui::Rect/100x100", BenchRect },
+    { "ImGui::Button", BenchButton },
+    { "ImGui::Input", BenchInput },
+    { "ImGui::Panels", BenchPanels },
+    { "ImGui::StaticPanel", BenchStaticPanel },
+    { "ImGui::StaticPanel/cached", BenchStaticPanelCached },
+    { "Font::Draw", BenchFontDraw },
+    { "Font::DrawColour", BenchFontDrawColour },
+    { "Font::DrawColour/blend", BenchFontDrawBlend },
+    { "TrueTypeFont::Draw", BenchTrueTypeDraw },
+    { "TrueTypeFont::Rasterize", BenchTrueTypeRasterize },
+    { "Blit/64x64", BenchBlit },
+    { "BlitKeyed/64x64", BenchBlitKeyed },
+    { "BlitAlpha/64x64", BenchBlitAlpha },
+    { "BlitScaled/128x128", BenchBlitScaled },
+    { "Scaler::Nearest/x2", BenchScaleNearest2 },
+    { "Scaler::Nearest/x2.5", BenchScaleNearest25 },
+    { "Scaler::Bilinear/x2.5", BenchScaleBilinear25 },
+    { "Window::KeyState", BenchKeyState },
+    { "Window::Update", BenchUpdate },
+};
+
+static double Now()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::nano>>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Times one repetition of iterations operations, returning nanoseconds.
+static double TimeRepetition(const Benchmark& benchmark, Context& context, int iterations, Work& work)
+{
+    double start = Now();
+    work = benchmark.fn(context, iterations);
+    return Now() - start;
+}
+
+static Result Run(const Benchmark& benchmark, Context& context, int repetitions, double minTimeNs)
+{
+    Result result;
+    result.name = benchmark.name;
+    result.width = context.width;
+    result.height = context.height;
+
+    // Double the iterations until a repetition takes long enough to time reliably. This
+    // also warms up the caches.
+    int iterations = 1;
+    while (TimeRepetition(benchmark, context, iterations, result.work) < minTimeNs && iterations < (1 << 24))
+        iterations *= 2;
+    result.iterations = iterations;
+
+    std::vector<double> times(repetitions);
+    for (int i = 0; i < repetitions; i++)
+        times[i] = TimeRepetition(benchmark, context, iterations, result.work) / iterations;
+
+    std::sort(times.begin(), times.end());
+    result.medianNs = times[repetitions / 2];
+    result.minNs = times[0];
+
+    double sum = 0.0;
+    for (int i = 0; i < repetitions; i++)
+        sum += times[i];
+    result.meanNs = sum / repetitions;
+
+    double variance = 0.0;
+    for (int i = 0; i < repetitions; i++)
+        variance += (times[i] - result.meanNs) * (times[i] - result.meanNs);
+    result.stddevNs = sqrt(variance / repetitions);
+
+    return result;
+}
+
+static void PrintResult(const Result& result)
+{
+    char resolution[32];
+    sprintf_s(resolution, sizeof(resolution), "%dx%d", result.width, result.height);
+
+    double pixelsPerSecond = result.work.pixels / (result.medianNs * 1e-9);
+    printf("%-10s %-26s %12.1f ns  +-%5.1f%%", resolution, result.name,
+        result.medianNs, 100.0 * result.stddevNs / result.meanNs);
+    if (result.work.pixels)
+        printf("  %9.1f Mpixels/s", pixelsPerSecond * 1e-6);
+    if (result.work.glyphs)
+        printf("  %7.2f ns/glyph", result.medianNs / result.work.glyphs);
+    printf("\n");
+}
+
+static bool WriteJson(const char* filename, const std::vector<Result>& results, int repetitions, int threads)
+{
+    FILE* file = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"simd\": \"%s\",\n", SimdLevelNames[Pixie::Simd::GetLevel()]);
+    fprintf(file, "  \"threads\": %d,\n", threads);
+    fprintf(file, "  \"repetitions\": %d,\n", repetitions);
+    fprintf(file, "  \"results\": [\n");
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"width\": %d, \"height\": %d, \"iterations\": %d, ",
+            result.name, result.width, result.height, result.iterations);
+        fprintf(file, "\"median_ns\": %.1f, \"min_ns\": %.1f, \"mean_ns\": %.1f, \"stddev_ns\": %.1f, ",
+            result.medianNs, result.minNs, result.meanNs, result.stddevNs);
+        fprintf(file, "\"pixels\": %llu, \"pixels_per_second\": %.0f",
+            (unsigned long long)result.work.pixels, result.work.pixels / (result.medianNs * 1e-9));
+        if (result.work.glyphs)
+            fprintf(file, ", \"glyphs\": %llu, \"ns_per_glyph\": %.3f",
+                (unsigned long long)result.work.glyphs, result.medianNs / result.work.glyphs);
+        fprintf(file, " }%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    bool ok = !ferror(file);
+    if (file != stdout)
+        ok &= fclose(file) == 0;
+    return ok;
+}
+
+static void PrintUsage()
+{
+    printf("usage: pixie_bench [--reps N] [--min-time MS] [--simd scalar|sse2|avx2] [--filter NAME] [--json FILE] [--ttf FILE] [--pad-rows] [--huge-pages]\n");
+}
+
+int main(int argc, char** argv)
+{
+    int repetitions = 15;
+    double minTimeMs = 5.0;
+    const char* filter = 0;
+    const char* jsonFile = 0;
+    const char* ttfFile = 0;
+    uint32_t bufferFlags = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : 0;
+
+        if (strcmp(arg, "--pad-rows") == 0)
+        {
+            bufferFlags |= Pixie::BufferFlag_PadRows;
+            continue;
+        }
+        if (strcmp(arg, "--huge-pages") == 0)
+        {
+            bufferFlags |= Pixie::BufferFlag_HugePages;
+            continue;
+        }
+
+        if (strcmp(arg, "--reps") == 0 && value)
+            repetitions = std::max(1, atoi(value));
+        else if (strcmp(arg, "--min-time") == 0 && value)
+            minTimeMs = atof(value);
+        else if (strcmp(arg, "--filter") == 0 && value)
+            filter = value;
+        else if (strcmp(arg, "--json") == 0 && value)
+            jsonFile = value;
+        else if (strcmp(arg, "--ttf") == 0 && value)
+            ttfFile = value;
+        else if (strcmp(arg, "--simd") == 0 && value)
+        {
+            int level;
+            for (level = 0; level < Pixie::Simd::Level_Num; level++)
+                if (strcmp(value, SimdLevelNames[level]) == 0)
+                    break;
+            if (level == Pixie::Simd::Level_Num)
+            {
+                PrintUsage();
+                return 1;
+            }
+            Pixie::Simd::SetLevel((Pixie::Simd::Level)level);
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+        i++;
+    }
+
+    Pixie::Font font;
+    if (!font.Load("font.bmp", 9, 16))
+    {
+        printf("pixie_bench: failed to load font.bmp\n");
+        return 1;
+    }
+
+    Pixie::TrueTypeFont trueTypeFont;
+    if (ttfFile && !trueTypeFont.Load(ttfFile))
+    {
+        printf("pixie_bench: failed to load %s\n", ttfFile);
+        return 1;
+    }
+
+    MakeSprite();
+    for (int i = 0; i < (int)sizeof(s_text) - 1; i++)
+        s_text[i] = (char)(32 + (i % 95));
+
+    Pixie::JobSystem jobs;
+    std::vector<Result> results;
+
+    // JSON on stdout replaces the table.
+    bool printTable = !jsonFile || strcmp(jsonFile, "-") != 0;
+    if (printTable)
+        printf("simd %s, %d threads, %d repetitions\n", SimdLevelNames[Pixie::Simd::GetLevel()], jobs.GetNumThreads(), repetitions);
+
+    for (const Resolution& resolution : Resolutions)
+    {
+        Pixie::Window window;
+        window.SetBufferFlags(bufferFlags);
+        if (!window.Open(TEXT("pixie_bench"), resolution.width, resolution.height, false))
+        {
+            printf("pixie_bench: failed to open a %dx%d window\n", resolution.width, resolution.height);
+            return 1;
+        }
+
+        Context context;
+        context.window = &window;
+        context.font = &font;
+        context.trueTypeFont = ttfFile ? &trueTypeFont : 0;
+        context.jobs = &jobs;
+        context.width = resolution.width;
+        context.height = resolution.height;
+
+        for (const Benchmark& benchmark : Benchmarks)
+        {
+            if (filter && !strstr(benchmark.name, filter))
+                continue;
+            if (!context.trueTypeFont && strncmp(benchmark.name, "TrueTypeFont::", 14) == 0)
+                continue;
+
+            Result result = Run(benchmark, context, repetitions, minTimeMs * 1e6);
+            results.push_back(result);
+            if (printTable)
+                PrintResult(result);
+        }
+
+        window.Close();
+    }
+
+    if (jsonFile && !WriteJson(jsonFile, results, repetitions, jobs.GetNumThreads()))
+    {
+        printf("pixie_bench: failed to write %s\n", jsonFile);
+        return 1;
+    }
+
+    return 0;
+}
@@ -8,21 +8,52 @@
 //
 //#define PIXIE_NORMALISE_MAIN
 
+// PIXIE_PROFILER controls whether PIXIE_PROFILE_ZONE records anything (see
+// profiler.h). Define it to 0 to compile the zones out entirely.
+#ifndef PIXIE_PROFILER
+#define PIXIE_PROFILER 1
+#endif
+
 #ifdef _WIN32
 #define PIXIE_PLATFORM_WIN 1
 #elif __APPLE__
 #define PIXIE_PLATFORM_OSX 1
+#elif __linux__
+// Linux builds have no window system; the window renders into an offscreen
+// buffer only (see pixie_headless.cpp).
+#define PIXIE_PLATFORM_HEADLESS 1
 #else
 #error "Unsupported platform"
 #endif
 
 #if PIXIE_PLATFORM_OSX
 #define strcat_s(dst, size, src) strlcat(dst, src, size)
+#elif PIXIE_PLATFORM_HEADLESS
+#define strcat_s(dst, size, src) strncat(dst, src, (size) - strlen(dst) - 1)
+#endif
+
+#if PIXIE_PLATFORM_OSX || PIXIE_PLATFORM_HEADLESS
 #define sprintf_s(dst, size, fmt, ...) snprintf(dst, size, fmt, __VA_ARGS__)
 #define strcpy_s(dst, size, src) snprintf(dst, size, "%s", src)
 #endif
 
 #define MAKE_RGB(r, g, b) ((b)|((g)<<8)|((r)<<16))
+#define MAKE_ARGB(a, r, g, b) (MAKE_RGB(r, g, b)|((uint32_t)(a)<<24))
+
+namespace Pixie
+{
+    // How drawing combines a colour with the pixels already there. Opaque overwrites them
+    // and ignores alpha; the other modes take an ARGB colour with straight (not
+    // premultiplied) alpha, made with MAKE_ARGB.
+    enum BlendMode
+    {
+        BlendMode_Opaque = 0,
+        BlendMode_SrcOver,      // colour * alpha + dst * (1 - alpha)
+        BlendMode_Additive,     // dst + colour * alpha, saturated
+        BlendMode_Multiply,     // dst * colour * alpha + dst * (1 - alpha)
+        BlendMode_Num
+    };
+}
 
 #if PIXIE_PLATFORM_WIN
 #if !defined(__MINGW32__)
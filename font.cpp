@@ -1,207 +1,235 @@
 #include "core.h"
-#include <stdio.h>
-#include <stdlib.h>
+#include <string.h>
 #include "font.h"
+#include "image.h"
 #include "pixie.h"
-#if !PIXIE_PLATFORM_WIN
-#include <string.h>
-#endif
+#include "simd.h"
+#include "profiler.h"
 
-#if PIXIE_PLATFORM_OSX
-struct BITMAPFILEHEADER
+using namespace Pixie;
+
+struct CodePageEntry
 {
-    uint16_t	bfType;
-    uint32_t	bfSize;
-    uint16_t	bfReserved1;
-    uint16_t	bfReserved2;
-    uint32_t	bfOffBits;
-} __attribute__((packed));
-
-struct BITMAPINFOHEADER
+    uint16_t codepoint;
+    uint8_t glyph;
+};
+
+// The characters of code page 437 outside ASCII, sorted by codepoint. The control
+// characters have glyphs as well.
+static const CodePageEntry CodePage437[] =
 {
-    uint32_t biSize;
-    int32_t	biWidth;
-    int32_t	biHeight;
-    uint16_t	biPlanes;
-    uint16_t	biBitCount;
-    uint32_t	biCompression;
-    uint32_t	biSizeImage;
-    int32_t	biXPelsPerMeter;
-    int32_t	biYPelsPerMeter;
-    uint32_t	biClrUsed;
-    uint32_t	biClrImportant;
-} __attribute__((packed));
-
-#define BI_RGB 0
-#endif
+    { 0x00a0, 0xff }, { 0x00a1, 0xad }, { 0x00a2, 0x9b }, { 0x00a3, 0x9c }, { 0x00a5, 0x9d }, { 0x00a7, 0x15 },
+    { 0x00aa, 0xa6 }, { 0x00ab, 0xae }, { 0x00ac, 0xaa }, { 0x00b0, 0xf8 }, { 0x00b1, 0xf1 }, { 0x00b2, 0xfd },
+    { 0x00b5, 0xe6 }, { 0x00b6, 0x14 }, { 0x00b7, 0xfa }, { 0x00ba, 0xa7 }, { 0x00bb, 0xaf }, { 0x00bc, 0xac },
+    { 0x00bd, 0xab }, { 0x00bf, 0xa8 }, { 0x00c4, 0x8e }, { 0x00c5, 0x8f }, { 0x00c6, 0x92 }, { 0x00c7, 0x80 },
+    { 0x00c9, 0x90 }, { 0x00d1, 0xa5 }, { 0x00d6, 0x99 }, { 0x00dc, 0x9a }, { 0x00df, 0xe1 }, { 0x00e0, 0x85 },
+    { 0x00e1, 0xa0 }, { 0x00e2, 0x83 }, { 0x00e4, 0x84 }, { 0x00e5, 0x86 }, { 0x00e6, 0x91 }, { 0x00e7, 0x87 },
+    { 0x00e8, 0x8a }, { 0x00e9, 0x82 }, { 0x00ea, 0x88 }, { 0x00eb, 0x89 }, { 0x00ec, 0x8d }, { 0x00ed, 0xa1 },
+    { 0x00ee, 0x8c }, { 0x00ef, 0x8b }, { 0x00f1, 0xa4 }, { 0x00f2, 0x95 }, { 0x00f3, 0xa2 }, { 0x00f4, 0x93 },
+    { 0x00f6, 0x94 }, { 0x00f7, 0xf6 }, { 0x00f9, 0x97 }, { 0x00fa, 0xa3 }, { 0x00fb, 0x96 }, { 0x00fc, 0x81 },
+    { 0x00ff, 0x98 }, { 0x0192, 0x9f }, { 0x0393, 0xe2 }, { 0x0398, 0xe9 }, { 0x03a3, 0xe4 }, { 0x03a6, 0xe8 },
+    { 0x03a9, 0xea }, { 0x03b1, 0xe0 }, { 0x03b4, 0xeb }, { 0x03b5, 0xee }, { 0x03c0, 0xe3 }, { 0x03c3, 0xe5 },
+    { 0x03c4, 0xe7 }, { 0x03c6, 0xed }, { 0x2022, 0x07 }, { 0x203c, 0x13 }, { 0x207f, 0xfc }, { 0x20a7, 0x9e },
+    { 0x2190, 0x1b }, { 0x2191, 0x18 }, { 0x2192, 0x1a }, { 0x2193, 0x19 }, { 0x2194, 0x1d }, { 0x2195, 0x12 },
+    { 0x21a8, 0x17 }, { 0x2219, 0xf9 }, { 0x221a, 0xfb }, { 0x221e, 0xec }, { 0x221f, 0x1c }, { 0x2229, 0xef },
+    { 0x2248, 0xf7 }, { 0x2261, 0xf0 }, { 0x2264, 0xf3 }, { 0x2265, 0xf2 }, { 0x2302, 0x7f }, { 0x2310, 0xa9 },
+    { 0x2320, 0xf4 }, { 0x2321, 0xf5 }, { 0x2500, 0xc4 }, { 0x2502, 0xb3 }, { 0x250c, 0xda }, { 0x2510, 0xbf },
+    { 0x2514, 0xc0 }, { 0x2518, 0xd9 }, { 0x251c, 0xc3 }, { 0x2524, 0xb4 }, { 0x252c, 0xc2 }, { 0x2534, 0xc1 },
+    { 0x253c, 0xc5 }, { 0x2550, 0xcd }, { 0x2551, 0xba }, { 0x2552, 0xd5 }, { 0x2553, 0xd6 }, { 0x2554, 0xc9 },
+    { 0x2555, 0xb8 }, { 0x2556, 0xb7 }, { 0x2557, 0xbb }, { 0x2558, 0xd4 }, { 0x2559, 0xd3 }, { 0x255a, 0xc8 },
+    { 0x255b, 0xbe }, { 0x255c, 0xbd }, { 0x255d, 0xbc }, { 0x255e, 0xc6 }, { 0x255f, 0xc7 }, { 0x2560, 0xcc },
+    { 0x2561, 0xb5 }, { 0x2562, 0xb6 }, { 0x2563, 0xb9 }, { 0x2564, 0xd1 }, { 0x2565, 0xd2 }, { 0x2566, 0xcb },
+    { 0x2567, 0xcf }, { 0x2568, 0xd0 }, { 0x2569, 0xca }, { 0x256a, 0xd8 }, { 0x256b, 0xd7 }, { 0x256c, 0xce },
+    { 0x2580, 0xdf }, { 0x2584, 0xdc }, { 0x2588, 0xdb }, { 0x258c, 0xdd }, { 0x2590, 0xde }, { 0x2591, 0xb0 },
+    { 0x2592, 0xb1 }, { 0x2593, 0xb2 }, { 0x25a0, 0xfe }, { 0x25ac, 0x16 }, { 0x25b2, 0x1e }, { 0x25ba, 0x10 },
+    { 0x25bc, 0x1f }, { 0x25c4, 0x11 }, { 0x25cb, 0x09 }, { 0x25d8, 0x08 }, { 0x25d9, 0x0a }, { 0x263a, 0x01 },
+    { 0x263b, 0x02 }, { 0x263c, 0x0f }, { 0x2640, 0x0c }, { 0x2642, 0x0b }, { 0x2660, 0x06 }, { 0x2663, 0x05 },
+    { 0x2665, 0x03 }, { 0x2666, 0x04 }, { 0x266a, 0x0d }, { 0x266b, 0x0e },
+};
+
+static const int CodePage437Size = sizeof(CodePage437) / sizeof(CodePage437[0]);
+
+// Returns the glyph for a codepoint.
+static uint8_t GetGlyph(uint32_t codepoint)
+{
+    if (codepoint < 0x80)
+        return (uint8_t)codepoint;
+    if (IsRawByte(codepoint))
+        return (uint8_t)(codepoint - RawByteBase);
 
-using namespace Pixie;
+    int low = 0, high = CodePage437Size;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (CodePage437[mid].codepoint < codepoint)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low < CodePage437Size && CodePage437[low].codepoint == codepoint)
+        return CodePage437[low].glyph;
+    return '?';
+}
 
 Font::~Font()
 {
     delete[] m_fontBuffer;
+    delete[] m_glyphMasks;
 }
 
 bool Font::Load(const char* filename, int characterSizeX, int characterSizeY)
 {
-    m_characterSizeX = characterSizeX;
-    m_characterSizeY = characterSizeY;
-
-    FILE* infile = fopen(filename, "rb");
-    if (!infile)
+    // Glyph rows are stored as one 64-bit coverage mask each.
+    if (characterSizeX <= 0 || characterSizeX > 64 || characterSizeY <= 0)
         return false;
 
-    BITMAPFILEHEADER bmfh;
-    fread(&bmfh, sizeof(bmfh), 1, infile);
-    if (bmfh.bfType != 0x4d42) // 'MB'
-    {
-        fclose(infile);
-        return false;
-    }
-
-    BITMAPINFOHEADER bmih;
-    fread(&bmih, sizeof(bmih), 1, infile);
-    if (bmih.biSize != sizeof(bmih))
-    {
-        fclose(infile);
+    Image image;
+    if (!image.Load(filename))
         return false;
-    }
 
-    if ((bmih.biBitCount != 32 && bmih.biBitCount != 24) || bmih.biCompression != BI_RGB)
-    {
-        fclose(infile);
+    // The characters are side by side along the top of the image.
+    int width = 256 * characterSizeX;
+    if (image.GetWidth() < width || image.GetHeight() < characterSizeY)
         return false;
-    }
-
-    fseek(infile, bmfh.bfOffBits, SEEK_SET);
 
-    m_width = bmih.biWidth;
-    m_height = abs(bmih.biHeight);
-
-    uint32_t size = 256 * m_characterSizeX * m_characterSizeY;
-    m_fontBuffer = new uint32_t[size];
+    m_characterSizeX = characterSizeX;
+    m_characterSizeY = characterSizeY;
+    m_width = width;
+    m_height = characterSizeY;
 
-    if (bmih.biBitCount == 32)
+    // Take the image's pixels when they're exactly the character set, as they usually are.
+    delete[] m_fontBuffer;
+    if (image.GetWidth() == width && image.GetHeight() == characterSizeY)
     {
-        fread(m_fontBuffer, 1, size * 4, infile);
+        m_fontBuffer = image.Release();
     }
-    else if (bmih.biBitCount == 24)
+    else
     {
-        // read into 24bit buf and expand
-        uint8_t* buf24 = new uint8_t[size * 3];
-        fread(buf24, 1, size * 3, infile);
-
-        uint8_t* pcurr = buf24;
-        for (uint32_t i = 0; i < size; ++i)
-        {
-            // from: R,G,B
-            // to:   xRGB
-            m_fontBuffer[i] =
-                0xff000000 |
-                (*(pcurr) << 16) |
-                (*(pcurr + 1) << 8) |
-                (*(pcurr + 2));
-
-            pcurr += 3;
-        }
-
-        delete[] buf24;
+        m_fontBuffer = new uint32_t[width * characterSizeY];
+        for (int y = 0; y < characterSizeY; y++)
+            memcpy(m_fontBuffer + (y * width), image.GetPixels() + (y * image.GetWidth()), width * sizeof(uint32_t));
     }
 
-    // if we don't have a negative height, the bmp is stored upside-down, so go through and flip it
-    if (bmih.biHeight > 0)
-    {
-        uint32_t* rowbuf = new uint32_t[m_width];
-        // flip all rows apart from the middle one if the image has an odd height
-        // h = 4; h/2 = 2; y 0,fy 3 | y 1,fy 2
-        // h = 5; h/2 = 2; y 0,fy 4 | y 1,fy 3  [row 2 unchanged]
-        for (uint32_t y = 0; y < m_height / 2; ++y)
-        {
-            uint32_t flipy = (m_height - (y + 1));
+    BuildGlyphMasks();
 
-            void* row = m_fontBuffer + (m_width * y);
-            void* fliprow = m_fontBuffer + (m_width * flipy);
-            uint32_t rowsize = m_width * sizeof(uint32_t);
+    return true;
+}
 
-            // 1. copy fliprow into rowbuf
-            memcpy(rowbuf, fliprow, rowsize);
+void Font::BuildGlyphMasks()
+{
+    // Build a coverage bitmask for each glyph row, where bit n is set if texel n of the
+    // row is not black. Drawing only needs to know which texels are covered, and the
+    // masks are a fraction of the size of the 32-bit font buffer so they stay in cache.
+    delete[] m_glyphMasks;
+    m_glyphMasks = new uint64_t[256 * m_characterSizeY];
+
+    int stride = 256 * m_characterSizeX;
+    for (int c = 0; c < 256; c++)
+    {
+        const uint32_t* charStart = m_fontBuffer + (c * m_characterSizeX);
+        uint64_t* mask = m_glyphMasks + (c * m_characterSizeY);
 
-            // 2. copy row into fliprow
-            memcpy(fliprow, row, rowsize);
+        for (int cy = 0; cy < m_characterSizeY; cy++)
+        {
+            const uint32_t* row = charStart + (cy * stride);
+            uint64_t bits = 0;
+            for (int cx = 0; cx < m_characterSizeX; cx++)
+            {
+                if (row[cx] & 0xffffff)
+                    bits |= (uint64_t)1 << cx;
+            }
 
-            // 3. copy rowbuf into row
-            memcpy(row, rowbuf, rowsize);
+            mask[cy] = bits;
         }
-
-        delete[] rowbuf;
     }
-
-    fclose(infile);
-
-    return true;
 }
 
 void Font::Draw(const char* msg, int x, int y, Pixie::Window* window)
 {
-    uint32_t* pixels = window->GetPixels();
-    int width = window->GetWidth();
-    int height = window->GetHeight();
+    DrawInternal(msg, x, y, 0, false, BlendMode_Opaque, window->GetSurface());
+}
 
-    for ( ; *msg; msg++)
-    {
-        uint8_t c = *msg;
-        uint32_t* charStart = m_fontBuffer + (c * m_characterSizeX);
+void Font::Draw(const char* msg, int x, int y, const Surface& target)
+{
+    DrawInternal(msg, x, y, 0, false, BlendMode_Opaque, target);
+}
 
-        for (int cx = 0; cx < m_characterSizeX; cx++)
-        {
-            for (int cy = 0; cy < m_characterSizeY; cy++)
-            {
-                int sx = cx + x;
-                int sy = cy + y;
-                if (sx >= 0 && sx < width && sy >= 0 && sy < height)
-                {
-                    uint32_t pixel = charStart[cx + (cy * 256 * m_characterSizeX)];
-                    if (pixel & 0xffffff)
-                        pixels[sx+(sy*width)] = pixel;
-                }
-            }
-        }
+void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window, BlendMode mode)
+{
+    DrawInternal(msg, x, y, colour, true, mode, window->GetSurface());
+}
 
-        x += m_characterSizeX;
-    }
+void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, const Surface& target, BlendMode mode)
+{
+    DrawInternal(msg, x, y, colour, true, mode, target);
 }
 
-void Font::DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window)
+void Font::DrawInternal(const char* msg, int x, int y, uint32_t colour, bool useColour, BlendMode mode, const Surface& target)
 {
-    uint32_t* pixels = window->GetPixels();
-    int width = window->GetWidth();
-    int height = window->GetHeight();
+    PIXIE_PROFILE_ZONE("Font::Draw");
+
+    const SurfaceRect& clip = target.GetClipRect();
+    int pitch = target.GetStride();
+    int stride = 256 * m_characterSizeX;
+
+    // Clip vertically once for the whole string.
+    int top = y < clip.top ? clip.top - y : 0;
+    int bottom = y + m_characterSizeY > clip.bottom ? clip.bottom - y : m_characterSizeY;
+    if (top >= bottom)
+        return;
+
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    Simd::Blend blend = { 0, 0 };
+    if (useColour && mode != BlendMode_Opaque)
+        blend = Simd::MakeBlend(colour, mode);
 
-    for (; *msg; msg++)
+    int glyphX = x;
+    for ( ; *msg && glyphX < clip.right; glyphX += m_characterSizeX)
     {
-        uint8_t c = *msg;
-        uint32_t* charStart = m_fontBuffer + (c * m_characterSizeX);
+        int c = GetGlyph(DecodeUtf8(msg));
 
-        for (int cx = 0; cx < m_characterSizeX; cx++)
+        // Clip horizontally once per glyph.
+        int left = glyphX < clip.left ? clip.left - glyphX : 0;
+        int right = glyphX + m_characterSizeX > clip.right ? clip.right - glyphX : m_characterSizeX;
+        if (left >= right)
+            continue;
+
+        const uint64_t* mask = m_glyphMasks + (c * m_characterSizeY);
+        uint32_t* dst = target.GetRow(y + top) + glyphX + left;
+        int count = right - left;
+
+        // Drop the clipped texels from the row masks.
+        uint64_t clipMask = count == 64 ? ~(uint64_t)0 : (((uint64_t)1 << count) - 1);
+
+        if (useColour && mode != BlendMode_Opaque)
         {
-            for (int cy = 0; cy < m_characterSizeY; cy++)
-            {
-                int sx = cx + x;
-                int sy = cy + y;
-                if (sx >= 0 && sx < width && sy >= 0 && sy < height)
-                {
-                    uint32_t pixel = charStart[cx + (cy * 256 * m_characterSizeX)];
-                    if (pixel & 0xffffff)
-                        pixels[sx + (sy*width)] = colour;
-                }
-            }
+            for (int cy = top; cy < bottom; cy++, dst += pitch)
+                kernels.blendFillMasked(dst, (mask[cy] >> left) & clipMask, count, blend);
+        }
+        else if (useColour)
+        {
+            for (int cy = top; cy < bottom; cy++, dst += pitch)
+                kernels.fillMasked(dst, (mask[cy] >> left) & clipMask, count, colour);
+        }
+        else
+        {
+            const uint32_t* src = m_fontBuffer + (c * m_characterSizeX) + left + (top * stride);
+            for (int cy = top; cy < bottom; cy++, dst += pitch, src += stride)
+                kernels.copyMasked(dst, src, (mask[cy] >> left) & clipMask, count);
         }
-
-        x += m_characterSizeX;
     }
+
+    target.MarkDirty(x, y, glyphX - x, m_characterSizeY);
 }
 
 int Font::GetStringWidth(const char* msg) const
 {
-    return (int)strlen(msg) * m_characterSizeX;
+    int count = 0;
+    while (*msg)
+    {
+        DecodeUtf8(msg);
+        count++;
+    }
+    return count * m_characterSizeX;
 }
@@ -2,12 +2,18 @@
 
 #include <stdint.h>
 #include "core.h"
+#include "textlayout.h"
+#include "surface.h"
 
 namespace Pixie
 {
     class Window;
 
-    // BMP font loader. Expects the entire character set (256 ASCII characters) on one line.
+    // BMP font loader. Expects the entire character set (256 code page 437 characters) on
+    // one line. Strings are UTF-8, and characters outside code page 437 are drawn as '?'.
+    // Bytes that aren't valid UTF-8 are drawn as the code page 437 character they are.
+    // Drawing and measuring don't change the font, so once loaded it can be drawn from
+    // several threads at once, such as to the tiles of ParallelForTiles.
     class Font
     {
         public:
@@ -15,13 +21,19 @@ namespace Pixie
             ~Font();
 
             // Loads the font in the given BMP filename using the specified character size.
+            // Characters can be at most 64 pixels wide.
             bool Load(const char* filename, int characterSizeX, int characterSizeY);
 
             // Draws the specified font to the window in the font colour.
             void Draw(const char* msg, int x, int y, Pixie::Window* window);
 
-            // Draws the specified font to the window in the given colour.
-            void DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window);
+            // Draws the specified font to the surface, within its clip rectangle.
+            void Draw(const char* msg, int x, int y, const Surface& target);
+
+            // Draws the specified font to the window in the given colour. With a blend mode
+            // other than BlendMode_Opaque, the colour is ARGB and is blended with the window.
+            void DrawColour(const char* msg, int x, int y, uint32_t colour, Pixie::Window* window, BlendMode mode = BlendMode_Opaque);
+            void DrawColour(const char* msg, int x, int y, uint32_t colour, const Surface& target, BlendMode mode = BlendMode_Opaque);
 
             // Returns the width of the specified string in this font.
             int GetStringWidth(const char* msg) const;
@@ -33,7 +45,11 @@ namespace Pixie
             int GetCharacterWidth() const;
 
         private:
+            void DrawInternal(const char* msg, int x, int y, uint32_t colour, bool useColour, BlendMode mode, const Surface& target);
+            void BuildGlyphMasks();
+
             uint32_t* m_fontBuffer;
+            uint64_t* m_glyphMasks;
             uint32_t m_width;
             uint32_t m_height;
             uint8_t m_characterSizeX;
@@ -43,6 +59,7 @@ namespace Pixie
     inline Font::Font()
     {
         m_fontBuffer = 0;
+        m_glyphMasks = 0;
         m_width = m_height = 0;
     }
 
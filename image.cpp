@@ -0,0 +1,258 @@
+#include "core.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "image.h"
+#include "simd.h"
+#include "profiler.h"
+#if !PIXIE_PLATFORM_WIN
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace Pixie;
+
+// A read-only view of a whole file.
+class MappedFile
+{
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        bool Open(const char* filename);
+        void Close();
+
+        const uint8_t* GetData() const { return m_data; }
+        size_t GetSize() const { return m_size; }
+
+    private:
+        const uint8_t* m_data;
+        size_t m_size;
+};
+
+MappedFile::MappedFile()
+{
+    m_data = 0;
+    m_size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#if PIXIE_PLATFORM_WIN
+bool MappedFile::Open(const char* filename)
+{
+    Close();
+
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (uint64_t)size.QuadPart > (size_t)-1)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // The view keeps the file open, so the handles can be closed straight away.
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+
+    m_data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!m_data)
+        return false;
+
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    m_data = 0;
+    m_size = 0;
+}
+#else
+bool MappedFile::Open(const char* filename)
+{
+    Close();
+
+    int file = open(filename, O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size <= 0)
+    {
+        close(file);
+        return false;
+    }
+
+    // The whole file is about to be read, so where possible map it all in up front
+    // rather than taking a fault per page. The mapping keeps the file open, so it can be
+    // closed straight away.
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    void* data = mmap(0, (size_t)status.st_size, PROT_READ, flags, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = (const uint8_t*)data;
+    m_size = (size_t)status.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (m_data)
+        munmap((void*)m_data, m_size);
+    m_data = 0;
+    m_size = 0;
+}
+#endif
+
+// BMP data is little endian.
+static inline uint16_t ReadU16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t ReadU32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const uint32_t FileHeaderSize = 14;     // BITMAPFILEHEADER
+static const uint32_t InfoHeaderSize = 40;     // BITMAPINFOHEADER
+static const uint32_t CompressionRGB = 0;      // BI_RGB
+static const uint32_t CompressionBitfields = 3; // BI_BITFIELDS
+
+Image::Image()
+{
+    m_pixels = 0;
+    m_width = 0;
+    m_height = 0;
+}
+
+Image::~Image()
+{
+    Free();
+}
+
+void Image::Free()
+{
+    delete[] m_pixels;
+    m_pixels = 0;
+    m_width = 0;
+    m_height = 0;
+}
+
+uint32_t* Image::Release()
+{
+    uint32_t* pixels = m_pixels;
+    m_pixels = 0;
+    m_width = 0;
+    m_height = 0;
+    return pixels;
+}
+
+bool Image::Load(const char* filename)
+{
+    assert(filename);
+    PIXIE_PROFILE_ZONE("Image::Load");
+
+    MappedFile file;
+    if (!file.Open(filename))
+    {
+        Free();
+        return false;
+    }
+
+    return LoadMemory(file.GetData(), file.GetSize());
+}
+
+bool Image::LoadMemory(const void* data, size_t size)
+{
+    assert(data);
+
+    Free();
+
+    const uint8_t* file = (const uint8_t*)data;
+    if (size < FileHeaderSize + InfoHeaderSize || ReadU16(file) != 0x4d42) // 'BM'
+        return false;
+
+    // Later versions of the info header add fields to the end, so any of them will do.
+    const uint8_t* info = file + FileHeaderSize;
+    uint32_t infoSize = ReadU32(info);
+    if (infoSize < InfoHeaderSize || infoSize > size - FileHeaderSize)
+        return false;
+
+    int32_t width = (int32_t)ReadU32(info + 4);
+    int32_t height = (int32_t)ReadU32(info + 8);
+    int planes = ReadU16(info + 12);
+    int bitCount = ReadU16(info + 14);
+    uint32_t compression = ReadU32(info + 16);
+    if (planes != 1 || (bitCount != 24 && bitCount != 32))
+        return false;
+
+    // A negative height means the rows are stored top down rather than bottom up.
+    bool topDown = height < 0;
+    if (height == INT32_MIN)
+        return false;
+    if (topDown)
+        height = -height;
+    if (width <= 0 || width > MaxSize || height <= 0 || height > MaxSize || (size_t)width * height > MaxPixels)
+        return false;
+
+    // 32-bit files may give the channel masks, which follow the original info header, but
+    // only the usual layout is supported.
+    if (compression == CompressionBitfields)
+    {
+        uint32_t masks = FileHeaderSize + InfoHeaderSize;
+        if (bitCount != 32 || size < masks + 12)
+            return false;
+        if (ReadU32(file + masks) != 0xff0000 || ReadU32(file + masks + 4) != 0xff00 || ReadU32(file + masks + 8) != 0xff)
+            return false;
+    }
+    else if (compression != CompressionRGB)
+    {
+        return false;
+    }
+
+    // Rows are padded to a multiple of four bytes.
+    size_t stride = ((((size_t)width * bitCount) + 31) / 32) * 4;
+    uint32_t pixelOffset = ReadU32(file + 10);
+    if (pixelOffset > size || stride * height > size - pixelOffset)
+        return false;
+
+    m_pixels = new uint32_t[(size_t)width * height];
+    m_width = width;
+    m_height = height;
+
+    // One pass over the file, writing each row to its place in the image.
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    const uint8_t* pixels = file + pixelOffset;
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* src = pixels + ((topDown ? y : height - 1 - y) * stride);
+        uint32_t* dst = m_pixels + ((size_t)y * width);
+        if (bitCount == 24)
+            kernels.expandBGR(dst, src, width);
+        else
+            memcpy(dst, src, width * sizeof(uint32_t));
+    }
+
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "surface.h"
+
+namespace Pixie
+{
+    // A 32-bit ARGB image, stored top row first with no padding between rows. Loads
+    // uncompressed 24 and 32-bit BMP files.
+    class Image
+    {
+        public:
+            enum
+            {
+                MaxSize = 32768,        // The largest width or height loaded.
+                MaxPixels = 1 << 26,    // The most pixels loaded, 256 MB of them.
+            };
+
+            Image();
+            ~Image();
+
+            // Loads the BMP file. The file is memory mapped and each row is decoded straight
+            // into the image, so there is no copy of the file in memory.
+            bool Load(const char* filename);
+
+            // Loads a BMP file that's already in memory.
+            bool LoadMemory(const void* data, size_t size);
+
+            // Frees the pixels, leaving an empty image.
+            void Free();
+
+            // Hands the pixels over to the caller, who frees them with delete[], leaving an
+            // empty image.
+            uint32_t* Release();
+
+            int GetWidth() const;
+            int GetHeight() const;
+            uint32_t* GetPixels();
+            const uint32_t* GetPixels() const;
+
+            // Returns the image as a surface, such as to blit from.
+            Surface GetSurface() const;
+
+        private:
+            uint32_t* m_pixels;
+            int m_width;
+            int m_height;
+    };
+
+    inline int Image::GetWidth() const
+    {
+        return m_width;
+    }
+
+    inline int Image::GetHeight() const
+    {
+        return m_height;
+    }
+
+    inline uint32_t* Image::GetPixels()
+    {
+        return m_pixels;
+    }
+
+    inline const uint32_t* Image::GetPixels() const
+    {
+        return m_pixels;
+    }
+
+    inline Surface Image::GetSurface() const
+    {
+        return Surface(m_pixels, m_width, m_height, m_width);
+    }
+}
@@ -1,7 +1,11 @@
 ﻿#include "imgui.h"
 #include "pixie.h"
 #include "font.h"
+#include "simd.h"
+#include "profiler.h"
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <assert.h>
 #include <algorithm>
 
@@ -27,13 +31,176 @@ struct State
     float cursorBlinkTimer;
     uint32_t defaultTextColour;
 
+    // The mouse position relative to the target.
+    int mouseX;
+    int mouseY;
+
     Window* window;
     Font* font;
+    Surface target;
+};
+
+static State s_state;
+
+// Drawing between Begin and End is recorded into a draw list and executed by End, which
+// skips commands hidden behind later filled rectangles and merges adjacent fills.
+struct DrawCommand
+{
+    enum Type
+    {
+        Type_Rect = 0,      // Border only.
+        Type_FilledRect,
+        Type_Text,
+        Type_Line,
+    };
+
+    uint8_t type;
+    bool visible;
+    bool clipToDamage;      // Only draw within DrawList::damage.
+    uint8_t blendMode;
+    int x;
+    int y;
+    int width;              // For lines, the end point.
+    int height;
+    uint32_t colour;
+    uint32_t borderColour;
+    int text;               // Offset of the string in the text arena.
+
+    // Bounds clipped to the target, set by End.
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+// The commands recorded by one widget or drawing call. End compares each item with the
+// item in the same place the previous frame, and skips drawing it if it hasn't changed
+// and nothing has drawn over it since.
+struct DrawItem
+{
+    enum Mode
+    {
+        Mode_Skip = 0,
+        Mode_Clipped,       // Only redraw where something else has changed.
+        Mode_Full,
+    };
+
+    int firstCommand;
+    int lastCommand;
+    uint64_t hash;
+    DirtyRect bounds;
+    bool drawWhole;         // Has text or blending, so can't be drawn clipped.
+    bool cacheable;         // Its text and blending are all over opaque fills drawn first.
+    uint8_t mode;
+};
+
+// The command, text and item arenas are kept from frame to frame, so once they have
+// grown to fit a frame recording allocates nothing.
+struct DrawList
+{
+    DrawCommand* commands;
+    int numCommands;
+    int maxCommands;
+
+    char* text;
+    int textSize;
+    int maxTextSize;
+
+    DrawItem* items;
+    int numItems;
+    int maxItems;
+    int itemDepth;
+
+    // Items drawn by the previous End, and the state needed to tell if their pixels
+    // are still in the window.
+    DrawItem* lastItems;
+    int numLastItems;
+    int maxLastItems;
+    Window* lastWindow;
+    Font* lastFont;
+    uint32_t lastWidth;
+    uint32_t lastHeight;
+    uint64_t lastSubmittedFrames;
+    int lastNumDirtyAdded;
+    bool lastWholeWindow;
+
+    // The parts of the window being drawn this End when caching.
+    DirtyRegion damage;
+
+    bool cachingDisabled;
+    int drawnItems;
+    int skippedItems;
+};
+
+static DrawList s_drawList = { 0 };
+
+template<typename T>
+static void Reserve(T*& data, int size, int& capacity, int required)
+{
+    if (required <= capacity)
+        return;
+
+    int newCapacity = std::max(std::max(capacity * 2, required), 256);
+    T* newData = new T[newCapacity];
+    if (size > 0)
+        memcpy(newData, data, size * sizeof(T));
+    delete[] data;
+    data = newData;
+    capacity = newCapacity;
+}
+
+static DrawCommand& AddCommand(DrawCommand::Type type, int x, int y, int width, int height, uint32_t colour, uint32_t borderColour)
+{
+    DrawList& list = s_drawList;
+    Reserve(list.commands, list.numCommands, list.maxCommands, list.numCommands + 1);
+
+    DrawCommand& command = list.commands[list.numCommands++];
+    command.type = (uint8_t)type;
+    command.x = x;
+    command.y = y;
+    command.width = width;
+    command.height = height;
+    command.colour = colour;
+    command.borderColour = borderColour;
+    command.text = 0;
+    command.clipToDamage = false;
+    command.blendMode = BlendMode_Opaque;
+    return command;
+}
+
+// Groups the commands recorded until the end of the scope into one item. Widgets built
+// from other widgets are a single item.
+struct ScopedItem
+{
+    ScopedItem()
+    {
+        DrawList& list = s_drawList;
+        if (list.itemDepth++ > 0)
+            return;
+
+        Reserve(list.items, list.numItems, list.maxItems, list.numItems + 1);
+        list.items[list.numItems].firstCommand = list.numCommands;
+    }
+
+    ~ScopedItem()
+    {
+        DrawList& list = s_drawList;
+        if (--list.itemDepth > 0)
+            return;
+
+        list.items[list.numItems++].lastCommand = list.numCommands;
+    }
 };
 
-static State s_state = { 0 };
+static void ExecuteDrawList(Window* window, Font* font, const Surface& target);
 
 void ImGui::Begin(Window* window, Font* font)
+{
+    assert(window);
+    Begin(window, font, window->GetSurface());
+}
+
+void ImGui::Begin(Window* window, Font* font, const Surface& target)
 {
     assert(window);
     assert(font);
@@ -43,7 +210,22 @@ void ImGui::Begin(Window* window, Font* font)
     s_state.hoverId = 0;
     s_state.window = window;
     s_state.font = font;
+    s_state.target = target;
+
+    // A target within the window sees the mouse relative to its top left.
+    s_state.mouseX = window->GetMouseX();
+    s_state.mouseY = window->GetMouseY();
+    if (target.GetWindow() == window)
+    {
+        s_state.mouseX -= target.GetWindowX();
+        s_state.mouseY -= target.GetWindowY();
+    }
     s_state.defaultTextColour = MAKE_RGB(200, 200, 200);
+
+    s_drawList.numCommands = 0;
+    s_drawList.textSize = 0;
+    s_drawList.numItems = 0;
+    s_drawList.itemDepth = 0;
 }
 
 void ImGui::End()
@@ -60,19 +242,35 @@ void ImGui::End()
         }
     }
 
+    ExecuteDrawList(s_state.window, s_state.font, s_state.target);
+
     s_state.window = 0;
+    s_state.target = Surface();
 }
 
-void ImGui::Label(const char* text, int x, int y, uint32_t colour)
+void ImGui::Label(const char* text, int x, int y, uint32_t colour, BlendMode mode)
 {
     assert(text);
     assert(s_state.HasStarted());
-    s_state.font->DrawColour(text, x, y, colour, s_state.window);
+    ScopedItem item;
+
+    // The text may change before End, so copy it.
+    DrawList& list = s_drawList;
+    int length = (int)strlen(text) + 1;
+    Reserve(list.text, list.textSize, list.maxTextSize, list.textSize + length);
+    memcpy(list.text + list.textSize, text, length);
+
+    DrawCommand& command = AddCommand(DrawCommand::Type_Text, x, y, 0, 0, colour, colour);
+    command.text = list.textSize;
+    command.blendMode = (uint8_t)mode;
+    list.textSize += length;
 }
 
 bool ImGui::Button(const char* label, int x, int y, int width, int height)
 {
     assert(s_state.HasStarted());
+    PIXIE_PROFILE_ZONE("ImGui::Button");
+    ScopedItem item;
 
     Window* window = s_state.window;
     int id = s_state.GetNextId();
@@ -83,8 +281,8 @@ bool ImGui::Button(const char* label, int x, int y, int width, int height)
     const uint32_t BorderColour = MAKE_RGB(68, 79, 103);
     const uint32_t FocusBorderColour = MAKE_RGB(200, 200, 229);
 
-    int mouseX = window->GetMouseX();
-    int mouseY = window->GetMouseY();
+    int mouseX = s_state.mouseX;
+    int mouseY = s_state.mouseY;
 
     bool hover = mouseX >= x && mouseX <= x + width && mouseY >= y && mouseY <= y + height;
     bool pressed = false;
@@ -122,6 +320,8 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
 {
     assert(text);
     assert(s_state.HasStarted());
+    PIXIE_PROFILE_ZONE("ImGui::Input");
+    ScopedItem item;
 
     Window* window = s_state.window;
     int id = s_state.GetNextId();
@@ -137,8 +337,8 @@ void ImGui::Input(char* text, int textBufferLength, int x, int y, int width, int
     const float KeyRepeatTimeRepeat = 0.05f;
     const float CursorBlinkTime = 1.0f;
 
-    int mouseX = window->GetMouseX();
-    int mouseY = window->GetMouseY();
+    int mouseX = s_state.mouseX;
+    int mouseY = s_state.mouseY;
 
     bool hover = mouseX >= x && mouseX <= x + width && mouseY >= y && mouseY <= y + height;
     bool pressed = false;
@@ -286,6 +486,8 @@ bool ImGui::Checkbox(const char* label, bool checked, int x, int y)
 {
     assert(label);
     assert(s_state.HasStarted());
+    PIXIE_PROFILE_ZONE("ImGui::Checkbox");
+    ScopedItem item;
 
     const int TextLeftMargin = 8;
     const int BoxSize = 18;
@@ -305,15 +507,8 @@ bool ImGui::Checkbox(const char* label, bool checked, int x, int y)
         // Draw check mark.
         int checkX = x + ((BoxSize - CheckSize) >> 1);
         int checkY = y + ((BoxSize - CheckSize) >> 1);
-        Window* window = s_state.window;
-        int windowWidth = window->GetWidth();
-        uint32_t* pixels = window->GetPixels();
-        y = checkY;
-        for (int yy = y*windowWidth, x = 0; y < checkY + CheckSize; y++, x++, yy += windowWidth)
-        {
-            pixels[checkX + x + yy] = MAKE_RGB(255, 255, 255);
-            pixels[checkX + CheckSize - x - 1 + yy] = MAKE_RGB(255, 255, 255);
-        }
+        Line(checkX, checkY, checkX + CheckSize - 1, checkY + CheckSize - 1, MAKE_RGB(255, 255, 255));
+        Line(checkX + CheckSize - 1, checkY, checkX, checkY + CheckSize - 1, MAKE_RGB(255, 255, 255));
     }
 
     return checked;
@@ -323,6 +518,8 @@ bool ImGui::RadioButton(const char* label, bool checked, int x, int y)
 {
     assert(label);
     assert(s_state.HasStarted());
+    PIXIE_PROFILE_ZONE("ImGui::RadioButton");
+    ScopedItem item;
 
     const int TextLeftMargin = 8;
     const int BoxSize = 18;
@@ -349,65 +546,759 @@ bool ImGui::RadioButton(const char* label, bool checked, int x, int y)
     return checked;
 }
 
-void ImGui::Rect(int x, int y, int width, int height, uint32_t borderColour)
+void ImGui::Rect(int x, int y, int width, int height, uint32_t borderColour, BlendMode mode)
 {
     assert(s_state.HasStarted());
-    Window* window = s_state.window;
-    uint32_t* pixels = window->GetPixels();
-    int windowWidth = window->GetWidth();
-    int windowHeight = window->GetHeight();
+    PIXIE_PROFILE_ZONE("ImGui::Rect");
+    ScopedItem item;
+    if (width > 0 && height > 0)
+        AddCommand(DrawCommand::Type_Rect, x, y, width, height, borderColour, borderColour).blendMode = (uint8_t)mode;
+}
 
-    pixels += x + (y*windowWidth);
+void ImGui::FilledRect(int x, int y, int width, int height, uint32_t colour, uint32_t borderColour, BlendMode mode)
+{
+    assert(s_state.HasStarted());
+    PIXIE_PROFILE_ZONE("ImGui::FilledRect");
+    ScopedItem item;
+    if (width > 0 && height > 0)
+        AddCommand(DrawCommand::Type_FilledRect, x, y, width, height, colour, borderColour).blendMode = (uint8_t)mode;
+}
 
-    for (int j = 0, ypos = y; j < height && ypos < windowHeight; j++, ypos++)
+void ImGui::Line(int x0, int y0, int x1, int y1, uint32_t colour, BlendMode mode)
+{
+    assert(s_state.HasStarted());
+    ScopedItem item;
+    AddCommand(DrawCommand::Type_Line, x0, y0, x1, y1, colour, colour).blendMode = (uint8_t)mode;
+}
+
+// Clips the rectangle to the clip rectangle. Returns false if nothing is visible.
+static bool ClipRect(int x, int y, int width, int height, const SurfaceRect& clip, int& left, int& top, int& right, int& bottom)
+{
+    left = std::max(x, clip.left);
+    top = std::max(y, clip.top);
+    right = std::min(x + width, clip.right);
+    bottom = std::min(y + height, clip.bottom);
+    return left < right && top < bottom;
+}
+
+// Works out the bounds of the command clipped to the target's clip rectangle. Returns
+// false if nothing is visible.
+static bool ClipCommand(DrawCommand& command, Font* font, const SurfaceRect& clip)
+{
+    int x = command.x, y = command.y, width = command.width, height = command.height;
+    if (command.type == DrawCommand::Type_Text)
+    {
+        width = font->GetStringWidth(s_drawList.text + command.text);
+        height = font->GetCharacterHeight();
+    }
+    else if (command.type == DrawCommand::Type_Line)
     {
-        int left = x;
-        if (left >= 0 && left < windowWidth)
-            *pixels = borderColour;
+        x = std::min(command.x, command.width);
+        y = std::min(command.y, command.height);
+        width = abs(command.width - command.x) + 1;
+        height = abs(command.height - command.y) + 1;
+    }
+
+    return ClipRect(x, y, width, height, clip, command.left, command.top, command.right, command.bottom);
+}
 
-        int right = x + width - 1;
-        if (right >= 0 && right < windowWidth)
-            *(pixels + width - 1) = borderColour;
+static bool Contains(const DrawCommand& outer, const DrawCommand& inner)
+{
+    return outer.left <= inner.left && outer.top <= inner.top && outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
 
-        pixels += windowWidth;
+static bool IsOpaqueFill(const DrawCommand& command)
+{
+    return command.type == DrawCommand::Type_FilledRect && command.blendMode == BlendMode_Opaque;
+}
+
+// Blended fills are never merged, as the rectangles being merged may overlap.
+static bool IsSolidFill(const DrawCommand& command)
+{
+    return IsOpaqueFill(command) && command.colour == command.borderColour;
+}
+
+// Returns true if the union of two rectangles is itself exactly covered by them.
+static bool CanMerge(const DrawCommand& a, const DrawCommand& b)
+{
+    if (a.top == b.top && a.bottom == b.bottom)
+        return a.left <= b.right && b.left <= a.right;
+    if (a.left == b.left && a.right == b.right)
+        return a.top <= b.bottom && b.top <= a.bottom;
+    return Contains(a, b) || Contains(b, a);
+}
+
+// A colour to write or blend into the target, prepared once per command.
+struct Paint
+{
+    Paint(uint32_t colour, BlendMode mode) : kernels(Simd::GetKernels())
+    {
+        this->colour = colour;
+        opaque = mode == BlendMode_Opaque;
+        if (!opaque)
+            blend = Simd::MakeBlend(colour, mode);
     }
 
-    pixels = window->GetPixels() + x + (y*windowWidth);
-    for (int i = 0, xpos = x; i < width; i++, xpos++)
+    void Span(uint32_t* dst, int count) const
     {
-        int top = y;
-        if (top >= 0 && top < windowHeight)
-            *pixels = borderColour;
+        if (opaque)
+            kernels.fill(dst, count, colour);
+        else
+            kernels.blendFill(dst, count, blend);
+    }
+
+    void Pixel(uint32_t* dst) const
+    {
+        if (opaque)
+            *dst = colour;
+        else
+            kernels.blendFill(dst, 1, blend);
+    }
+
+    const Simd::Kernels& kernels;
+    uint32_t colour;
+    bool opaque;
+    Simd::Blend blend;
+};
+
+static void Fill(const Surface& target, int left, int top, int right, int bottom, uint32_t colour, BlendMode mode)
+{
+    Paint paint(colour, mode);
+    int pitch = target.GetStride();
 
-        int bottom = y + height - 1;
-        if (bottom >= 0 && bottom < windowHeight)
-            *(pixels + ((height-1)*windowWidth)) = borderColour;
+    uint32_t* row = target.GetRow(top) + left;
+    for (int j = top; j < bottom; j++, row += pitch)
+        paint.Span(row, right - left);
 
-        pixels++;
+    target.MarkDirty(left, top, right - left, bottom - top);
+}
+
+static void DrawBorder(const Surface& target, const DrawCommand& command)
+{
+    int x = command.x, y = command.y, width = command.width, height = command.height;
+    int left = command.left, top = command.top, right = command.right, bottom = command.bottom;
+    int x1 = x + width - 1;
+    int y1 = y + height - 1;
+    Paint paint(command.borderColour, (BlendMode)command.blendMode);
+
+    // Top and bottom borders.
+    if (top == y)
+    {
+        paint.Span(target.GetRow(top) + left, right - left);
+        target.MarkDirty(left, y, right - left, 1);
+    }
+    if (bottom - 1 == y1 && y1 != y)
+    {
+        paint.Span(target.GetRow(y1) + left, right - left);
+        target.MarkDirty(left, y1, right - left, 1);
+    }
+
+    // Left and right borders.
+    int spanTop = std::max(top, y + 1);
+    int spanBottom = std::min(bottom, y1);
+    if (spanTop >= spanBottom)
+        return;
+
+    for (int j = spanTop; j < spanBottom; j++)
+    {
+        uint32_t* row = target.GetRow(j);
+        if (left == x)
+            paint.Pixel(row + x);
+        if (right - 1 == x1 && x1 != x)
+            paint.Pixel(row + x1);
     }
+
+    if (left == x)
+        target.MarkDirty(x, spanTop, 1, spanBottom - spanTop);
+    if (right - 1 == x1 && x1 != x)
+        target.MarkDirty(x1, spanTop, 1, spanBottom - spanTop);
 }
 
-void ImGui::FilledRect(int x, int y, int width, int height, uint32_t colour, uint32_t borderColour)
+static void DrawFilledRect(const Surface& target, const DrawCommand& command)
 {
-    assert(s_state.HasStarted());
-    Window* window = s_state.window;
-    uint32_t* pixels = window->GetPixels();
-    int windowWidth = window->GetWidth();
-    int windowHeight = window->GetHeight();
+    // Draw the border, then fill the interior spans.
+    DrawBorder(target, command);
+
+    int innerLeft = std::max(command.left, command.x + 1);
+    int innerRight = std::min(command.right, command.x + command.width - 1);
+    int innerTop = std::max(command.top, command.y + 1);
+    int innerBottom = std::min(command.bottom, command.y + command.height - 1);
+    if (innerLeft < innerRight && innerTop < innerBottom)
+        Fill(target, innerLeft, innerTop, innerRight, innerBottom, command.colour, (BlendMode)command.blendMode);
+}
+
+static void DrawLine(const Surface& target, const DrawCommand& command)
+{
+    Paint paint(command.colour, (BlendMode)command.blendMode);
+
+    // Bresenham, clipped per pixel to the command's clipped bounds.
+    int x = command.x, y = command.y;
+    int x1 = command.width, y1 = command.height;
+    int dx = abs(x1 - x), sx = x < x1 ? 1 : -1;
+    int dy = -abs(y1 - y), sy = y < y1 ? 1 : -1;
+    int error = dx + dy;
+    for (;;)
+    {
+        if (x >= command.left && x < command.right && y >= command.top && y < command.bottom)
+            paint.Pixel(target.GetRow(y) + x);
+        if (x == x1 && y == y1)
+            break;
 
-    pixels += x + (y*windowWidth);
+        int error2 = error * 2;
+        if (error2 >= dy)
+        {
+            error += dy;
+            x += sx;
+        }
+        if (error2 <= dx)
+        {
+            error += dx;
+            y += sy;
+        }
+    }
+
+    target.MarkDirty(command.left, command.top, command.right - command.left, command.bottom - command.top);
+}
 
-    for (int j = 0, ypos = y; j < height && ypos < windowHeight; j++, ypos++)
+// Draws commands in order, within their clipped bounds. Consecutive solid fills of the
+// same colour that together make a rectangle are merged, so each row of them is a single
+// span.
+struct CommandPainter
+{
+    CommandPainter(const Surface& target, Font* font) : target(target)
     {
-        for (int i = 0, xpos = x; i < width; i++, xpos++)
+        this->font = font;
+        pendingFill = false;
+    }
+
+    void Draw(const DrawCommand& command)
+    {
+        if (IsSolidFill(command))
         {
-            if (xpos < 0 || xpos >= windowWidth || ypos < 0 || ypos >= windowHeight)
+            if (pendingFill && fill.colour == command.colour && CanMerge(fill, command))
+            {
+                fill.left = std::min(fill.left, command.left);
+                fill.top = std::min(fill.top, command.top);
+                fill.right = std::max(fill.right, command.right);
+                fill.bottom = std::max(fill.bottom, command.bottom);
+                return;
+            }
+
+            Flush();
+            fill = command;
+            pendingFill = true;
+            return;
+        }
+
+        Flush();
+
+        switch (command.type)
+        {
+            case DrawCommand::Type_Rect:
+                DrawBorder(target, command);
+                break;
+            case DrawCommand::Type_FilledRect:
+                DrawFilledRect(target, command);
+                break;
+            case DrawCommand::Type_Text:
+                font->DrawColour(s_drawList.text + command.text, command.x, command.y, command.colour, target, (BlendMode)command.blendMode);
+                break;
+            case DrawCommand::Type_Line:
+                DrawLine(target, command);
+                break;
+        }
+    }
+
+    void Flush()
+    {
+        if (pendingFill)
+            Fill(target, fill.left, fill.top, fill.right, fill.bottom, fill.colour, BlendMode_Opaque);
+        pendingFill = false;
+    }
+
+    const Surface& target;
+    Font* font;
+    DrawCommand fill;
+    bool pendingFill;
+};
+
+static uint64_t Hash(uint64_t hash, const void* data, size_t size)
+{
+    // FNV-1a.
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Hashes everything that affects what the item's commands draw.
+static uint64_t HashItem(const DrawItem& item)
+{
+    const DrawList& list = s_drawList;
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = item.firstCommand; i < item.lastCommand; i++)
+    {
+        const DrawCommand& command = list.commands[i];
+        int fields[] = { command.type, command.blendMode, command.x, command.y, command.width, command.height, (int)command.colour, (int)command.borderColour };
+        hash = Hash(hash, fields, sizeof(fields));
+        if (command.type == DrawCommand::Type_Text)
+        {
+            const char* text = list.text + command.text;
+            hash = Hash(hash, text, strlen(text));
+        }
+    }
+    return hash;
+}
+
+static bool Intersects(const DirtyRegion& region, const DirtyRect& rect)
+{
+    for (int i = 0; i < region.GetCount(); i++)
+    {
+        const DirtyRect& other = region.Get(i);
+        if (rect.left < other.right && other.left < rect.right && rect.top < other.bottom && other.top < rect.bottom)
+            return true;
+    }
+    return false;
+}
+
+static void AddToRegion(DirtyRegion& region, const DirtyRect& rect)
+{
+    if (rect.left < rect.right && rect.top < rect.bottom)
+        region.Add(rect.left, rect.top, rect.right, rect.bottom);
+}
+
+// Keeps the command in a list of the largest opaque fills, replacing the smallest when
+// the list is full.
+static void AddBacking(const DrawCommand** backings, int& numBackings, int maxBackings, const DrawCommand& command)
+{
+    if (numBackings < maxBackings)
+    {
+        backings[numBackings++] = &command;
+        return;
+    }
+
+    int area = (command.right - command.left) * (command.bottom - command.top);
+    int smallest = 0;
+    int smallestArea = INT32_MAX;
+    for (int i = 0; i < numBackings; i++)
+    {
+        const DrawCommand& backing = *backings[i];
+        int backingArea = (backing.right - backing.left) * (backing.bottom - backing.top);
+        if (backingArea < smallestArea)
+        {
+            smallest = i;
+            smallestArea = backingArea;
+        }
+    }
+    if (area > smallestArea)
+        backings[smallest] = &command;
+}
+
+// Decides which items need drawing. An item is skipped if it's the same as the item in
+// its place the previous frame and nothing has drawn over it since, which is only known
+// with dirty rectangle tracking enabled.
+//
+// Wherever anything has changed is damaged, and every item overlapping the damage is
+// redrawn clipped to it, so that the damage is repainted in the same order as before
+// without spreading to the rest of those items. Text can't be clipped, and blending
+// clipped to damage rectangles that overlap would blend twice, so items with either are
+// redrawn in full when they overlap the damage and damage the rest of their bounds.
+//
+// Redrawing text or blending over its own previous output would blend it again, so that
+// is only done where an opaque fill earlier in the frame is redrawn under it first. Items
+// with text or blending over anything else, such as the application's own drawing, are
+// never cached and are drawn every frame as they would be without caching.
+static void SkipUnchangedItems(Window* window, Font* font, const Surface& target)
+{
+    DrawList& list = s_drawList;
+
+    // The opaque fills that could be under later text and blending: the last one, which
+    // is usually the background of the same widget, and the largest few, which catch
+    // panels.
+    const int MaxBackings = 8;
+    const DrawCommand* backings[MaxBackings];
+    int numBackings = 0;
+    const DrawCommand* lastFill = 0;
+
+    for (int i = 0; i < list.numItems; i++)
+    {
+        DrawItem& item = list.items[i];
+        item.hash = HashItem(item);
+        item.mode = DrawItem::Mode_Full;
+        item.drawWhole = false;
+        item.cacheable = true;
+
+        DirtyRect bounds = { INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN };
+        for (int j = item.firstCommand; j < item.lastCommand; j++)
+        {
+            const DrawCommand& command = list.commands[j];
+            bool blends = command.type == DrawCommand::Type_Text || command.blendMode != BlendMode_Opaque;
+            item.drawWhole |= blends;
+            if (!command.visible)
                 continue;
-            *pixels = (i == 0 || i == width - 1 || j == 0 || j == height - 1) ? borderColour : colour;
-            pixels++;
+
+            if (blends)
+            {
+                bool backed = lastFill && Contains(*lastFill, command);
+                for (int k = 0; k < numBackings && !backed; k++)
+                    backed = Contains(*backings[k], command);
+                item.cacheable &= backed;
+            }
+            else if (IsOpaqueFill(command))
+            {
+                lastFill = &command;
+                AddBacking(backings, numBackings, MaxBackings, command);
+            }
+
+            bounds.left = std::min(bounds.left, command.left);
+            bounds.top = std::min(bounds.top, command.top);
+            bounds.right = std::max(bounds.right, command.right);
+            bounds.bottom = std::max(bounds.bottom, command.bottom);
+        }
+        item.bounds = bounds;
+    }
+
+    list.drawnItems = list.numItems;
+    list.skippedItems = 0;
+
+    // The window's dirty region only describes the target if the target is the whole of
+    // the window.
+    const SurfaceRect& clip = target.GetClipRect();
+    bool wholeWindow = target.GetWindow() == window && target.GetPixels() == window->GetPixels() &&
+        clip.left == 0 && clip.top == 0 && clip.right == (int)window->GetWidth() && clip.bottom == (int)window->GetHeight();
+
+    bool valid = !list.cachingDisabled &&
+        wholeWindow && list.lastWholeWindow &&
+        window->IsDirtyRectTrackingEnabled() &&
+        window == list.lastWindow &&
+        font == list.lastFont &&
+        window->GetWidth() == list.lastWidth &&
+        window->GetHeight() == list.lastHeight;
+
+    // Anything drawn after the previous End and before Update has been presented without
+    // us knowing where, so the previous frame's pixels can't be trusted.
+    uint64_t submittedFrames = window->GetSubmittedFrames();
+    if (submittedFrames == list.lastSubmittedFrames + 1)
+        valid &= window->GetPresentedRegion().GetNumAdded() == list.lastNumDirtyAdded;
+    else if (submittedFrames != list.lastSubmittedFrames)
+        valid = false;
+
+    list.lastWholeWindow = wholeWindow;
+
+    if (!valid)
+        return;
+
+    // Everything drawn since the previous frame, and wherever an item has changed.
+    DirtyRegion& damage = list.damage;
+    damage = window->GetDirtyRegion();
+
+    int numItems = std::max(list.numItems, list.numLastItems);
+    for (int i = 0; i < numItems; i++)
+    {
+        if (i < list.numItems && i < list.numLastItems && list.items[i].cacheable && list.items[i].hash == list.lastItems[i].hash)
+        {
+            list.items[i].mode = DrawItem::Mode_Skip;
+            continue;
+        }
+
+        if (i < list.numLastItems)
+            AddToRegion(damage, list.lastItems[i].bounds);
+        if (i < list.numItems)
+            AddToRegion(damage, list.items[i].bounds);
+    }
+
+    // Grow the damage by the items it reaches that must be drawn whole, until it stops
+    // growing.
+    bool grown = true;
+    while (grown)
+    {
+        grown = false;
+        for (int i = 0; i < list.numItems; i++)
+        {
+            DrawItem& item = list.items[i];
+            if (item.mode == DrawItem::Mode_Skip && item.drawWhole && Intersects(damage, item.bounds))
+            {
+                item.mode = DrawItem::Mode_Full;
+                AddToRegion(damage, item.bounds);
+                grown = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < list.numItems; i++)
+    {
+        DrawItem& item = list.items[i];
+        if (item.mode == DrawItem::Mode_Skip && Intersects(damage, item.bounds))
+            item.mode = DrawItem::Mode_Clipped;
+
+        for (int j = item.firstCommand; j < item.lastCommand; j++)
+        {
+            DrawCommand& command = list.commands[j];
+            command.visible &= item.mode != DrawItem::Mode_Skip;
+            command.clipToDamage = item.mode == DrawItem::Mode_Clipped;
+        }
+
+        if (item.mode == DrawItem::Mode_Skip)
+            list.skippedItems++;
+    }
+
+    list.drawnItems = list.numItems - list.skippedItems;
+}
+
+static void ExecuteDrawList(Window* window, Font* font, const Surface& target)
+{
+    PIXIE_PROFILE_ZONE("ImGui::ExecuteDrawList");
+
+    DrawList& list = s_drawList;
+    const SurfaceRect& clip = target.GetClipRect();
+
+    for (int i = 0; i < list.numCommands; i++)
+    {
+        DrawCommand& command = list.commands[i];
+        command.visible = ClipCommand(command, font, clip);
+    }
+
+    SkipUnchangedItems(window, font, target);
+
+    // Walk back from the last command, culling anything entirely covered by a later
+    // opaque filled rectangle. Only the largest few of those are kept as occluders, which
+    // catches panels and backgrounds without the cost growing quadratically.
+    const int MaxOccluders = 8;
+    const DrawCommand* occluders[MaxOccluders];
+    int numOccluders = 0;
+
+    for (int i = list.numCommands - 1; i >= 0; i--)
+    {
+        DrawCommand& command = list.commands[i];
+        if (!command.visible)
+            continue;
+
+        for (int j = 0; j < numOccluders && command.visible; j++)
+            command.visible = !Contains(*occluders[j], command);
+
+        if (!command.visible || !IsOpaqueFill(command))
+            continue;
+
+        // Keep the command as an occluder if it's bigger than the smallest so far.
+        int area = (command.right - command.left) * (command.bottom - command.top);
+        if (numOccluders < MaxOccluders)
+        {
+            occluders[numOccluders++] = &command;
+            continue;
+        }
+
+        int smallest = 0;
+        int smallestArea = INT32_MAX;
+        for (int j = 0; j < numOccluders; j++)
+        {
+            const DrawCommand& occluder = *occluders[j];
+            int occluderArea = (occluder.right - occluder.left) * (occluder.bottom - occluder.top);
+            if (occluderArea < smallestArea)
+            {
+                smallest = j;
+                smallestArea = occluderArea;
+            }
+        }
+        if (area > smallestArea)
+            occluders[smallest] = &command;
+    }
+
+    CommandPainter painter(target, font);
+    for (int i = 0; i < list.numCommands; i++)
+    {
+        const DrawCommand& command = list.commands[i];
+        if (!command.visible)
+            continue;
+
+        if (!command.clipToDamage)
+        {
+            painter.Draw(command);
+            continue;
         }
 
-        pixels += windowWidth - width;
+        for (int j = 0; j < list.damage.GetCount(); j++)
+        {
+            const DirtyRect& rect = list.damage.Get(j);
+            DrawCommand clipped = command;
+            clipped.left = std::max(command.left, rect.left);
+            clipped.top = std::max(command.top, rect.top);
+            clipped.right = std::min(command.right, rect.right);
+            clipped.bottom = std::min(command.bottom, rect.bottom);
+            if (clipped.left < clipped.right && clipped.top < clipped.bottom)
+                painter.Draw(clipped);
+        }
+    }
+    painter.Flush();
+
+    // Keep this frame's items to compare the next frame against.
+    std::swap(list.items, list.lastItems);
+    std::swap(list.maxItems, list.maxLastItems);
+    list.numLastItems = list.numItems;
+    list.numItems = 0;
+    list.lastWindow = window;
+    list.lastFont = font;
+    list.lastWidth = window->GetWidth();
+    list.lastHeight = window->GetHeight();
+    list.lastSubmittedFrames = window->GetSubmittedFrames();
+    list.lastNumDirtyAdded = window->GetDirtyRegion().GetNumAdded();
+}
+
+void ImGui::SetCaching(bool enabled)
+{
+    s_drawList.cachingDisabled = !enabled;
+}
+
+bool ImGui::IsCachingEnabled()
+{
+    return !s_drawList.cachingDisabled;
+}
+
+int ImGui::GetNumDrawnWidgets()
+{
+    return s_drawList.drawnItems;
+}
+
+int ImGui::GetNumSkippedWidgets()
+{
+    return s_drawList.skippedItems;
+}
+
+struct ProfilerGraphState
+{
+    uint64_t start;
+    uint64_t end;
+    int x;
+    int width;
+    int barsTop;
+    int barsBottom;
+    int rowHeight;
+    int mouseX;
+    int mouseY;
+
+    int rows[Profiler::MaxThreads];
+    int bandTop[Profiler::MaxThreads];
+
+    // Left edge of the last bar drawn in each row. Zones arrive right to left, so bars
+    // that would land on pixels already drawn in the row are clipped or skipped.
+    int lastLeft[Profiler::MaxThreads][Profiler::MaxDepth];
+
+    const char* hoverName;
+    uint64_t hoverDuration;
+};
+
+static void CountProfilerRows(const Profiler::Zone& zone, void* userData)
+{
+    ProfilerGraphState& graph = *(ProfilerGraphState*)userData;
+    int rows = std::min(zone.depth + 1, (int)Profiler::MaxDepth);
+    graph.rows[zone.thread] = std::max(graph.rows[zone.thread], rows);
+}
+
+static uint32_t ProfilerZoneColour(const char* name)
+{
+    // Colour by a hash of the name so each zone keeps its colour from frame to frame.
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c; c++)
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return MAKE_RGB(96 + (hash & 127), 96 + ((hash >> 8) & 127), 96 + ((hash >> 16) & 127));
+}
+
+static void DrawProfilerZone(const Profiler::Zone& zone, void* userData)
+{
+    ProfilerGraphState& graph = *(ProfilerGraphState*)userData;
+    if (zone.depth >= Profiler::MaxDepth)
+        return;
+
+    int top = graph.bandTop[zone.thread] + (zone.depth * graph.rowHeight);
+    if (top + graph.rowHeight > graph.barsBottom)
+        return;
+
+    uint64_t duration = graph.end - graph.start;
+    uint64_t start = std::max(zone.start, graph.start) - graph.start;
+    uint64_t end = std::min(zone.end, graph.end) - graph.start;
+    int left = graph.x + (int)((start * graph.width) / duration);
+    int right = graph.x + (int)((end * graph.width) / duration);
+
+    // Keep zones shorter than a pixel visible.
+    if (right <= left)
+        right = left + 1;
+
+    if (!graph.hoverName && graph.mouseX >= left && graph.mouseX < right && graph.mouseY >= top && graph.mouseY < top + graph.rowHeight)
+    {
+        graph.hoverName = zone.name;
+        graph.hoverDuration = zone.end - zone.start;
     }
+
+    int& lastLeft = graph.lastLeft[zone.thread][zone.depth];
+    right = std::min(right, lastLeft);
+    if (right <= left)
+        return;
+    lastLeft = left;
+
+    uint32_t colour = ProfilerZoneColour(zone.name);
+    int height = graph.rowHeight > 2 ? graph.rowHeight - 1 : graph.rowHeight;
+    ImGui::FilledRect(left, top, right - left, height, colour, colour);
 }
 
+void ImGui::ProfilerGraph(int x, int y, int width, int height)
+{
+    assert(s_state.HasStarted());
+    ScopedItem item;
+
+    const uint32_t BackgroundColour = MAKE_RGB(20, 22, 26);
+    const uint32_t BorderColour = MAKE_RGB(68, 79, 103);
+    const int MaxRowHeight = 8;
+    const int Margin = 2;
+
+    Font* font = s_state.font;
+
+    FilledRect(x, y, width, height, BackgroundColour, BorderColour);
+
+    ProfilerGraphState graph;
+    if (!Profiler::GetFrame(0, graph.start, graph.end) || graph.end <= graph.start)
+        return;
+
+    // The top line is for text and the bars go below it.
+    graph.x = x + Margin;
+    graph.width = width - (Margin * 2);
+    graph.barsTop = y + font->GetCharacterHeight() + (Margin * 2);
+    graph.barsBottom = y + height - Margin;
+    graph.mouseX = s_state.mouseX;
+    graph.mouseY = s_state.mouseY;
+    graph.hoverName = 0;
+    graph.hoverDuration = 0;
+    if (graph.width <= 0 || graph.barsBottom <= graph.barsTop)
+        return;
+
+    // Give each thread with zones in the frame a band just deep enough for its zones.
+    int numThreads = Profiler::GetNumThreads();
+    for (int i = 0; i < numThreads; i++)
+        graph.rows[i] = 0;
+    Profiler::ForEachZone(graph.start, graph.end, CountProfilerRows, &graph);
+
+    int totalRows = 0;
+    for (int i = 0; i < numThreads; i++)
+        totalRows += graph.rows[i];
+
+    if (totalRows > 0)
+    {
+        graph.rowHeight = std::max(1, std::min(MaxRowHeight, (graph.barsBottom - graph.barsTop) / totalRows));
+
+        int top = graph.barsTop;
+        for (int i = 0; i < numThreads; i++)
+        {
+            graph.bandTop[i] = top;
+            top += graph.rows[i] * graph.rowHeight;
+            for (int j = 0; j < Profiler::MaxDepth; j++)
+                graph.lastLeft[i][j] = graph.x + graph.width;
+        }
+
+        Profiler::ForEachZone(graph.start, graph.end, DrawProfilerZone, &graph);
+    }
+
+    char text[128];
+    if (graph.hoverName)
+        sprintf_s(text, sizeof(text), "%s %.3f ms", graph.hoverName, graph.hoverDuration / 1000000.0);
+    else
+        sprintf_s(text, sizeof(text), "Frame %.2f ms", (graph.end - graph.start) / 1000000.0);
+    Label(text, x + Margin, y + Margin, s_state.defaultTextColour);
+}
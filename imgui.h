@@ -7,22 +7,55 @@ namespace Pixie
 {
     class Window;
     class Font;
+    class Surface;
 
     class ImGui
     {
         public:
+            // Widgets and drawing between Begin and End are recorded and then drawn by End,
+            // on top of anything drawn straight to the window in between. End skips
+            // anything hidden behind a later filled rectangle.
             static void Begin(Window* window, Font* font);
             static void End();
 
+            // As Begin, but draws to the target rather than the window, such as a region of
+            // the window or a buffer owned by something else. Positions are relative to
+            // the target and drawing is clipped to its clip rectangle. The window still
+            // supplies the input, with the mouse relative to the target if it's part of the
+            // window. Caching only applies when the target is the whole window.
+            static void Begin(Window* window, Font* font, const Surface& target);
+
             // UI widgets
-            static void Label(const char* text, int x, int y, uint32_t colour);
+            static void Label(const char* text, int x, int y, uint32_t colour, BlendMode mode = BlendMode_Opaque);
             static bool Button(const char* label, int x, int y, int width, int height);
             static void Input(char* text, int textBufferLength, int x, int y, int width, int height);
             static bool Checkbox(const char* label, bool checked, int x, int y);
             static bool RadioButton(const char* label, bool checked, int x, int y);
 
             // Basic drawing
-            static void Rect(int x, int y, int width, int height, uint32_t borderColour);
-            static void FilledRect(int x, int y, int width, int height, uint32_t colour, uint32_t borderColour);
+            // With a blend mode other than BlendMode_Opaque, colours are ARGB (see MAKE_ARGB)
+            // and are blended with whatever is underneath.
+            static void Rect(int x, int y, int width, int height, uint32_t borderColour, BlendMode mode = BlendMode_Opaque);
+            static void FilledRect(int x, int y, int width, int height, uint32_t colour, uint32_t borderColour, BlendMode mode = BlendMode_Opaque);
+            static void Line(int x0, int y0, int x1, int y1, uint32_t colour, BlendMode mode = BlendMode_Opaque);
+
+            // Caching
+            // When dirty rectangle tracking is enabled on the window, End skips drawing any
+            // widget or drawing call that is the same as in the previous frame, as long as
+            // nothing has drawn over it since. Text and blending are only skipped when they
+            // are over a filled rectangle drawn opaquely before them, and are otherwise drawn
+            // every frame. Caching is enabled by default.
+            static void SetCaching(bool enabled);
+            static bool IsCachingEnabled();
+
+            // Returns the number of widgets and drawing calls drawn and skipped by the last End.
+            static int GetNumDrawnWidgets();
+            static int GetNumSkippedWidgets();
+
+            // Profiling
+            // Draws the zones the profiler recorded in the last complete frame as a flame
+            // graph, with a band for each thread and a row for each level of nesting.
+            // Hovering over a zone shows its name and duration.
+            static void ProfilerGraph(int x, int y, int width, int height);
     };
 }
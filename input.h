@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+namespace Pixie
+{
+    enum InputEventType
+    {
+        InputEvent_KeyDown = 0,
+        InputEvent_KeyUp,
+        InputEvent_MouseDown,
+        InputEvent_MouseUp,
+        InputEvent_MouseMove,
+        InputEvent_Character,
+    };
+
+    struct InputEvent
+    {
+        InputEventType type;
+        int code;           // The Key for key events, the MouseButton for mouse button events
+                            // and the character for character events.
+        int x;              // The mouse position in the buffer when the event happened.
+        int y;
+        int64_t time;       // When the event happened, in Window::GetTicks ticks.
+    };
+
+    // A fixed size queue of input events that one thread pushes to and one thread, which
+    // may be the same one, pops from, without locks. Each side only writes its own index,
+    // so the two never wait for each other. When the queue is full new events are dropped
+    // and counted.
+    class InputQueue
+    {
+        public:
+            enum
+            {
+                Capacity = 1024,    // Must be a power of two.
+            };
+
+            InputQueue();
+
+            // Adds an event to the back of the queue. Only the producer calls this. Returns
+            // false if the queue is full.
+            bool Push(const InputEvent& event);
+
+            // Takes the event from the front of the queue. Only the consumer calls this.
+            // Returns false if the queue is empty.
+            bool Pop(InputEvent& event);
+
+            // Throws away every queued event. Only the consumer calls this.
+            void Clear();
+
+            // Returns the number of events queued.
+            uint32_t GetCount() const;
+
+            // Returns the number of events dropped because the queue was full.
+            uint32_t GetDropped() const;
+
+        private:
+            InputEvent m_events[Capacity];
+
+            // The indices count up forever and wrap around the buffer. Each is on its own
+            // cache line so the producer and consumer don't fight over one.
+            alignas(64) std::atomic<uint32_t> m_tail;   // Written by the producer.
+            alignas(64) std::atomic<uint32_t> m_head;   // Written by the consumer.
+            std::atomic<uint32_t> m_dropped;
+    };
+
+    inline InputQueue::InputQueue()
+    {
+        m_tail.store(0, std::memory_order_relaxed);
+        m_head.store(0, std::memory_order_relaxed);
+        m_dropped.store(0, std::memory_order_relaxed);
+    }
+
+    inline bool InputQueue::Push(const InputEvent& event)
+    {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) >= Capacity)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // The event is written before the new tail makes it visible to the consumer.
+        m_events[tail & (Capacity - 1)] = event;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline bool InputQueue::Pop(InputEvent& event)
+    {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+
+        // The event is read before the new head lets the producer overwrite it.
+        event = m_events[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    inline void InputQueue::Clear()
+    {
+        m_head.store(m_tail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    inline uint32_t InputQueue::GetCount() const
+    {
+        // Head is loaded first. Tail only grows, so it can't then be behind it.
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        return m_tail.load(std::memory_order_acquire) - head;
+    }
+
+    inline uint32_t InputQueue::GetDropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+}
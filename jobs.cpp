@@ -0,0 +1,261 @@
+#include "jobs.h"
+#include "pixie.h"
+#include "simd.h"
+#include "profiler.h"
+#include <assert.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace Pixie;
+
+// Each worker's range of indices, padded so that workers taking indices from their
+// own ranges don't contend for the same cache line.
+struct alignas(64) JobSystem::Worker
+{
+    std::mutex lock;
+    int begin;
+    int end;
+    std::thread thread;
+};
+
+struct JobSystem::Job
+{
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation;
+    int activeWorkers;
+    bool quit;
+
+    ForFunc fn;
+    void* userData;
+};
+
+JobSystem::JobSystem(int numThreads /*= 0*/)
+{
+    if (numThreads <= 0)
+        numThreads = (int)std::thread::hardware_concurrency();
+    if (numThreads <= 0)
+        numThreads = 1;
+
+    m_numThreads = numThreads;
+    m_workers = new Worker[numThreads];
+    m_job = new Job;
+    m_job->generation = 0;
+    m_job->activeWorkers = 0;
+    m_job->quit = false;
+    m_job->fn = 0;
+    m_job->userData = 0;
+
+    for (int i = 0; i < numThreads; i++)
+    {
+        m_workers[i].begin = 0;
+        m_workers[i].end = 0;
+    }
+
+    // Thread 0 is the calling thread.
+    for (int i = 1; i < numThreads; i++)
+        m_workers[i].thread = std::thread(WorkerMain, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_job->lock);
+        m_job->quit = true;
+    }
+    m_job->wake.notify_all();
+
+    for (int i = 1; i < m_numThreads; i++)
+        m_workers[i].thread.join();
+
+    delete m_job;
+    delete[] m_workers;
+}
+
+void JobSystem::WorkerMain(JobSystem* jobSystem, int threadIndex)
+{
+    Job* job = jobSystem->m_job;
+    uint64_t generation = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(job->lock);
+            job->wake.wait(lock, [&]() { return job->quit || job->generation != generation; });
+            if (job->quit)
+                return;
+            generation = job->generation;
+        }
+
+        jobSystem->RunJob(threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(job->lock);
+            if (--job->activeWorkers == 0)
+                job->done.notify_one();
+        }
+    }
+}
+
+void JobSystem::RunJob(int threadIndex)
+{
+    PIXIE_PROFILE_ZONE("JobSystem::RunJob");
+    int index;
+    while (TakeIndex(threadIndex, index))
+        m_job->fn(index, m_job->userData);
+}
+
+bool JobSystem::TakeIndex(int threadIndex, int& index)
+{
+    Worker& self = m_workers[threadIndex];
+
+    {
+        std::lock_guard<std::mutex> lock(self.lock);
+        if (self.begin < self.end)
+        {
+            index = self.begin++;
+            return true;
+        }
+    }
+
+    // Out of work, so steal the back half of another thread's range.
+    for (int i = 1; i < m_numThreads; i++)
+    {
+        Worker& victim = m_workers[(threadIndex + i) % m_numThreads];
+        int begin, end;
+
+        {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            int remaining = victim.end - victim.begin;
+            if (remaining <= 0)
+                continue;
+
+            begin = victim.end - ((remaining + 1) >> 1);
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        // Our range is empty so nobody else will touch it until we refill it.
+        std::lock_guard<std::mutex> lock(self.lock);
+        index = begin;
+        self.begin = begin + 1;
+        self.end = end;
+        return true;
+    }
+
+    return false;
+}
+
+void JobSystem::ParallelFor(int count, ForFunc fn, void* userData)
+{
+    assert(fn);
+    if (count <= 0)
+        return;
+
+    PIXIE_PROFILE_ZONE("JobSystem::ParallelFor");
+
+    if (m_numThreads == 1 || count == 1)
+    {
+        for (int i = 0; i < count; i++)
+            fn(i, userData);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_job->lock);
+        assert(m_job->activeWorkers == 0);
+
+        // Split the indices evenly between the threads to begin with.
+        for (int i = 0; i < m_numThreads; i++)
+        {
+            std::lock_guard<std::mutex> workerLock(m_workers[i].lock);
+            m_workers[i].begin = (int)(((int64_t)count * i) / m_numThreads);
+            m_workers[i].end = (int)(((int64_t)count * (i + 1)) / m_numThreads);
+        }
+
+        m_job->fn = fn;
+        m_job->userData = userData;
+        m_job->activeWorkers = m_numThreads - 1;
+        m_job->generation++;
+    }
+    m_job->wake.notify_all();
+
+    RunJob(0);
+
+    // Wait for the workers to finish their last indices.
+    std::unique_lock<std::mutex> lock(m_job->lock);
+    m_job->done.wait(lock, [&]() { return m_job->activeWorkers == 0; });
+}
+
+struct TileJob
+{
+    uint32_t* pixels;
+    int width;
+    int height;
+    int pitch;
+    int tileWidth;
+    int tileHeight;
+    int tilesX;
+    JobSystem::TileFunc fn;
+    void* userData;
+};
+
+static void RunTile(int index, void* userData)
+{
+    const TileJob& job = *(const TileJob*)userData;
+
+    Tile tile;
+    tile.index = index;
+    tile.x = (index % job.tilesX) * job.tileWidth;
+    tile.y = (index / job.tilesX) * job.tileHeight;
+    tile.width = tile.x + job.tileWidth > job.width ? job.width - tile.x : job.tileWidth;
+    tile.height = tile.y + job.tileHeight > job.height ? job.height - tile.y : job.tileHeight;
+    tile.pitch = job.pitch;
+    tile.pixels = job.pixels + tile.x + (tile.y * tile.pitch);
+
+    job.fn(tile, job.userData);
+}
+
+void JobSystem::ParallelForTiles(Window* window, int tileWidth, int tileHeight, TileFunc fn, void* userData)
+{
+    assert(window);
+    assert(tileWidth > 0 && tileHeight > 0);
+
+    Surface surface = window->GetSurface();
+    TileJob job;
+    job.pixels = surface.GetPixels();
+    job.width = surface.GetWidth();
+    job.height = surface.GetHeight();
+    job.pitch = surface.GetStride();
+    job.tileWidth = tileWidth;
+    job.tileHeight = tileHeight;
+    job.tilesX = (job.width + tileWidth - 1) / tileWidth;
+    job.fn = fn;
+    job.userData = userData;
+
+    int tilesY = (job.height + tileHeight - 1) / tileHeight;
+    ParallelFor(job.tilesX * tilesY, RunTile, &job);
+
+    // There's no telling which pixels the tile function wrote.
+    if (window->IsDirtyRectTrackingEnabled())
+        window->MarkAllDirty();
+}
+
+static void ClearTile(const Tile& tile, void* userData)
+{
+    uint32_t colour = *(const uint32_t*)userData;
+    const Simd::Kernels& kernels = Simd::GetKernels();
+
+    uint32_t* row = tile.pixels;
+    for (int y = 0; y < tile.height; y++, row += tile.pitch)
+        kernels.fill(row, tile.width, colour);
+}
+
+void JobSystem::Clear(Window* window, uint32_t colour)
+{
+    // Full-width bands keep each thread's writes contiguous.
+    const int BandHeight = 32;
+    ParallelForTiles(window, window->GetWidth(), BandHeight, ClearTile, &colour);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include "core.h"
+
+namespace Pixie
+{
+    class Window;
+
+    // A rectangular part of the window's backing buffer handed to a tile function.
+    struct Tile
+    {
+        uint32_t* pixels;   // Top left pixel of the tile.
+        int x;              // Position of the tile in the buffer.
+        int y;
+        int width;          // Size of the tile, clipped to the buffer.
+        int height;
+        int pitch;          // Distance in pixels between rows.
+        int index;          // Index of the tile, row-major.
+    };
+
+    // Work-stealing thread pool for spreading per-pixel work across cores.
+    //
+    // Work is split into one contiguous range of indices per thread. A thread takes
+    // indices from the front of its own range and when that runs out steals the back
+    // half of another thread's range, so uneven work balances itself without any
+    // per-item synchronisation in the common case.
+    //
+    // Every index runs exactly once, so output is deterministic as long as each index
+    // (or tile) only writes to its own part of the buffer.
+    class JobSystem
+    {
+        public:
+            typedef void(*ForFunc)(int index, void* userData);
+            typedef void(*TileFunc)(const Tile& tile, void* userData);
+
+            // Starts the worker threads. If numThreads is 0 one thread per hardware thread
+            // is used. The calling thread counts as one of the threads.
+            JobSystem(int numThreads = 0);
+            ~JobSystem();
+
+            // Returns the number of threads work is spread across, including the caller.
+            int GetNumThreads() const;
+
+            // Calls fn for each index from 0 to count - 1 across all threads and waits for
+            // them to finish. Must not be called from inside a job.
+            void ParallelFor(int count, ForFunc fn, void* userData);
+
+            // Partitions the window's backing buffer into tiles of the given size and calls
+            // fn for each across all threads. If dirty rectangle tracking is enabled the
+            // whole buffer is marked dirty afterwards.
+            void ParallelForTiles(Window* window, int tileWidth, int tileHeight, TileFunc fn, void* userData);
+
+            // Fills the window's backing buffer with colour across all threads.
+            void Clear(Window* window, uint32_t colour);
+
+        private:
+            struct Worker;
+            struct Job;
+
+            static void WorkerMain(JobSystem* jobSystem, int threadIndex);
+            void RunJob(int threadIndex);
+            bool TakeIndex(int threadIndex, int& index);
+
+            JobSystem(const JobSystem&);
+            JobSystem& operator=(const JobSystem&);
+
+            Worker* m_workers;
+            Job* m_job;
+            int m_numThreads;
+    };
+
+    inline int JobSystem::GetNumThreads() const
+    {
+        return m_numThreads;
+    }
+}
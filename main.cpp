@@ -1,6 +1,8 @@
 ﻿#include "pixie.h"
 #include "font.h"
 #include "imgui.h"
+#include "jobs.h"
+#include "profiler.h"
 #include <string.h>
 #include <stdio.h>
 #include <algorithm>
@@ -9,17 +11,14 @@ static const TCHAR* WindowTitle = TEXT("Hello, World!");
 static const int WindowWidth = 640;
 static const int WindowHeight = 400;
 
-static void draw(int x, int y, uint32_t* pixels)
+static void draw(int x, int y, const Pixie::Surface& surface)
 {
     for (int i = x; i < x+4; i++)
     {
         for (int j = y; j < y+4; j++)
         {
-            if (i < WindowWidth && j < WindowHeight)
-            {
-                int index = (i + (j * WindowWidth));
-                pixels[index] = MAKE_RGB(0, 0, 255);
-            }
+            if (i < surface.GetWidth() && j < surface.GetHeight())
+                surface.GetRow(j)[i] = MAKE_RGB(0, 0, 255);
         }
     }
 }
@@ -41,7 +40,30 @@ int main(int argc, char** argv)
     if (!window.Open(WindowTitle, WindowWidth, WindowHeight, true))
         return 0;
 
-    uint32_t* pixels = window.GetPixels();
+    // --record and --replay log the input of a run and play it back, so a headless run
+    // in CI draws the same frames every time. --stream serves the frames to pixie_viewer.
+    Pixie::FrameStreamer streamer;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        bool started = true;
+        if (strcmp(argv[i], "--record") == 0)
+            started = window.StartRecording(argv[i + 1]);
+        else if (strcmp(argv[i], "--replay") == 0)
+            started = window.StartReplay(argv[i + 1]);
+        else if (strcmp(argv[i], "--stream") == 0)
+            started = streamer.Start(argv[i + 1], WindowWidth, WindowHeight);
+        if (!started)
+            printf("pixie: failed to open %s\n", argv[i + 1]);
+    }
+    if (streamer.IsStreaming())
+        window.SetFrameStreamer(&streamer);
+
+    Pixie::JobSystem jobs;
+
+#if !PIXIE_PLATFORM_HEADLESS
+    // Headless runs are for throughput, so only pace frames when there's a display.
+    window.SetFrameRate(Pixie::FrameRate_Adaptive, 60.0f);
+#endif
 
     const float SPEED = 100.0f;
     float x = 0, y = 0;
@@ -49,6 +71,12 @@ int main(int argc, char** argv)
     char buf[16] = { 0 };
     strcat_s(buf, sizeof(buf), "Hello, World!");
 
+#if PIXIE_PLATFORM_HEADLESS
+    // Nobody is around to press escape, so script it after a fixed number of frames.
+    const int HeadlessFrames = 10000;
+    int frame = 0;
+#endif
+
     while (!window.HasKeyGoneUp(Pixie::Key_Escape))
     {
         Pixie::ImGui::Begin(&window, &font);
@@ -79,7 +107,7 @@ int main(int argc, char** argv)
             yadd = SPEED;
         }
 
-        memset(pixels, 0, WindowWidth * WindowHeight * sizeof(uint32_t));
+        jobs.Clear(&window, 0);
 
         int cx = 0, cy = 0;
         for (int i = 0; i < 256; i++)
@@ -101,9 +129,10 @@ int main(int argc, char** argv)
             font.Draw(buf, 10, 90, &window);
         }
 
-        draw((int)x, (int)y, pixels);
+        draw((int)x, (int)y, window.GetSurface());
 
         Pixie::ImGui::FilledRect(10, 240, 100, 100, MAKE_RGB(255, 0, 0), MAKE_RGB(128, 0, 0));
+        Pixie::ImGui::FilledRect(60, 270, 100, 45, MAKE_ARGB(128, 0, 0, 255), MAKE_ARGB(255, 0, 0, 128), Pixie::BlendMode_SrcOver);
 
         if (Pixie::ImGui::Button("Hello", 100, 100, 100, 30))
             strcpy_s(buf, sizeof(buf), "Hello, World!");
@@ -135,32 +164,38 @@ int main(int argc, char** argv)
             }
         }
 
-        static float accumTime = 0.0f;
-        static int numFrames = 0;
-        static float avgFrameTime = 0.0f;
-        numFrames++;
-        accumTime += delta;
-        if (numFrames == 16)
-        {
-            avgFrameTime = accumTime / (float)numFrames;
-            numFrames = 0;
-            accumTime = 0.0f;
-        }
+        float medianFrameTime = window.GetFrameTimePercentile(50.0f);
+        float worstFrameTime = window.GetFrameTimePercentile(99.0f);
 
-        int fpsWidth = std::min(WindowWidth, (int)((avgFrameTime*20.0f)*WindowWidth));
+        int fpsWidth = std::min(WindowWidth, (int)((medianFrameTime*20.0f)*WindowWidth));
         Pixie::ImGui::FilledRect(0, 0, fpsWidth, 10, MAKE_RGB(255, 0, 0), MAKE_RGB(255, 0, 0));
         Pixie::ImGui::FilledRect((int)((1.0f/60.0f)*20.0f*WindowWidth), 0, 2, 10, MAKE_RGB(0, 255, 0), MAKE_RGB(0, 255, 0));
 
         {
             char buf[128];
-            sprintf_s(buf, sizeof(buf), "%.2f fps", 1.0f / avgFrameTime);
-            font.Draw(buf, 10, 106, &window);
+            sprintf_s(buf, sizeof(buf), "%.2f fps (p99 %.2f ms)", 1.0f / medianFrameTime, worstFrameTime * 1000.0f);
+            Pixie::ImGui::Label(buf, 10, 106, MAKE_RGB(255, 255, 255));
         }
 
+        Pixie::ImGui::ProfilerGraph(10, 320, 620, 70);
+
+        // F1 saves the last few frames of profiler zones for chrome://tracing.
+        if (window.HasKeyGoneDown(Pixie::Key_F1))
+            Pixie::Profiler::WriteChromeTrace("pixie_trace.json");
+
         Pixie::ImGui::End();
 
         if (!window.Update())
             break;
+
+#if PIXIE_PLATFORM_HEADLESS
+        // Input is injected after Update(), which is where the other platforms pump events.
+        frame++;
+        if (frame == HeadlessFrames)
+            window.SetKeyDown(Pixie::Key_Escape, true);
+        else if (frame == HeadlessFrames + 1)
+            window.SetKeyDown(Pixie::Key_Escape, false);
+#endif
     }
 
     window.Close();
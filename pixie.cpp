@@ -1,23 +1,242 @@
 #include <string.h>
 #include <ctype.h>
 #include "pixie.h"
+#include "profiler.h"
 #include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#if !PIXIE_PLATFORM_WIN
+#include <sys/mman.h>
+#endif
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
 using namespace Pixie;
 
+// State shared between Update and the present thread.
+struct Window::PresentState
+{
+    struct Frame
+    {
+        int buffer;
+        DirtyRegion dirtyRegion;
+        int64_t inputTime;
+    };
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable queued;
+    std::condition_variable presented;
+
+    // Queue of frames waiting to be presented.
+    Frame frames[MaxBuffers];
+    int head;
+    int count;
+    bool inFlight[MaxBuffers];
+    bool quit;
+
+    std::atomic<uint64_t> submittedFrames;
+    std::atomic<uint64_t> presentedFrames;
+    std::atomic<float> latency;
+    std::atomic<const uint32_t*> frontPixels;
+};
+
+// A log of input recorded by StartRecording, or being played back by StartReplay. The
+// file starts with a header of the magic, version, and the buffer's width and height.
+// Each frame follows as its delta, the size of its input, then each piece of input as an
+// action byte and its values, all little endian.
+struct Window::InputLog
+{
+    FILE* recordFile;
+    bool recordedUpdate;        // Update has run since recording started.
+    uint8_t* actions;           // Input recorded since the last frame was written.
+    size_t actionsSize;
+    size_t actionsCapacity;
+
+    FILE* replayFile;
+    float fixedDelta;
+    uint8_t* frame;             // The frame being played back.
+    size_t frameCapacity;
+};
+
+static const uint8_t InputLogMagic[4] = { 'P', 'X', 'I', 'N' };
+static const uint32_t InputLogVersion = 1;
+
+enum InputAction
+{
+    InputAction_Key = 0,        // Key, down.
+    InputAction_MouseButton,    // MouseButton, down.
+    InputAction_MouseMove,      // x, y as 32 bit integers.
+    InputAction_Character,      // Character.
+};
+
+static void WriteU32(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t ReadU32(const uint8_t* data)
+{
+    return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Grows a buffer to hold at least size bytes, keeping its contents.
+static bool ReserveBytes(uint8_t*& data, size_t& capacity, size_t size)
+{
+    if (size <= capacity)
+        return true;
+
+    size_t newCapacity = capacity ? capacity * 2 : 256;
+    while (newCapacity < size)
+        newCapacity *= 2;
+    uint8_t* newData = (uint8_t*)realloc(data, newCapacity);
+    if (!newData)
+        return false;
+
+    data = newData;
+    capacity = newCapacity;
+    return true;
+}
+
+// Returns the pixels between rows of a backing buffer allocated with the given flags.
+static int GetBufferPitch(int width, uint32_t flags)
+{
+    if (!(flags & BufferFlag_PadRows))
+        return width;
+
+    // Rows a multiple of 2KB long map the same column of each row to the same few sets of
+    // an L1 cache, so drawing down a column keeps evicting itself.
+    const int CacheLinePixels = 64 / sizeof(uint32_t);
+    int pitch = (width + CacheLinePixels - 1) & ~(CacheLinePixels - 1);
+    if ((pitch * sizeof(uint32_t)) % 2048 == 0)
+        pitch += CacheLinePixels;
+    return pitch;
+}
+
+// Allocates a zeroed backing buffer starting on a cache line. largePages is set if the
+// buffer is in Windows large pages, which are freed differently.
+static uint32_t* AllocateBuffer(size_t size, bool hugePages, bool& largePages)
+{
+    const size_t CacheLine = 64;
+    largePages = false;
+
+#if PIXIE_PLATFORM_WIN
+    // Large pages need the lock pages in memory privilege, so fall back to normal pages
+    // without it. Memory from VirtualAlloc is already zeroed.
+    SIZE_T largePageSize = hugePages ? GetLargePageMinimum() : 0;
+    if (largePageSize)
+    {
+        size_t rounded = (size + largePageSize - 1) & ~(largePageSize - 1);
+        void* pixels = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (pixels)
+        {
+            largePages = true;
+            return (uint32_t*)pixels;
+        }
+    }
+
+    void* pixels = _aligned_malloc(size, CacheLine);
+#else
+    // Transparent huge pages only back whole, aligned huge pages. Clearing the buffer
+    // after the advice faults it in as huge pages rather than splitting them later.
+    size_t alignment = CacheLine;
+#ifdef MADV_HUGEPAGE
+    const size_t HugePageSize = 2 * 1024 * 1024;
+    if (hugePages)
+    {
+        alignment = HugePageSize;
+        size = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+    }
+#endif
+
+    void* pixels = 0;
+    if (posix_memalign(&pixels, alignment, size) != 0)
+        return 0;
+#ifdef MADV_HUGEPAGE
+    if (hugePages)
+        madvise(pixels, size, MADV_HUGEPAGE);
+#endif
+#endif
+
+    if (pixels)
+        memset(pixels, 0, size);
+    return (uint32_t*)pixels;
+}
+
+static void FreeBuffer(uint32_t* pixels, bool largePages)
+{
+#if PIXIE_PLATFORM_WIN
+    if (largePages)
+        VirtualFree(pixels, 0, MEM_RELEASE);
+    else
+        _aligned_free(pixels);
+#else
+    (void)largePages;
+    free(pixels);
+#endif
+}
+
 Window::Window()
 {
     m_keyCallback = NULL;
     m_delta = 0.0f;
     m_pixels = 0;
+    m_pitch = 0;
+    m_bufferPitch = 0;
+    m_bufferFlags = 0;
     m_scale = 1;
+    m_width = m_height = 0;
+    m_dirtyRectTracking = false;
+    m_presentedBytes = 0;
+    m_numBuffers = 0;
+    m_backBuffer = 0;
+    m_bufferDirtyIndex = 0;
+    m_inputTime = 0;
+    memset(m_buffers, 0, sizeof(m_buffers));
+    memset(m_largePageBuffers, 0, sizeof(m_largePageBuffers));
+    m_windowWidth = m_windowHeight = 0;
+    m_scaleFilter = ScaleFilter_Nearest;
+    m_presentPixels = 0;
+    m_largePagePresent = false;
+
+    m_frameRateMode = FrameRate_Uncapped;
+    m_targetFrameRate = 60.0f;
+    m_nextFrameTime = 0;
+    m_frameStartTime = 0;
+    m_sleepMargin = 0;
+    m_rateDivisor = 1;
+    m_slowFrames = 0;
+    m_fastFrames = 0;
+    m_frameTimeIndex = 0;
+    m_frameTimeCount = 0;
+
+    m_present = new PresentState;
+    m_present->head = 0;
+    m_present->count = 0;
+    m_present->quit = false;
+    m_present->submittedFrames = 0;
+    m_present->presentedFrames = 0;
+    m_present->latency = 0.0f;
+    m_present->frontPixels = 0;
+    m_frameRecorder = 0;
+    m_frameStreamer = 0;
 
     assert(sizeof(m_mouseButtonDown) == sizeof(m_lastMouseButtonDown));
     memset(m_mouseButtonDown, 0, sizeof(m_mouseButtonDown));
     memset(m_lastMouseButtonDown, 0, sizeof(m_lastMouseButtonDown));
 
     memset(m_inputCharacters, 0, sizeof(m_inputCharacters));
-    assert(sizeof(m_keyDown) == sizeof(m_lastKeyDown));
+    m_inputEventsEnabled = false;
+    m_captureInput = false;
+    m_inputBlocked = false;
+    m_inputLog = new InputLog;
+    memset(m_inputLog, 0, sizeof(InputLog));
     memset(m_lastKeyDown, 0, sizeof(m_lastKeyDown));
     memset(m_keyDown, 0, sizeof(m_keyDown));
 
@@ -26,48 +245,516 @@ Window::Window()
         m_keyMap[i] = i >= Key_ASCII_Start && i <= Key_ASCII_End ? i : Key_Num;
 
     PlatformInit();
+
+    // Build the reverse map backwards, so the first Key mapped to a platform key wins.
+    memset(m_mappedKeys, 0, sizeof(m_mappedKeys));
+    for (int i = 0; i < MaxPlatformKeys; i++)
+        m_platformKeyMap[i] = Key_Num;
+    for (int i = Key_Num - 1; i >= 0; i--)
+    {
+        int platformKey = m_keyMap[i];
+        if (platformKey < 0)
+            continue;
+
+        assert(platformKey < MaxPlatformKeys);
+        m_platformKeyMap[platformKey] = (Key)i;
+        m_mappedKeys[platformKey >> 6] |= (uint64_t)1 << (platformKey & 63);
+    }
 }
 
 Window::~Window()
 {
-    delete[] m_pixels;
+    StopPresentThread();
+    FreeBuffers();
+    delete m_present;
+
+    StopRecording();
+    StopReplay();
+    free(m_inputLog->actions);
+    free(m_inputLog->frame);
+    delete m_inputLog;
 }
 
-bool Window::Open(const TCHAR* title, int width, int height, bool fullscreen, bool maintainAspectRatio /*= false*/, int scale /*= 1*/)
+bool Window::Open(const TCHAR* title, int width, int height, bool fullscreen, bool maintainAspectRatio /*= false*/, int scale /*= 1*/, int numBuffers /*= 1*/)
 {
-    // Create the buffer first because on OSX we need it to exist when initialising.
-    m_pixels = new uint32_t[width * height];
+    assert(numBuffers >= 1 && numBuffers <= MaxBuffers);
+
+    // A present thread left from an earlier Open may still be presenting the old buffers.
+    StopPresentThread();
+    FreeBuffers();
+
+    // Create the buffers first because on OSX we need them to exist when initialising.
+    int pitch = GetBufferPitch(width, m_bufferFlags);
+    size_t size = (size_t)pitch * height * sizeof(uint32_t);
+    bool hugePages = (m_bufferFlags & BufferFlag_HugePages) && size >= HugePageMinSize;
+    m_numBuffers = numBuffers;
+    for (int i = 0; i < numBuffers; i++)
+    {
+        m_buffers[i] = AllocateBuffer(size, hugePages, m_largePageBuffers[i]);
+        if (!m_buffers[i])
+        {
+            FreeBuffers();
+            return false;
+        }
+    }
+
+    m_backBuffer = 0;
+    m_pixels = m_buffers[0];
+    m_pitch = pitch;
+    m_bufferPitch = pitch;
+    m_present->frontPixels = m_pixels;
     m_width = width;
     m_height = height;
     m_scale = scale;
     m_time = 0.0f;
     m_fullscreen = fullscreen;
     m_maintainAspectRatio = maintainAspectRatio;
+    m_dirtyRegion.Clear();
+    m_presentedRegion.Clear();
+    MarkAllDirty();
+
+    m_bufferDirtyIndex = 0;
+    for (int i = 0; i < numBuffers - 1; i++)
+        m_bufferDirtyRegions[i].Clear();
 
     if (!PlatformOpen(title, width, height))
     {
-        delete[] m_pixels;
-        m_pixels = 0;
+        FreeBuffers();
         return false;
     }
 
+    // The platform has worked out the size of the window's contents. If it's larger than
+    // the buffer, frames are scaled into a buffer that size to present.
+    if (m_windowWidth != m_width || m_windowHeight != m_height)
+    {
+        size_t presentSize = (size_t)m_windowWidth * m_windowHeight * sizeof(uint32_t);
+        bool presentHugePages = (m_bufferFlags & BufferFlag_HugePages) && presentSize >= HugePageMinSize;
+        m_presentPixels = AllocateBuffer(presentSize, presentHugePages, m_largePagePresent);
+        if (!m_presentPixels)
+        {
+            PlatformClose();
+            FreeBuffers();
+            return false;
+        }
+
+        m_scaler.Init(m_width, m_height, m_windowWidth, m_windowHeight, m_scaleFilter, m_fullscreen && m_maintainAspectRatio);
+        m_scaler.FillBorders(Surface(m_presentPixels, m_windowWidth, m_windowHeight, m_windowWidth));
+    }
+
+    m_inputTime = PlatformGetTime();
+
+    if (m_numBuffers > 1 && PlatformSupportsPresentThread())
+        StartPresentThread();
+
     return true;
 }
 
 bool Window::Update()
 {
+    // Each profiler frame runs from the start of one Update to the start of the next.
+    Profiler::MarkFrame();
+    PIXIE_PROFILE_ZONE("Window::Update");
+
+    // Input set after the last Update, such as headless input, belongs to the last frame.
+    if (m_inputLog->recordFile && m_inputLog->recordedUpdate)
+        RecordFrame();
+
     UpdateMouse();
     UpdateKeyboard();
-    bool result = PlatformUpdate();
+
+    // The platform presents the dirty region, so without tracking it is the whole buffer.
+    if (!m_dirtyRectTracking)
+        MarkAllDirty();
+
+    PaceFrame();
+
+    bool result;
+    {
+        PIXIE_PROFILE_ZONE("Window::PlatformUpdate");
+        result = PlatformUpdate();
+    }
+
+    if (m_inputLog->replayFile && !ReplayFrame())
+    {
+        StopReplay();
+        result = false;
+    }
+    if (m_inputLog->recordFile)
+        m_inputLog->recordedUpdate = true;
+
     m_time += m_delta;
+
+    m_frameTimes[m_frameTimeIndex] = m_delta;
+    m_frameTimeIndex = (m_frameTimeIndex + 1) % FrameTimeHistory;
+    if (m_frameTimeCount < FrameTimeHistory)
+        m_frameTimeCount++;
+
+    if (result)
+    {
+        // The frame is copied before presenting, which may hand the buffer to another thread.
+        Surface frame(m_pixels, m_width, m_height, m_pitch);
+        if (m_frameRecorder)
+            m_frameRecorder->Capture(frame);
+        if (m_frameStreamer)
+            m_frameStreamer->Capture(frame);
+        Present();
+        m_inputTime = PlatformGetTime();
+    }
+
+    m_frameStartTime = PlatformGetTime();
+
+    m_presentedBytes = m_dirtyRegion.GetArea() * sizeof(uint32_t);
+    m_presentedRegion = m_dirtyRegion;
+    m_dirtyRegion.Clear();
+
     return result;
 }
 
+void Window::SetFrameRate(FrameRateMode mode, float targetFps /*= 60.0f*/)
+{
+    assert(mode == FrameRate_Uncapped || targetFps > 0.0f);
+
+    m_frameRateMode = mode;
+    m_targetFrameRate = targetFps;
+    m_nextFrameTime = 0;
+    m_rateDivisor = 1;
+    m_slowFrames = 0;
+    m_fastFrames = 0;
+}
+
+float Window::GetFrameTimePercentile(float percentile) const
+{
+    if (m_frameTimeCount == 0)
+        return 0.0f;
+
+    float times[FrameTimeHistory];
+    memcpy(times, m_frameTimes, m_frameTimeCount * sizeof(float));
+
+    int index = (int)((percentile / 100.0f) * (m_frameTimeCount - 1) + 0.5f);
+    index = std::max(0, std::min(index, m_frameTimeCount - 1));
+    std::nth_element(times, times + index, times + m_frameTimeCount);
+    return times[index];
+}
+
+void Window::PaceFrame()
+{
+    if (m_frameRateMode == FrameRate_Uncapped)
+        return;
+
+    PIXIE_PROFILE_ZONE("Window::PaceFrame");
+
+    // Frames slower than the paced rate for this many frames in a row drop adaptive
+    // pacing to the next fraction of the target rate. Frames fast enough for the next
+    // higher rate for this many frames in a row go back up.
+    const int AdaptiveSlowFrames = 8;
+    const int AdaptiveFastFrames = 60;
+    const int MaxRateDivisor = 4;
+
+    int64_t now = PlatformGetTime();
+    int64_t basePeriod = (int64_t)(m_freq / m_targetFrameRate);
+
+    if (m_frameRateMode == FrameRate_Adaptive)
+    {
+        int64_t work = now - m_frameStartTime;
+        if (work > basePeriod * m_rateDivisor)
+        {
+            m_fastFrames = 0;
+            if (++m_slowFrames >= AdaptiveSlowFrames && m_rateDivisor < MaxRateDivisor)
+            {
+                m_rateDivisor++;
+                m_slowFrames = 0;
+            }
+        }
+        else if (m_rateDivisor > 1 && work < (basePeriod * (m_rateDivisor - 1) * 3) / 4)
+        {
+            m_slowFrames = 0;
+            if (++m_fastFrames >= AdaptiveFastFrames)
+            {
+                m_rateDivisor--;
+                m_fastFrames = 0;
+            }
+        }
+        else
+        {
+            m_slowFrames = 0;
+            m_fastFrames = 0;
+        }
+    }
+
+    int64_t period = basePeriod * m_rateDivisor;
+
+    // If we've fallen more than a frame behind, start again from now rather than
+    // rushing through frames to catch up.
+    if (m_nextFrameTime == 0 || now - m_nextFrameTime > period)
+        m_nextFrameTime = now;
+
+    // Sleep until shortly before the frame is due. The margin tracks how late the
+    // platform's sleep wakes up, so the spin afterwards is short but still on time.
+    const int64_t MinSleepMargin = m_freq / 5000;   // 0.2ms
+    const int64_t MaxSleepMargin = m_freq / 250;    // 4ms
+    if (m_sleepMargin == 0)
+        m_sleepMargin = m_freq / 1000;
+
+    if (m_nextFrameTime - now > m_sleepMargin)
+    {
+        int64_t wakeTime = m_nextFrameTime - m_sleepMargin;
+        PlatformSleepUntil(wakeTime);
+
+        int64_t overslept = PlatformGetTime() - wakeTime;
+        if (overslept > m_sleepMargin / 2)
+            m_sleepMargin = std::min(overslept * 2, MaxSleepMargin);
+        else
+            m_sleepMargin = std::max(m_sleepMargin - (m_sleepMargin >> 4), MinSleepMargin);
+    }
+
+    while (PlatformGetTime() < m_nextFrameTime)
+        ;
+
+    m_nextFrameTime += period;
+}
+
 void Window::Close()
 {
+    StopPresentThread();
     PlatformClose();
 }
 
+void Window::Present()
+{
+    PIXIE_PROFILE_ZONE("Window::Present");
+    PresentState* present = m_present;
+    present->submittedFrames++;
+
+    if (!present->thread.joinable())
+    {
+        // Present synchronously.
+        PresentFrame(m_pixels, m_dirtyRegion);
+        present->frontPixels = m_pixels;
+        present->latency = (PlatformGetTime() - m_inputTime) / (float)m_freq;
+        present->presentedFrames++;
+    }
+    else
+    {
+        // Queue the backing buffer for the present thread.
+        std::lock_guard<std::mutex> lock(present->lock);
+        assert(present->count < m_numBuffers);
+        PresentState::Frame& frame = present->frames[(present->head + present->count) % MaxBuffers];
+        frame.buffer = m_backBuffer;
+        frame.dirtyRegion = m_dirtyRegion;
+        frame.inputTime = m_inputTime;
+        present->inFlight[m_backBuffer] = true;
+        present->count++;
+        present->queued.notify_one();
+    }
+
+    if (m_numBuffers == 1)
+        return;
+
+    // Move on to the next buffer, waiting for the present thread to finish with it.
+    int next = (m_backBuffer + 1) % m_numBuffers;
+    if (present->thread.joinable())
+    {
+        std::unique_lock<std::mutex> lock(present->lock);
+        present->presented.wait(lock, [&]() { return !present->inFlight[next]; });
+    }
+
+    // The next buffer last held the frame submitted m_numBuffers - 1 frames ago, so copy
+    // over everything that has changed since then from the frame just submitted.
+    m_bufferDirtyRegions[m_bufferDirtyIndex] = m_dirtyRegion;
+    m_bufferDirtyIndex = (m_bufferDirtyIndex + 1) % (m_numBuffers - 1);
+
+    const uint32_t* src = m_buffers[m_backBuffer];
+    uint32_t* dst = m_buffers[next];
+    for (int i = 0; i < m_numBuffers - 1; i++)
+    {
+        const DirtyRegion& region = m_bufferDirtyRegions[i];
+        for (int j = 0; j < region.GetCount(); j++)
+        {
+            const DirtyRect& rect = region.Get(j);
+            size_t rowBytes = (rect.right - rect.left) * sizeof(uint32_t);
+            for (int y = rect.top; y < rect.bottom; y++)
+                memcpy(dst + rect.left + (y * m_pitch), src + rect.left + (y * m_pitch), rowBytes);
+        }
+    }
+
+    m_backBuffer = next;
+    m_pixels = m_buffers[next];
+}
+
+// Hands a frame to the platform, first scaling what's dirty into the present buffer if
+// the window is larger than the frame.
+void Window::PresentFrame(const uint32_t* pixels, const DirtyRegion& dirtyRegion)
+{
+    Surface frame((uint32_t*)pixels, m_width, m_height, m_pitch);
+    if (!m_presentPixels)
+    {
+        PIXIE_PROFILE_ZONE("Window::PlatformPresent");
+        PlatformPresent(frame, dirtyRegion);
+        return;
+    }
+
+    Surface target(m_presentPixels, m_windowWidth, m_windowHeight, m_windowWidth);
+    {
+        PIXIE_PROFILE_ZONE("Window::Scale");
+        m_scaledRegion.Clear();
+        bool wholeFrame = false;
+        for (int i = 0; i < dirtyRegion.GetCount(); i++)
+        {
+            const DirtyRect& dirty = dirtyRegion.Get(i);
+            SurfaceRect srcRect = { dirty.left, dirty.top, dirty.right, dirty.bottom };
+            SurfaceRect rect = m_scaler.MapRect(srcRect);
+            m_scaler.Scale(target, frame, rect);
+            if (rect.left < rect.right && rect.top < rect.bottom)
+                m_scaledRegion.Add(rect.left, rect.top, rect.right, rect.bottom);
+            if (dirty.left == 0 && dirty.top == 0 && dirty.right == (int)m_width && dirty.bottom == (int)m_height)
+                wholeFrame = true;
+        }
+
+        // When the whole frame is presented, so are the borders around it.
+        if (wholeFrame)
+            m_scaledRegion.Add(0, 0, m_windowWidth, m_windowHeight);
+    }
+
+    PIXIE_PROFILE_ZONE("Window::PlatformPresent");
+    PlatformPresent(target, m_scaledRegion);
+}
+
+void Window::StartPresentThread()
+{
+    PresentState* present = m_present;
+    present->head = 0;
+    present->count = 0;
+    present->quit = false;
+    for (int i = 0; i < MaxBuffers; i++)
+        present->inFlight[i] = false;
+
+    present->thread = std::thread(&Window::PresentThreadMain, this);
+}
+
+void Window::StopPresentThread()
+{
+    PresentState* present = m_present;
+    if (!present->thread.joinable())
+        return;
+
+    // The present thread drains the queue before quitting.
+    {
+        std::lock_guard<std::mutex> lock(present->lock);
+        present->quit = true;
+    }
+    present->queued.notify_one();
+    present->thread.join();
+}
+
+void Window::PresentThreadMain()
+{
+    PresentState* present = m_present;
+
+    for (;;)
+    {
+        PresentState::Frame* frame;
+
+        {
+            std::unique_lock<std::mutex> lock(present->lock);
+            present->queued.wait(lock, [&]() { return present->quit || present->count > 0; });
+            if (present->count == 0)
+                return;
+            frame = &present->frames[present->head];
+        }
+
+        // The frame stays at the head of the queue, so Update won't overwrite it.
+        const uint32_t* pixels = m_buffers[frame->buffer];
+        PresentFrame(pixels, frame->dirtyRegion);
+        int64_t time = PlatformGetTime();
+
+        {
+            std::lock_guard<std::mutex> lock(present->lock);
+            present->frontPixels = pixels;
+            present->latency = (time - frame->inputTime) / (float)m_freq;
+            present->presentedFrames++;
+            present->inFlight[frame->buffer] = false;
+            present->head = (present->head + 1) % MaxBuffers;
+            present->count--;
+        }
+        present->presented.notify_one();
+    }
+}
+
+void Window::FreeBuffers()
+{
+    for (int i = 0; i < MaxBuffers; i++)
+    {
+        if (m_buffers[i])
+            FreeBuffer(m_buffers[i], m_largePageBuffers[i]);
+        m_buffers[i] = 0;
+        m_largePageBuffers[i] = false;
+    }
+
+    if (m_presentPixels)
+        FreeBuffer(m_presentPixels, m_largePagePresent);
+    m_presentPixels = 0;
+    m_largePagePresent = false;
+
+    m_pixels = 0;
+    m_pitch = 0;
+    m_numBuffers = 0;
+}
+
+bool Window::SetBackBuffer(const Surface& surface)
+{
+    if (m_numBuffers != 1)
+        return false;
+
+    if (!surface.GetPixels())
+    {
+        m_pixels = m_buffers[0];
+        m_pitch = m_bufferPitch;
+    }
+    else
+    {
+        if (surface.GetWidth() < (int)m_width || surface.GetHeight() < (int)m_height)
+            return false;
+        m_pixels = surface.GetPixels();
+        m_pitch = surface.GetStride();
+    }
+
+    // The platform may redraw the window from the front buffer at any time, and with one
+    // buffer that's the back buffer. Nothing in the new buffer has been presented yet.
+    m_present->frontPixels = m_pixels;
+    MarkAllDirty();
+    return true;
+}
+
+uint64_t Window::GetSubmittedFrames() const
+{
+    return m_present->submittedFrames;
+}
+
+uint64_t Window::GetPresentedFrames() const
+{
+    return m_present->presentedFrames;
+}
+
+float Window::GetPresentLatency() const
+{
+    return m_present->latency;
+}
+
+Surface Window::GetFrontSurface() const
+{
+    if (m_presentPixels)
+        return Surface(m_presentPixels, m_windowWidth, m_windowHeight, m_windowWidth);
+    return Surface((uint32_t*)(const uint32_t*)m_present->frontPixels, m_width, m_height, m_pitch);
+}
+
+void Window::SetDirtyRectTracking(bool enabled)
+{
+    m_dirtyRectTracking = enabled;
+
+    // Nothing is known about what has been presented so far.
+    MarkAllDirty();
+}
+
 void Window::UpdateMouse()
 {
     memcpy(m_lastMouseButtonDown, m_mouseButtonDown, sizeof(m_mouseButtonDown));
@@ -79,8 +766,288 @@ void Window::UpdateKeyboard()
     memcpy(m_lastKeyDown, m_keyDown, sizeof(m_keyDown));
 }
 
-void Window::AddInputCharacter(char c)
+void Window::SetInputEventsEnabled(bool enabled)
+{
+    m_inputEventsEnabled = enabled;
+    if (!enabled)
+        m_inputQueue.Clear();
+    UpdateCaptureInput();
+}
+
+void Window::UpdateCaptureInput()
+{
+    m_captureInput = m_inputEventsEnabled || m_inputLog->recordFile;
+}
+
+int64_t Window::GetTicks() const
+{
+    return PlatformGetTime();
+}
+
+void Window::QueueInputEvent(InputEventType type, int code, int64_t time)
+{
+    if (m_inputLog->recordFile)
+        RecordInput(type, code);
+    if (!m_inputEventsEnabled)
+        return;
+
+    InputEvent event;
+    event.type = type;
+    event.code = code;
+    event.x = m_mouseX;
+    event.y = m_mouseY;
+    event.time = time < 0 ? PlatformGetTime() : time;
+    m_inputQueue.Push(event);
+}
+
+void Window::WindowToBuffer(int windowX, int windowY, int& x, int& y) const
+{
+    if (m_presentPixels)
+    {
+        m_scaler.MapToSource(windowX, windowY, x, y);
+    }
+    else
+    {
+        x = windowX;
+        y = windowY;
+    }
+}
+
+bool Window::StartRecording(const char* filename)
 {
+    StopRecording();
+
+    InputLog* log = m_inputLog;
+    log->recordFile = fopen(filename, "wb");
+    if (!log->recordFile)
+        return false;
+
+    uint8_t header[16];
+    memcpy(header, InputLogMagic, sizeof(InputLogMagic));
+    WriteU32(header + 4, InputLogVersion);
+    WriteU32(header + 8, (uint32_t)m_width);
+    WriteU32(header + 12, (uint32_t)m_height);
+    if (fwrite(header, sizeof(header), 1, log->recordFile) != 1)
+    {
+        fclose(log->recordFile);
+        log->recordFile = 0;
+        return false;
+    }
+
+    log->recordedUpdate = false;
+    log->actionsSize = 0;
+    UpdateCaptureInput();
+
+    // A replay starts with nothing held down, so record what already is.
+    RecordInput(InputEvent_MouseMove, 0);
+    for (int i = 0; i < MouseButton_Num; i++)
+    {
+        if (m_mouseButtonDown[i])
+            RecordInput(InputEvent_MouseDown, i);
+    }
+    for (int i = 0; i < Key_Num; i++)
+    {
+        if (IsKeyDown((Key)i))
+            RecordInput(InputEvent_KeyDown, i);
+    }
+
+    return true;
+}
+
+void Window::StopRecording()
+{
+    InputLog* log = m_inputLog;
+    if (!log->recordFile)
+        return;
+
+    if (log->recordedUpdate)
+        RecordFrame();
+    if (log->recordFile)
+    {
+        fclose(log->recordFile);
+        log->recordFile = 0;
+    }
+    UpdateCaptureInput();
+}
+
+bool Window::IsRecording() const
+{
+    return m_inputLog->recordFile != 0;
+}
+
+void Window::RecordInput(InputEventType type, int code)
+{
+    uint8_t action[9];
+    size_t size = 2;
+    switch (type)
+    {
+        case InputEvent_KeyDown:
+        case InputEvent_KeyUp:
+            action[0] = InputAction_Key;
+            action[1] = (uint8_t)code;
+            action[2] = type == InputEvent_KeyDown;
+            size = 3;
+            break;
+        case InputEvent_MouseDown:
+        case InputEvent_MouseUp:
+            action[0] = InputAction_MouseButton;
+            action[1] = (uint8_t)code;
+            action[2] = type == InputEvent_MouseDown;
+            size = 3;
+            break;
+        case InputEvent_MouseMove:
+            action[0] = InputAction_MouseMove;
+            WriteU32(action + 1, (uint32_t)m_mouseX);
+            WriteU32(action + 5, (uint32_t)m_mouseY);
+            size = 9;
+            break;
+        case InputEvent_Character:
+            action[0] = InputAction_Character;
+            action[1] = (uint8_t)code;
+            break;
+    }
+
+    InputLog* log = m_inputLog;
+    if (!ReserveBytes(log->actions, log->actionsCapacity, log->actionsSize + size))
+        return;
+    memcpy(log->actions + log->actionsSize, action, size);
+    log->actionsSize += size;
+}
+
+void Window::RecordFrame()
+{
+    InputLog* log = m_inputLog;
+    uint32_t delta;
+    memcpy(&delta, &m_delta, sizeof(delta));
+    uint8_t header[8];
+    WriteU32(header, delta);
+    WriteU32(header + 4, (uint32_t)log->actionsSize);
+    bool written = fwrite(header, sizeof(header), 1, log->recordFile) == 1;
+    if (written && log->actionsSize)
+        written = fwrite(log->actions, log->actionsSize, 1, log->recordFile) == 1;
+    log->actionsSize = 0;
+
+    // Stop rather than write a log with frames missing.
+    if (!written)
+    {
+        fclose(log->recordFile);
+        log->recordFile = 0;
+        UpdateCaptureInput();
+    }
+}
+
+bool Window::StartReplay(const char* filename, float fixedDelta /*= 0.0f*/)
+{
+    StopReplay();
+
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    uint8_t header[16];
+    if (fread(header, sizeof(header), 1, file) != 1 || memcmp(header, InputLogMagic, sizeof(InputLogMagic)) != 0 ||
+        ReadU32(header + 4) != InputLogVersion || ReadU32(header + 8) != (uint32_t)m_width || ReadU32(header + 12) != (uint32_t)m_height)
+    {
+        fclose(file);
+        return false;
+    }
+
+    m_inputLog->replayFile = file;
+    m_inputLog->fixedDelta = fixedDelta;
+
+    // Start from nothing held down, as the recording did, without telling anyone.
+    m_mouseX = m_mouseY = 0;
+    memset(m_mouseButtonDown, 0, sizeof(m_mouseButtonDown));
+    memset(m_lastMouseButtonDown, 0, sizeof(m_lastMouseButtonDown));
+    memset(m_keyDown, 0, sizeof(m_keyDown));
+    memset(m_lastKeyDown, 0, sizeof(m_lastKeyDown));
+    memset(m_inputCharacters, 0, sizeof(m_inputCharacters));
+    m_inputBlocked = true;
+    return true;
+}
+
+void Window::StopReplay()
+{
+    if (!m_inputLog->replayFile)
+        return;
+
+    fclose(m_inputLog->replayFile);
+    m_inputLog->replayFile = 0;
+    m_inputBlocked = false;
+}
+
+bool Window::IsReplaying() const
+{
+    return m_inputLog->replayFile != 0;
+}
+
+bool Window::ReplayFrame()
+{
+    InputLog* log = m_inputLog;
+    uint8_t header[8];
+    if (fread(header, sizeof(header), 1, log->replayFile) != 1)
+        return false;
+
+    uint32_t size = ReadU32(header + 4);
+    if (!ReserveBytes(log->frame, log->frameCapacity, size) || (size && fread(log->frame, size, 1, log->replayFile) != 1))
+        return false;
+
+    uint32_t delta = ReadU32(header);
+    memcpy(&m_delta, &delta, sizeof(m_delta));
+    if (log->fixedDelta > 0.0f)
+        m_delta = log->fixedDelta;
+
+    // The input goes through the usual functions, so callbacks, events and recording see it.
+    m_inputBlocked = false;
+    bool valid = true;
+    const uint8_t* action = log->frame;
+    const uint8_t* end = log->frame + size;
+    while (valid && action < end)
+    {
+        switch (action[0])
+        {
+            case InputAction_Key:
+                valid = end - action >= 3 && action[1] < Key_Num && m_keyMap[action[1]] >= 0;
+                if (valid)
+                    SetKeyDown(m_keyMap[action[1]], action[2] != 0);
+                action += 3;
+                break;
+            case InputAction_MouseButton:
+                valid = end - action >= 3 && action[1] < MouseButton_Num;
+                if (valid)
+                    SetMouseButtonDown((MouseButton)action[1], action[2] != 0);
+                action += 3;
+                break;
+            case InputAction_MouseMove:
+                valid = end - action >= 9;
+                if (valid)
+                    SetMousePosition((int)ReadU32(action + 1), (int)ReadU32(action + 5));
+                action += 9;
+                break;
+            case InputAction_Character:
+                valid = end - action >= 2;
+                if (valid)
+                    AddInputCharacter((char)action[1]);
+                action += 2;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+    }
+    m_inputBlocked = true;
+    return valid;
+}
+
+void Window::AddInputCharacter(char c, int64_t time)
+{
+    if (m_inputBlocked)
+        return;
+
+    // Every character is queued, but only printable ones are kept for the frame.
+    if (m_captureInput)
+        QueueInputEvent(InputEvent_Character, (unsigned char)c, time);
+
     if (!isprint(c))
         return;
 
@@ -92,3 +1059,76 @@ void Window::AddInputCharacter(char c)
     }
 }
 
+static inline uint32_t Area(const DirtyRect& rect)
+{
+    return (uint32_t)((rect.right - rect.left) * (rect.bottom - rect.top));
+}
+
+static inline DirtyRect Union(const DirtyRect& a, const DirtyRect& b)
+{
+    DirtyRect rect;
+    rect.left = a.left < b.left ? a.left : b.left;
+    rect.top = a.top < b.top ? a.top : b.top;
+    rect.right = a.right > b.right ? a.right : b.right;
+    rect.bottom = a.bottom > b.bottom ? a.bottom : b.bottom;
+    return rect;
+}
+
+void DirtyRegion::Add(int left, int top, int right, int bottom)
+{
+    assert(left < right && top < bottom);
+
+    DirtyRect rect = { left, top, right, bottom };
+    m_numAdded++;
+
+    // Keep merging until the rectangle doesn't combine with any existing one. Each merge
+    // removes an existing rectangle, so this terminates.
+    bool merged = true;
+    while (merged)
+    {
+        merged = false;
+        for (int i = 0; i < m_count; i++)
+        {
+            // Merge if the union wastes no more area than the rectangles overlap by,
+            // which includes one rectangle containing the other.
+            DirtyRect merge = Union(m_rects[i], rect);
+            if (Area(merge) <= Area(m_rects[i]) + Area(rect))
+            {
+                rect = merge;
+                m_rects[i] = m_rects[--m_count];
+                merged = true;
+                break;
+            }
+        }
+
+        if (!merged && m_count == MaxRects)
+        {
+            // Out of space, so merge with the rectangle that grows the least.
+            int best = 0;
+            uint32_t bestGrowth = 0xffffffff;
+            for (int i = 0; i < m_count; i++)
+            {
+                uint32_t growth = Area(Union(m_rects[i], rect)) - Area(m_rects[i]);
+                if (growth < bestGrowth)
+                {
+                    best = i;
+                    bestGrowth = growth;
+                }
+            }
+
+            rect = Union(m_rects[best], rect);
+            m_rects[best] = m_rects[--m_count];
+            merged = true;
+        }
+    }
+
+    m_rects[m_count++] = rect;
+}
+
+uint32_t DirtyRegion::GetArea() const
+{
+    uint32_t area = 0;
+    for (int i = 0; i < m_count; i++)
+        area += Area(m_rects[i]);
+    return area;
+}
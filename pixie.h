@@ -3,6 +3,11 @@
 #include <assert.h>
 #include <stdint.h>
 #include "core.h"
+#include "surface.h"
+#include "scaler.h"
+#include "input.h"
+#include "recorder.h"
+#include "stream.h"
 
 namespace Pixie
 {
@@ -66,7 +71,82 @@ namespace Pixie
 
     enum
     {
-        MaxPlatformKeys = 256
+        MaxPlatformKeys = 256,
+        KeyWords = MaxPlatformKeys / 64,    // 64-bit words in a bitset of platform keys.
+        MaxBuffers = 3,
+        FrameTimeHistory = 256
+    };
+
+    // How the window allocates its backing buffers. Buffers always start on a 64-byte
+    // cache line.
+    enum BufferFlags
+    {
+        BufferFlag_PadRows = 1 << 0,    // Rows start on cache lines, and rows a multiple of 2KB
+                                        // long get an extra line so the same column of
+                                        // neighbouring rows doesn't share a cache set.
+        BufferFlag_HugePages = 1 << 1,  // Buffers of HugePageMinSize or more use huge pages
+                                        // where the OS allows, for fewer TLB misses.
+    };
+
+    enum
+    {
+        HugePageMinSize = 16 * 1024 * 1024,
+    };
+
+    enum FrameRateMode
+    {
+        FrameRate_Uncapped = 0,     // Update returns as soon as the frame is presented.
+        FrameRate_Target,           // Update waits so that frames are a fixed time apart.
+        FrameRate_Adaptive,         // Like FrameRate_Target, but drops to a whole fraction of
+                                    // the target rate while frames can't keep up with it.
+    };
+
+    // A rectangle of the backing buffer, with exclusive right and bottom edges.
+    struct DirtyRect
+    {
+        int left;
+        int top;
+        int right;
+        int bottom;
+    };
+
+    // A small set of rectangles covering the regions of the backing buffer that have
+    // changed. Rectangles are merged as they are added whenever the merged rectangle
+    // wastes no more area than the two overlapped, and when the set is full a new
+    // rectangle is merged with whichever existing one grows the least.
+    class DirtyRegion
+    {
+        public:
+            enum
+            {
+                MaxRects = 16
+            };
+
+            DirtyRegion();
+
+            // Adds a rectangle to the region, coalescing it with the existing rectangles.
+            void Add(int left, int top, int right, int bottom);
+
+            // Removes all rectangles from the region.
+            void Clear();
+
+            // Returns the number of rectangles in the region.
+            int GetCount() const;
+
+            // Returns the rectangle at the given index.
+            const DirtyRect& Get(int index) const;
+
+            // Returns the total area of the rectangles in pixels.
+            uint32_t GetArea() const;
+
+            // Returns the number of rectangles added since the region was last cleared,
+            // before merging.
+            int GetNumAdded() const;
+
+        private:
+            DirtyRect m_rects[MaxRects];
+            int m_count;
+            int m_numAdded;
     };
 
     class Window
@@ -77,13 +157,35 @@ namespace Pixie
 
             // Open the Pixie window with the specified title bar, width, and height.
             // If scale is greater than 1 the window will be rendered scale times larger
-            // and the buffer will be stretched to fit.
-            bool Open(const TCHAR* title, int width, int height, bool fullscreen, bool maintainAspectRatio = false, int scale = 1);
+            // and the buffer will be stretched to fit. Pixie does the stretching itself
+            // (see SetScaleFilter), so it looks the same on every platform, and only
+            // draws what's dirty. Fullscreen with maintainAspectRatio letterboxes the
+            // buffer in the middle of the screen.
+            // If numBuffers is greater than 1 (up to MaxBuffers) the window owns that many
+            // backing buffers and a present thread copies each finished buffer to the
+            // window while the application renders into the next one.
+            bool Open(const TCHAR* title, int width, int height, bool fullscreen, bool maintainAspectRatio = false, int scale = 1, int numBuffers = 1);
 
             // Close the Pixie window.
             void Close();
 
+            // Sets how the backing buffers are allocated (see BufferFlags). Takes effect at
+            // the next Open.
+            void SetBufferFlags(uint32_t flags);
+            uint32_t GetBufferFlags() const;
+
+            // Sets how the buffer is stretched to a window larger than it. Whole number
+            // scales with ScaleFilter_Nearest, the default, are the cheapest. Takes effect at
+            // the next Open.
+            void SetScaleFilter(ScaleFilter filter);
+            ScaleFilter GetScaleFilter() const;
+
             // Update the Pixie window. This will copy the backing buffer to the actual window.
+            // With multiple buffers the copy is queued for the present thread and the next
+            // buffer becomes the backing buffer. Update waits if every other buffer is still
+            // queued. The new backing buffer's contents are brought up to date with the
+            // buffer just queued, so drawing can carry on incrementally as usual; enabling
+            // dirty rectangle tracking limits that copy to what changed.
             bool Update();
 
             // Returns true in the frame the mouse button went down.
@@ -128,9 +230,85 @@ namespace Pixie
             // Returns the time in seconds since the window was opened.
             float GetTime() const;
 
-            // Returns the backing buffer for the window.
+            // Turns the input event queue on or off. While it's on, every key and mouse
+            // button change, mouse move and character the platform reports is queued with
+            // when it happened, so input that comes and goes within a frame isn't lost
+            // however long frames take. It's off by default so that a window that only polls
+            // doesn't fill the queue. Turning it off empties the queue.
+            void SetInputEventsEnabled(bool enabled);
+            bool AreInputEventsEnabled() const;
+
+            // Takes the oldest event off the input queue. Returns false if there are none.
+            bool PollInputEvent(InputEvent& event);
+
+            // Returns the number of input events dropped because the queue was full.
+            uint32_t GetDroppedInputEvents() const;
+
+            // Records the input of each frame, in the order it happened, and the frame's
+            // delta to a compact binary log until StopRecording. Input set after an Update,
+            // as headless input is, goes in with that Update's frame, and anything held down
+            // when recording starts goes in the first. Returns false if the file can't be
+            // created.
+            bool StartRecording(const char* filename);
+            void StopRecording();
+            bool IsRecording() const;
+
+            // Plays back a log made by StartRecording in place of any other input, from the
+            // platform or the Set functions, which is ignored until the replay stops. Input
+            // state starts out clear, then each Update applies the next frame's input, so
+            // callbacks and input events happen as they did, and takes that frame's delta,
+            // or fixedDelta if it's more than 0. Once the log runs out Update returns false,
+            // as if the window was closed. Returns false if the file isn't a log recorded
+            // from a window of this size.
+            bool StartReplay(const char* filename, float fixedDelta = 0.0f);
+            void StopReplay();
+            bool IsReplaying() const;
+
+            // Returns the platform's high resolution clock, which input events are timed
+            // with, and the number of ticks in a second. Comparing an event's time with
+            // GetTicks gives the latency from the event to now.
+            int64_t GetTicks() const;
+            int64_t GetTickFrequency() const;
+
+            // Sets how Update paces frames. With FrameRate_Target and FrameRate_Adaptive,
+            // Update sleeps and then spins for the last moment until the next frame is due,
+            // so frames are evenly spaced at targetFps without busy-waiting the whole time.
+            void SetFrameRate(FrameRateMode mode, float targetFps = 60.0f);
+
+            // Returns the current frame rate mode.
+            FrameRateMode GetFrameRateMode() const;
+
+            // Returns the frame rate currently being paced to. In FrameRate_Adaptive mode this
+            // may be a fraction of the target. Returns 0 when uncapped.
+            float GetPacedFrameRate() const;
+
+            // Returns the given percentile (0 to 100) of the time in seconds between the last
+            // FrameTimeHistory updates, e.g. 50 for the median or 99 for the worst frames.
+            float GetFrameTimePercentile(float percentile) const;
+
+            // Returns the backing buffer for the window. With multiple buffers this changes
+            // every Update. Rows are GetPitch() pixels apart.
             uint32_t* GetPixels() const;
 
+            // Returns the number of pixels between the start of each row of the backing
+            // buffer, which may be more than the width.
+            int GetPitch() const;
+
+            // Returns the backing buffer as a surface, which marks what's drawn to it as
+            // dirty. With multiple buffers this changes every Update.
+            Surface GetSurface();
+
+            // Renders into and presents from the surface's pixels rather than the window's
+            // own buffer, so frames can be drawn straight into memory owned by something
+            // else, such as shared memory or a video encoder's input frame, whatever its row
+            // stride. The surface must be at least the size of the window and stay valid
+            // while in use. An empty surface goes back to the window's own buffer. Only a
+            // window with one buffer can do this; returns false otherwise.
+            bool SetBackBuffer(const Surface& surface);
+
+            // Returns the number of backing buffers.
+            int GetNumBuffers() const;
+
             // Returns the width of the window.
             uint32_t GetWidth() const;
 
@@ -140,47 +318,160 @@ namespace Pixie
             // Returns the scale of the window.
             uint32_t GetScale() const;
 
+            // Enables or disables dirty rectangle tracking. When enabled, Update only presents
+            // the regions of the backing buffer marked dirty since the previous Update. Font and
+            // ImGui drawing mark the regions they draw to automatically; anything written to
+            // GetPixels() directly must be marked with AddDirtyRect or MarkAllDirty.
+            // When disabled (the default) the whole buffer is presented every Update.
+            void SetDirtyRectTracking(bool enabled);
+
+            // Returns true if dirty rectangle tracking is enabled.
+            bool IsDirtyRectTrackingEnabled() const;
+
+            // Marks a region of the backing buffer as changed. Does nothing if dirty
+            // rectangle tracking is disabled.
+            void AddDirtyRect(int x, int y, int width, int height);
+
+            // Marks the whole backing buffer as changed.
+            void MarkAllDirty();
+
+            // Returns the regions that will be presented by the next Update.
+            const DirtyRegion& GetDirtyRegion() const;
+
+            // Returns the number of bytes of the backing buffer presented by the last Update.
+            uint32_t GetPresentedBytes() const;
+
+            // Returns the regions presented by the last Update.
+            const DirtyRegion& GetPresentedRegion() const;
+
+            // Returns the number of frames handed to the present path by Update.
+            uint64_t GetSubmittedFrames() const;
+
+            // Returns the number of frames that have finished presenting. The difference
+            // from GetSubmittedFrames is the number of frames still in flight.
+            uint64_t GetPresentedFrames() const;
+
+            // Returns the time in seconds from when the input for the most recently presented
+            // frame was sampled to when that frame finished presenting.
+            float GetPresentLatency() const;
+
+            // Returns the frame most recently presented, at the size of the window's
+            // contents, so scaled if the window is. Used by the platform to redraw the
+            // window.
+            Surface GetFrontSurface() const;
+
+            // Captures each frame Update presents into the recorder, or stops capturing if
+            // recorder is NULL. The recorder must outlive the window or be unset first.
+            void SetFrameRecorder(FrameRecorder* recorder);
+            FrameRecorder* GetFrameRecorder() const;
+
+            // Streams each frame Update presents to a viewer through the streamer, or stops
+            // streaming if streamer is NULL. The streamer must outlive the window or be
+            // unset first.
+            void SetFrameStreamer(FrameStreamer* streamer);
+            FrameStreamer* GetFrameStreamer() const;
+
             // Key callback handler. Called on any key state change.
             typedef void(*KeyCallback)(Key key, bool down);
             void SetKeyCallback(KeyCallback callback);
 
-            // Used by the window procedure to update key and mouse state.
-            void SetMouseButtonDown(MouseButton button, bool down);
-            void SetKeyDown(int key, bool down);
-            void AddInputCharacter(char c);
+            // Used by the window procedure to update key and mouse state. Each change is also
+            // queued as an input event. time is when the platform says it happened, in
+            // GetTicks ticks, or -1 for now.
+            void SetMousePosition(int x, int y, int64_t time = -1);
+            void SetMouseButtonDown(MouseButton button, bool down, int64_t time = -1);
+            void SetKeyDown(int key, bool down, int64_t time = -1);
+            void AddInputCharacter(char c, int64_t time = -1);
+
+            // Maps a position in the window's contents, such as from a platform mouse event,
+            // to the buffer pixel under it.
+            void WindowToBuffer(int windowX, int windowY, int& x, int& y) const;
 
         private:
             void PlatformInit();
             bool PlatformOpen(const TCHAR* title, int width, int height);
             bool PlatformUpdate();
+            void PlatformPresent(const Surface& frame, const DirtyRegion& dirtyRegion);
             void PlatformClose();
+            int64_t PlatformGetTime() const;
+            static bool PlatformSupportsPresentThread();
+
+            void PlatformSleepUntil(int64_t time);
+
+            struct PresentState;
+            void Present();
+            void PresentFrame(const uint32_t* pixels, const DirtyRegion& dirtyRegion);
+            void PaceFrame();
+            void StartPresentThread();
+            void StopPresentThread();
+            void PresentThreadMain();
+            void FreeBuffers();
 
             void UpdateMouse();
             void UpdateKeyboard();
+            void QueueInputEvent(InputEventType type, int code, int64_t time);
+            void RecordInput(InputEventType type, int code);
+            void RecordFrame();
+            bool ReplayFrame();
+            void UpdateCaptureInput();
+
+            // Returns a platform key's bit in a bitset of platform keys.
+            static bool TestKeyBit(const uint64_t* bits, int platformKey);
 
             int m_mouseX;
             int m_mouseY;
             bool m_lastMouseButtonDown[MouseButton_Num];
             bool m_mouseButtonDown[MouseButton_Num];
 
+            // m_keyMap takes each Key to its platform key, or -1, and m_platformKeyMap takes
+            // each platform key back to the first Key mapped to it, or Key_Num. Key state is
+            // kept as bitsets of platform keys, so questions about any key are a few
+            // word-wide operations over the keys in m_mappedKeys.
             int m_keyMap[Key_Num];
-            bool m_lastKeyDown[MaxPlatformKeys];
-            bool m_keyDown[MaxPlatformKeys];
-            bool m_anyKeyDown;
+            Key m_platformKeyMap[MaxPlatformKeys];
+            uint64_t m_mappedKeys[KeyWords];
+            uint64_t m_lastKeyDown[KeyWords];
+            uint64_t m_keyDown[KeyWords];
             char m_inputCharacters[16+1];
+            InputQueue m_inputQueue;
+            bool m_inputEventsEnabled;
+
+            // Input is captured to go in the event queue, the recording, or both.
+            bool m_captureInput;
+
+            // Set during a replay, so only the log's input is taken.
+            bool m_inputBlocked;
+
+            struct InputLog;
+            InputLog* m_inputLog;
 
             float m_delta;
 
             uint32_t* m_pixels;
+            int m_pitch;                // Pixels between rows of m_pixels.
+            uint32_t* m_buffers[MaxBuffers];
+            bool m_largePageBuffers[MaxBuffers];
+            int m_bufferPitch;
+            uint32_t m_bufferFlags;
+            int m_numBuffers;
+            int m_backBuffer;
             uint32_t m_width;
             uint32_t m_height;
-            uint32_t m_windowWidth;
+            uint32_t m_windowWidth;     // Size of the window's contents in pixels.
             uint32_t m_windowHeight;
             int m_scale;
             bool m_fullscreen;
             bool m_maintainAspectRatio;
             float m_scalex, m_scaley;
 
+            // When the window is larger than the buffer, each frame is scaled into the
+            // present buffer, which is the size of the window's contents.
+            Scaler m_scaler;
+            ScaleFilter m_scaleFilter;
+            uint32_t* m_presentPixels;
+            bool m_largePagePresent;
+            DirtyRegion m_scaledRegion;
+
             void* m_window;
 
             float m_time;
@@ -188,8 +479,64 @@ namespace Pixie
             int64_t m_freq;
 
             KeyCallback m_keyCallback;
+
+            DirtyRegion m_dirtyRegion;
+            bool m_dirtyRectTracking;
+            uint32_t m_presentedBytes;
+            DirtyRegion m_presentedRegion;
+
+            // Dirty regions of the most recent frames, used to bring a new backing buffer
+            // up to date with the frame just submitted.
+            DirtyRegion m_bufferDirtyRegions[MaxBuffers - 1];
+            int m_bufferDirtyIndex;
+
+            PresentState* m_present;
+
+            FrameRecorder* m_frameRecorder;
+            FrameStreamer* m_frameStreamer;
+            int64_t m_inputTime;
+
+            FrameRateMode m_frameRateMode;
+            float m_targetFrameRate;
+            int64_t m_nextFrameTime;
+            int64_t m_frameStartTime;
+            int64_t m_sleepMargin;
+            int m_rateDivisor;
+            int m_slowFrames;
+            int m_fastFrames;
+            float m_frameTimes[FrameTimeHistory];
+            int m_frameTimeIndex;
+            int m_frameTimeCount;
     };
 
+    inline DirtyRegion::DirtyRegion()
+    {
+        m_count = 0;
+        m_numAdded = 0;
+    }
+
+    inline void DirtyRegion::Clear()
+    {
+        m_count = 0;
+        m_numAdded = 0;
+    }
+
+    inline int DirtyRegion::GetCount() const
+    {
+        return m_count;
+    }
+
+    inline const DirtyRect& DirtyRegion::Get(int index) const
+    {
+        assert(index >= 0 && index < m_count);
+        return m_rects[index];
+    }
+
+    inline int DirtyRegion::GetNumAdded() const
+    {
+        return m_numAdded;
+    }
+
     inline int Window::GetMouseX() const
     {
         return m_mouseX;
@@ -210,11 +557,56 @@ namespace Pixie
         return m_time;
     }
 
+    inline FrameRateMode Window::GetFrameRateMode() const
+    {
+        return m_frameRateMode;
+    }
+
+    inline float Window::GetPacedFrameRate() const
+    {
+        return m_frameRateMode == FrameRate_Uncapped ? 0.0f : m_targetFrameRate / m_rateDivisor;
+    }
+
     inline uint32_t* Window::GetPixels() const
     {
         return m_pixels;
     }
 
+    inline int Window::GetPitch() const
+    {
+        return m_pitch;
+    }
+
+    inline void Window::SetBufferFlags(uint32_t flags)
+    {
+        m_bufferFlags = flags;
+    }
+
+    inline uint32_t Window::GetBufferFlags() const
+    {
+        return m_bufferFlags;
+    }
+
+    inline void Window::SetScaleFilter(ScaleFilter filter)
+    {
+        m_scaleFilter = filter;
+    }
+
+    inline ScaleFilter Window::GetScaleFilter() const
+    {
+        return m_scaleFilter;
+    }
+
+    inline Surface Window::GetSurface()
+    {
+        return Surface(m_pixels, m_width, m_height, m_pitch, this);
+    }
+
+    inline int Window::GetNumBuffers() const
+    {
+        return m_numBuffers;
+    }
+
     inline uint32_t Window::GetWidth() const
     {
         return m_width;
@@ -230,6 +622,46 @@ namespace Pixie
         return m_scale;
     }
 
+    inline bool Window::IsDirtyRectTrackingEnabled() const
+    {
+        return m_dirtyRectTracking;
+    }
+
+    inline void Window::AddDirtyRect(int x, int y, int width, int height)
+    {
+        if (!m_dirtyRectTracking)
+            return;
+
+        int left = x < 0 ? 0 : x;
+        int top = y < 0 ? 0 : y;
+        int right = x + width > (int)m_width ? (int)m_width : x + width;
+        int bottom = y + height > (int)m_height ? (int)m_height : y + height;
+        if (left < right && top < bottom)
+            m_dirtyRegion.Add(left, top, right, bottom);
+    }
+
+    inline void Window::MarkAllDirty()
+    {
+        // The whole buffer absorbs every existing rectangle.
+        if (m_width > 0 && m_height > 0)
+            m_dirtyRegion.Add(0, 0, m_width, m_height);
+    }
+
+    inline const DirtyRegion& Window::GetDirtyRegion() const
+    {
+        return m_dirtyRegion;
+    }
+
+    inline uint32_t Window::GetPresentedBytes() const
+    {
+        return m_presentedBytes;
+    }
+
+    inline const DirtyRegion& Window::GetPresentedRegion() const
+    {
+        return m_presentedRegion;
+    }
+
     inline bool Window::HasMouseGoneDown(MouseButton button) const
     {
         return !m_lastMouseButtonDown[button] && m_mouseButtonDown[button];
@@ -245,15 +677,17 @@ namespace Pixie
         return m_mouseButtonDown[button];
     }
 
-    inline bool Window::HasAnyKeyGoneDown() const
+    inline bool Window::TestKeyBit(const uint64_t* bits, int platformKey)
     {
-        for (int i = 0; i < Key_Num; i++)
-        {
-            if (HasKeyGoneDown((Key)i))
-                return true;
-        }
+        return (bits[platformKey >> 6] >> (platformKey & 63)) & 1;
+    }
 
-        return false;
+    inline bool Window::HasAnyKeyGoneDown() const
+    {
+        uint64_t goneDown = 0;
+        for (int i = 0; i < KeyWords; i++)
+            goneDown |= m_keyDown[i] & ~m_lastKeyDown[i] & m_mappedKeys[i];
+        return goneDown != 0;
     }
 
     inline bool Window::HasKeyGoneDown(Key key) const
@@ -262,7 +696,7 @@ namespace Pixie
         if (index == -1)
             return false;
         assert(index >= 0 && index < MaxPlatformKeys);
-        return !m_lastKeyDown[index] && m_keyDown[index];
+        return !TestKeyBit(m_lastKeyDown, index) && TestKeyBit(m_keyDown, index);
     }
 
     inline bool Window::HasKeyGoneUp(Key key) const
@@ -271,7 +705,7 @@ namespace Pixie
         if (index == -1)
             return false;
         assert(index >= 0 && index < MaxPlatformKeys);
-        return m_lastKeyDown[index] && !m_keyDown[index];
+        return TestKeyBit(m_lastKeyDown, index) && !TestKeyBit(m_keyDown, index);
     }
 
     inline bool Window::IsKeyDown(Key key) const
@@ -280,18 +714,15 @@ namespace Pixie
         if (index == -1)
             return false;
         assert(index >= 0 && index < MaxPlatformKeys);
-        return m_keyDown[index];
+        return TestKeyBit(m_keyDown, index);
     }
 
     inline bool Window::IsAnyKeyDown() const
     {
-        for (int i = 0; i < Key_Num; i++)
-        {
-            if (IsKeyDown((Key)i))
-                return true;
-        }
-
-        return false;
+        uint64_t down = 0;
+        for (int i = 0; i < KeyWords; i++)
+            down |= m_keyDown[i] & m_mappedKeys[i];
+        return down != 0;
     }
 
     inline const char* Window::GetInputCharacters() const
@@ -304,30 +735,82 @@ namespace Pixie
         m_inputCharacters[0] = 0;
     }
 
-    inline void Window::SetMouseButtonDown(MouseButton button, bool down)
+    inline bool Window::AreInputEventsEnabled() const
+    {
+        return m_inputEventsEnabled;
+    }
+
+    inline bool Window::PollInputEvent(InputEvent& event)
+    {
+        return m_inputQueue.Pop(event);
+    }
+
+    inline uint32_t Window::GetDroppedInputEvents() const
+    {
+        return m_inputQueue.GetDropped();
+    }
+
+    inline int64_t Window::GetTickFrequency() const
+    {
+        return m_freq;
+    }
+
+    inline void Window::SetMousePosition(int x, int y, int64_t time)
     {
+        if (m_inputBlocked || (x == m_mouseX && y == m_mouseY))
+            return;
+
+        m_mouseX = x;
+        m_mouseY = y;
+        if (m_captureInput)
+            QueueInputEvent(InputEvent_MouseMove, 0, time);
+    }
+
+    inline void Window::SetMouseButtonDown(MouseButton button, bool down, int64_t time)
+    {
+        if (m_inputBlocked || m_mouseButtonDown[button] == down)
+            return;
+
         m_mouseButtonDown[button] = down;
+        if (m_captureInput)
+            QueueInputEvent(down ? InputEvent_MouseDown : InputEvent_MouseUp, button, time);
     }
 
-    inline void Window::SetKeyDown(int platformKey, bool down)
+    inline void Window::SetKeyDown(int platformKey, bool down, int64_t time)
     {
         assert(platformKey >= 0 && platformKey < MaxPlatformKeys);
-        if (m_keyDown[platformKey] == down)
+        if (m_inputBlocked || TestKeyBit(m_keyDown, platformKey) == down)
+            return;
+
+        m_keyDown[platformKey >> 6] ^= (uint64_t)1 << (platformKey & 63);
+        Key key = m_platformKeyMap[platformKey];
+        if (key == Key_Num)
             return;
 
-        m_keyDown[platformKey] = down;
         if (m_keyCallback)
-        {
-            for (int i = 0; i < Key_Num; i++)
-            {
-                int key = m_keyMap[i];
-                if (key == platformKey)
-                {
-                    m_keyCallback((Key)i, down);
-                    return;
-                }
-            }
-        }
+            m_keyCallback(key, down);
+        if (m_captureInput)
+            QueueInputEvent(down ? InputEvent_KeyDown : InputEvent_KeyUp, key, time);
+    }
+
+    inline void Window::SetFrameRecorder(FrameRecorder* recorder)
+    {
+        m_frameRecorder = recorder;
+    }
+
+    inline FrameRecorder* Window::GetFrameRecorder() const
+    {
+        return m_frameRecorder;
+    }
+
+    inline void Window::SetFrameStreamer(FrameStreamer* streamer)
+    {
+        m_frameStreamer = streamer;
+    }
+
+    inline FrameStreamer* Window::GetFrameStreamer() const
+    {
+        return m_frameStreamer;
     }
 
     inline void Window::SetKeyCallback(KeyCallback callback)
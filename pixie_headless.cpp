@@ -0,0 +1,88 @@
+#include "pixie.h"
+#include <assert.h>
+#include <time.h>
+#include <errno.h>
+
+using namespace Pixie;
+
+// The headless backend has no window system. The backing buffer is the framebuffer,
+// the clock is CLOCK_MONOTONIC, and all input comes from the application calling
+// SetMousePosition/SetMouseButtonDown/SetKeyDown/AddInputCharacter directly. Inject
+// input after Update() returns, which is where the other platforms pump events, so
+// that HasKeyGoneDown and friends see the transition in the next frame.
+//
+// Platform keys are the Pixie::Key values themselves, so scripted input can do:
+//
+//     window.SetKeyDown(Pixie::Key_Escape, true);
+
+static int64_t GetMonotonicTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Window::PlatformInit()
+{
+    assert((int)Key_Num <= (int)MaxPlatformKeys);
+
+    for (int i = 0; i < Key_Num; i++)
+        m_keyMap[i] = i;
+
+    m_mouseX = 0;
+    m_mouseY = 0;
+    m_window = 0;
+}
+
+bool Window::PlatformOpen(const TCHAR* title, int width, int height)
+{
+    m_scalex = (float)m_scale;
+    m_scaley = (float)m_scale;
+    m_windowWidth = width * m_scale;
+    m_windowHeight = height * m_scale;
+
+    m_freq = 1000000000;
+    m_lastTime = GetMonotonicTime();
+
+    return true;
+}
+
+bool Window::PlatformUpdate()
+{
+    // Update the delta time.
+    int64_t time = GetMonotonicTime();
+    int64_t delta = time - m_lastTime;
+    m_delta = delta / (float)m_freq;
+    m_lastTime = time;
+
+    return true;
+}
+
+void Window::PlatformPresent(const Surface& frame, const DirtyRegion& dirtyRegion)
+{
+    // There is nothing to present to; the backing buffer, and the scaled frame from
+    // GetFrontSurface, are the result.
+}
+
+void Window::PlatformClose()
+{
+}
+
+int64_t Window::PlatformGetTime() const
+{
+    return GetMonotonicTime();
+}
+
+void Window::PlatformSleepUntil(int64_t time)
+{
+    timespec ts;
+    ts.tv_sec = time / 1000000000;
+    ts.tv_nsec = time % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+        ;
+}
+
+bool Window::PlatformSupportsPresentThread()
+{
+    return true;
+}
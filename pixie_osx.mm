@@ -15,6 +15,13 @@ using namespace Pixie;
 
 static const int FrameBufferBitDepth = 8;
 
+// NSEvent timestamps are in seconds on the same clock as mach_absolute_time, which
+// Window's ticks count.
+static int64_t GetEventTicks(Window* window, NSEvent* event)
+{
+    return (int64_t)([event timestamp] * window->GetTickFrequency());
+}
+
 @interface PixieNSWindow : NSWindow <NSWindowDelegate>
 @property Window* pixieWindow;
 @property bool isActivated;
@@ -69,52 +76,89 @@ static const int FrameBufferBitDepth = 8;
         }
 
         if (foundKey)
-            _pixieWindow->SetKeyDown(theEvent.keyCode, down);
+            _pixieWindow->SetKeyDown(theEvent.keyCode, down, GetEventTicks(_pixieWindow, theEvent));
     }
 }
 
 - (void)keyDown:(NSEvent *) theEvent
 {
     if (theEvent.keyCode < 256)
-        _pixieWindow->SetKeyDown(theEvent.keyCode, true);
+        _pixieWindow->SetKeyDown(theEvent.keyCode, true, GetEventTicks(_pixieWindow, theEvent));
     if (theEvent.characters.length > 0)
-        _pixieWindow->AddInputCharacter([theEvent.characters characterAtIndex:0]);
+        _pixieWindow->AddInputCharacter([theEvent.characters characterAtIndex:0], GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (void)keyUp:(NSEvent *) theEvent
 {
     if (theEvent.keyCode < 256)
-        _pixieWindow->SetKeyDown(theEvent.keyCode, false);
+        _pixieWindow->SetKeyDown(theEvent.keyCode, false, GetEventTicks(_pixieWindow, theEvent));
+}
+
+// Moves the mouse to where the event happened, so button events carry the position
+// they happened at.
+- (void)setMouseFromEvent:(NSEvent *) theEvent
+{
+    NSPoint location = [theEvent locationInWindow];
+    NSRect content = [[self contentView] frame];
+    int x, y;
+    _pixieWindow->WindowToBuffer((int)location.x, (int)(content.size.height - location.y - 1), x, y);
+    _pixieWindow->SetMousePosition(x, y, GetEventTicks(_pixieWindow, theEvent));
+}
+
+- (void)mouseMoved:(NSEvent *) theEvent
+{
+    [self setMouseFromEvent:theEvent];
+}
+
+- (void)mouseDragged:(NSEvent *) theEvent
+{
+    [self setMouseFromEvent:theEvent];
+}
+
+- (void)rightMouseDragged:(NSEvent *) theEvent
+{
+    [self setMouseFromEvent:theEvent];
+}
+
+- (void)otherMouseDragged:(NSEvent *) theEvent
+{
+    [self setMouseFromEvent:theEvent];
 }
 
 - (void)mouseDown:(NSEvent *) theEvent
 {
-    _pixieWindow->SetMouseButtonDown(MouseButton_Left, true);
+    [self setMouseFromEvent:theEvent];
+    _pixieWindow->SetMouseButtonDown(MouseButton_Left, true, GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (void)mouseUp:(NSEvent *) theEvent
 {
-    _pixieWindow->SetMouseButtonDown(MouseButton_Left, false);
+    [self setMouseFromEvent:theEvent];
+    _pixieWindow->SetMouseButtonDown(MouseButton_Left, false, GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (void)rightMouseDown:(NSEvent *) theEvent
 {
-    _pixieWindow->SetMouseButtonDown(MouseButton_Right, true);
+    [self setMouseFromEvent:theEvent];
+    _pixieWindow->SetMouseButtonDown(MouseButton_Right, true, GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (void)rightMouseUp:(NSEvent *) theEvent
 {
-    _pixieWindow->SetMouseButtonDown(MouseButton_Right, false);
+    [self setMouseFromEvent:theEvent];
+    _pixieWindow->SetMouseButtonDown(MouseButton_Right, false, GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (void)otherMouseDown:(NSEvent *) theEvent
 {
-    _pixieWindow->SetMouseButtonDown(MouseButton_Middle, true);
+    [self setMouseFromEvent:theEvent];
+    _pixieWindow->SetMouseButtonDown(MouseButton_Middle, true, GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (void)otherMouseUp:(NSEvent *) theEvent
 {
-    _pixieWindow->SetMouseButtonDown(MouseButton_Middle, false);
+    [self setMouseFromEvent:theEvent];
+    _pixieWindow->SetMouseButtonDown(MouseButton_Middle, false, GetEventTicks(_pixieWindow, theEvent));
 }
 
 - (BOOL)acceptsFirstResponder
@@ -126,7 +170,6 @@ static const int FrameBufferBitDepth = 8;
 @interface PixieNSView : NSView
 {
     Window* pixieWindow;
-    CGContextRef backingBitmapContext;
     CGColorSpaceRef colourSpace;
 }
 
@@ -136,44 +179,38 @@ static const int FrameBufferBitDepth = 8;
 @implementation PixieNSView
 - (void)drawRect:(NSRect)dirtyRect
 {
-    // Copy buffer to window.
-    uint32_t width = pixieWindow->GetWidth();
-    uint32_t height = pixieWindow->GetHeight();
-    uint32_t scale = pixieWindow->GetScale();
-    assert(backingBitmapContext != 0);
-    CGImageRef img = CGBitmapContextCreateImage(backingBitmapContext);
+    // Copy the most recently presented frame to the window. Wrapping the frame in a
+    // bitmap context doesn't copy it, so this is cheap to do for whichever buffer it is.
+    // Pixie has already scaled the frame to the size of the view.
+    Surface frame = pixieWindow->GetFrontSurface();
+    size_t width = frame.GetWidth();
+    size_t height = frame.GetHeight();
+    CGContextRef bitmapContext = CGBitmapContextCreate((void*)frame.GetPixels(), width, height, FrameBufferBitDepth, frame.GetStride()*4,
+        colourSpace, kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst);
+    assert(bitmapContext != 0);
+    CGImageRef img = CGBitmapContextCreateImage(bitmapContext);
     CGContextRef currentContext = [[NSGraphicsContext currentContext] CGContext];
     assert(currentContext != 0);
-    CGContextDrawImage(currentContext, CGRectMake(0, 0, width * scale, height * scale), img);
+    // Only the invalidated regions are drawn; AppKit has already clipped the context to them.
+    CGContextDrawImage(currentContext, CGRectMake(0, 0, width, height), img);
     CGImageRelease(img);
+    CGContextRelease(bitmapContext);
 }
 
 - (id)initWithFrame:(NSRect)frameRect pixieWindow:(Window*) inPixieWindow
 {
     self = [super initWithFrame:frameRect];
     pixieWindow = inPixieWindow;
-    [self createBackingBitmapContext];
+    colourSpace = CGColorSpaceCreateDeviceRGB();
     return self;
 }
 
 - (void)dealloc
 {
     CGColorSpaceRelease(colourSpace);
-    CGContextRelease(backingBitmapContext);
     [super dealloc];
 }
 
-- (void)createBackingBitmapContext
-{
-    uint32_t* pixels = pixieWindow->GetPixels();
-    uint32_t width = pixieWindow->GetWidth();
-    uint32_t height = pixieWindow->GetHeight();
-    colourSpace = CGColorSpaceCreateDeviceRGB();
-    backingBitmapContext = CGBitmapContextCreate(pixels, width, height, FrameBufferBitDepth, width*4,
-        colourSpace, kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst);
-    assert(backingBitmapContext != 0);
-}
-
 @end
 
 void Window::PlatformInit()
@@ -271,11 +308,14 @@ bool Window::PlatformOpen(const char* title, int width, int height)
 
     m_scalex = (float)m_scale;
     m_scaley = (float)m_scale;
+    m_windowWidth = width * m_scale;
+    m_windowHeight = height * m_scale;
 
     // Create the application window.
     id window = [[[PixieNSWindow alloc] initWithContentRect:NSMakeRect(0, 0, width * m_scalex, height * m_scaley)
         styleMask:NSWindowStyleMaskTitled backing:NSBackingStoreBuffered defer:NO] autorelease];
     [window setPixieWindow:this];
+    [window setAcceptsMouseMovedEvents:YES];
     [window setDelegate:window];
     [window cascadeTopLeftFromPoint:NSMakePoint(20,20)];
     [window setTitle:[NSString stringWithCString:title encoding:NSUTF8StringEncoding]];
@@ -327,11 +367,9 @@ bool Window::PlatformUpdate()
     // Update mouse cursor position.
     NSPoint mousePos;
     mousePos = [window mouseLocationOutsideOfEventStream];
-    m_mouseX = std::clamp((int)mousePos.x, 0, (int)m_width);
-    m_mouseY = std::clamp((int)(m_height - mousePos.y - 1), 0, (int)m_height);
-
-    m_mouseX /= m_scalex;
-    m_mouseY /= m_scaley;
+    int mouseX, mouseY;
+    WindowToBuffer((int)mousePos.x, (int)(m_windowHeight - mousePos.y - 1), mouseX, mouseY);
+    SetMousePosition(std::clamp(mouseX, 0, (int)m_width), std::clamp(mouseY, 0, (int)m_height));
 
     // Update the delta time.
     uint64_t time = mach_absolute_time();
@@ -348,9 +386,6 @@ bool Window::PlatformUpdate()
         [NSApp sendEvent:event];
     }
 
-    // Force the display to refresh.
-    [[window contentView] setNeedsDisplay:TRUE];
-
     // Steal focus the first chance we get.
     if (![window isActivated])
     {
@@ -363,9 +398,41 @@ bool Window::PlatformUpdate()
     return [window isRunning];
 }
 
+void Window::PlatformPresent(const Surface& frame, const DirtyRegion& dirtyRegion)
+{
+    // Invalidate the dirty regions so the view redraws them from the front frame the
+    // next time events are pumped. The regions are already in the frame's scaled pixels.
+    // The view is not flipped, so the frame's y axis has to be inverted.
+    PixieNSWindow* window = (PixieNSWindow*)m_window;
+    NSView* view = [window contentView];
+    for (int i = 0; i < dirtyRegion.GetCount(); i++)
+    {
+        const DirtyRect& dirty = dirtyRegion.Get(i);
+        NSRect rect = NSMakeRect(dirty.left, frame.GetHeight() - dirty.bottom,
+            dirty.right - dirty.left, dirty.bottom - dirty.top);
+        [view setNeedsDisplayInRect:rect];
+    }
+}
+
 void Window::PlatformClose()
 {
     PixieNSWindow* window = (PixieNSWindow*)m_window;
     NSAutoreleasePool* autoreleasePool = [window autoreleasePool];
     [autoreleasePool release];
 }
+
+int64_t Window::PlatformGetTime() const
+{
+    return mach_absolute_time();
+}
+
+void Window::PlatformSleepUntil(int64_t time)
+{
+    mach_wait_until(time);
+}
+
+bool Window::PlatformSupportsPresentThread()
+{
+    // AppKit views can only be drawn from the main thread.
+    return false;
+}
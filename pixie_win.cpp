@@ -1,9 +1,14 @@
 #include "pixie.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <windowsx.h>
 
 using namespace Pixie;
 
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
 static const TCHAR* PixieWindowClass = TEXT("PixieWindowClass");
 static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
@@ -89,8 +94,8 @@ bool Window::PlatformOpen(const TCHAR* title, int width, int height)
         xPos = yPos = 0;
         width = desktopWidth;
         height = desktopHeight;
-        m_scalex = width / (float)m_width;
-        m_scaley = m_maintainAspectRatio ? m_scalex : (height / (float)m_height);
+        m_windowWidth = width;
+        m_windowHeight = height;
     }
     else
     {
@@ -101,6 +106,8 @@ bool Window::PlatformOpen(const TCHAR* title, int width, int height)
         rect.right = width * m_scale;
         rect.top = 0;
         rect.bottom = height * m_scale;
+        m_windowWidth = rect.right;
+        m_windowHeight = rect.bottom;
         AdjustWindowRect(&rect, style, FALSE);
 
         xPos = (desktopWidth - rect.right) >> 1;
@@ -110,9 +117,6 @@ bool Window::PlatformOpen(const TCHAR* title, int width, int height)
         height = rect.bottom - rect.top;
     }
 
-    m_windowWidth = width;
-    m_windowHeight = height;
-
     HWND window = CreateWindow(PixieWindowClass, title, style, xPos, yPos, width, height, NULL, NULL, hInstance, NULL);
     m_window = (HWND)window;
     if (window == 0)
@@ -133,19 +137,9 @@ bool Window::PlatformUpdate()
     POINT p;
     GetCursorPos(&p);
     ScreenToClient((HWND)m_window, &p);
-    m_mouseX = p.x;
-    m_mouseY = p.y;
-
-    if (m_fullscreen)
-    {
-        m_mouseX = (int)(m_mouseX / m_scalex);
-        m_mouseY = (int)(m_mouseY / m_scaley);
-    }
-    else
-    {
-        m_mouseX /= m_scale;
-        m_mouseY /= m_scale;
-    }
+    int mouseX, mouseY;
+    WindowToBuffer(p.x, p.y, mouseX, mouseY);
+    SetMousePosition(mouseX, mouseY);
 
     __int64 time;
     QueryPerformanceCounter((LARGE_INTEGER*)&time);
@@ -163,13 +157,21 @@ bool Window::PlatformUpdate()
             return false;
     }
 
-    // Copy buffer to the window.
+    return true;
+}
+
+void Window::PlatformPresent(const Surface& frame, const DirtyRegion& dirtyRegion)
+{
+    // Copy the dirty regions of the frame to the window. The frame is already the size of
+    // the window's contents, so nothing is stretched here. Each region is presented as its
+    // own DIB made of just the region's rows, which avoids the ambiguity of source
+    // rectangle coordinates in top-down DIBs.
     HDC hdc = GetDC((HWND)m_window);
     BITMAPINFO bitmapInfo;
     BITMAPINFOHEADER& bmiHeader = bitmapInfo.bmiHeader;
     bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    bmiHeader.biWidth = m_width;
-    bmiHeader.biHeight = -(int32_t)m_height; // Negative indicates a top-down DIB. Otherwise DIB is bottom up.
+    bmiHeader.biWidth = frame.GetStride();
+    bmiHeader.biHeight = -frame.GetHeight(); // Negative indicates a top-down DIB. Otherwise DIB is bottom up.
     bmiHeader.biPlanes = 1;
     bmiHeader.biBitCount = 32;
     bmiHeader.biCompression = BI_RGB;
@@ -178,38 +180,17 @@ bool Window::PlatformUpdate()
     bmiHeader.biYPelsPerMeter = 0;
     bmiHeader.biClrUsed = 0;
     bmiHeader.biClrImportant = 0;
-    if (m_scale > 1 || m_fullscreen)
-    {
-        int yofs = 0;
-        int destWidth = (int)(m_width * m_scalex);
-        int destHeight = (int)(m_height * m_scaley);
-        if (m_maintainAspectRatio)
-            yofs = (m_windowHeight - destHeight) >> 1;
 
-        if (m_maintainAspectRatio && yofs > 0)
-        {
-            // Fill top/bottom with black for letterboxing.
-            HBRUSH blackBrush = (HBRUSH)GetStockObject(BLACK_BRUSH);
-            RECT rect;
-            rect.left = 0;
-            rect.top = 0;
-            rect.right = m_windowWidth;
-            rect.bottom = yofs;
-            FillRect(hdc, &rect, blackBrush);
-            rect.top = m_windowHeight - yofs;
-            rect.bottom = m_windowHeight;
-            FillRect(hdc, &rect, blackBrush);
-        }
-
-        StretchDIBits(hdc, 0, yofs, destWidth, destHeight, 0, 0, m_width, m_height, m_pixels, &bitmapInfo, DIB_RGB_COLORS, SRCCOPY);
-    }
-    else
+    for (int i = 0; i < dirtyRegion.GetCount(); i++)
     {
-        SetDIBitsToDevice(hdc, 0, 0, m_width, m_height, 0, 0, 0, m_height, m_pixels, &bitmapInfo, DIB_RGB_COLORS);
+        const DirtyRect& dirty = dirtyRegion.Get(i);
+        int height = dirty.bottom - dirty.top;
+
+        bmiHeader.biHeight = -height;
+        SetDIBitsToDevice(hdc, dirty.left, dirty.top, dirty.right - dirty.left, height,
+            dirty.left, 0, 0, height, frame.GetRow(dirty.top), &bitmapInfo, DIB_RGB_COLORS);
     }
     ReleaseDC((HWND)m_window, hdc);
-
-    return true;
 }
 
 void Window::PlatformClose()
@@ -217,6 +198,44 @@ void Window::PlatformClose()
     DestroyWindow((HWND)m_window);
 }
 
+int64_t Window::PlatformGetTime() const
+{
+    __int64 time;
+    QueryPerformanceCounter((LARGE_INTEGER*)&time);
+    return time;
+}
+
+void Window::PlatformSleepUntil(int64_t time)
+{
+    // Sleep() is only accurate to the system timer period (usually 15.6ms), so use a
+    // high resolution waitable timer where available (Windows 10 1803 and later).
+    static HANDLE timer = 0;
+    if (!timer)
+    {
+        timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (!timer)
+            timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    }
+
+    int64_t now = PlatformGetTime();
+    if (time <= now)
+        return;
+
+    // Due time is relative (negative) in 100ns units.
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = -(int64_t)(((time - now) * 10000000) / m_freq);
+    if (timer && SetWaitableTimer(timer, &dueTime, 0, NULL, NULL, FALSE))
+        WaitForSingleObject(timer, INFINITE);
+    else
+        Sleep((DWORD)(((time - now) * 1000) / m_freq));
+}
+
+bool Window::PlatformSupportsPresentThread()
+{
+    // GDI can draw to the window from any thread.
+    return true;
+}
+
 WPARAM MapLeftRightKeys(WPARAM vk, LPARAM lParam)
 {
     WPARAM newVk = vk;
@@ -254,6 +273,15 @@ WPARAM MapLeftRightKeys(WPARAM vk, LPARAM lParam)
     return newVk;
 }
 
+// Moves the mouse to where a mouse message says it is, so button events carry the
+// position they happened at.
+static void SetMouseFromMessage(Window* window, LPARAM lParam)
+{
+    int x, y;
+    window->WindowToBuffer(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam), x, y);
+    window->SetMousePosition(x, y);
+}
+
 static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
     Window* window = (Window*)GetWindowLongPtr(hWnd, GWLP_USERDATA);
@@ -261,6 +289,12 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
     {
         switch (msg)
         {
+            case WM_MOUSEMOVE:
+            {
+                SetMouseFromMessage(window, lParam);
+                break;
+            }
+
             case WM_LBUTTONDOWN:
             case WM_MBUTTONDOWN:
             case WM_RBUTTONDOWN:
@@ -268,6 +302,7 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
                 MouseButton button = MouseButton_Left;
                 if (msg == WM_MBUTTONDOWN) button = MouseButton_Middle;
                 if (msg == WM_RBUTTONDOWN) button = MouseButton_Right;
+                SetMouseFromMessage(window, lParam);
                 window->SetMouseButtonDown(button, true);
                 break;
             }
@@ -279,6 +314,7 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
                 MouseButton button = MouseButton_Left;
                 if (msg == WM_MBUTTONUP) button = MouseButton_Middle;
                 if (msg == WM_RBUTTONUP) button = MouseButton_Right;
+                SetMouseFromMessage(window, lParam);
                 window->SetMouseButtonDown(button, false);
                 break;
             }
@@ -312,6 +348,14 @@ static LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPara
                 break;
             }
 
+            case WM_PAINT:
+            {
+                // Part of the window needs repainting, e.g. it was uncovered, so make sure
+                // the next update presents everything.
+                window->MarkAllDirty();
+                break;
+            }
+
             case WM_DESTROY:
             {
                 PostQuitMessage(0);
@@ -0,0 +1,244 @@
+#include "profiler.h"
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+using namespace Pixie;
+
+// A zone in a thread's ring buffer. The fields are atomic so that other threads can read
+// the ring buffer while its thread is writing; relaxed atomics are plain loads and stores
+// on the platforms we support.
+struct ZoneRecord
+{
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> end;
+    std::atomic<int> depth;
+};
+
+struct ThreadBuffer
+{
+    ZoneRecord zones[Profiler::MaxZonesPerThread];
+    std::atomic<uint64_t> count;    // Total zones ever recorded, only written by the thread.
+    int depth;                      // Zones currently open, only used by the thread.
+    int index;
+};
+
+// Thread buffers are never freed, so that zones from threads which have since exited can
+// still be read.
+static ThreadBuffer* s_threads[Profiler::MaxThreads];
+static std::atomic<int> s_numThreads(0);
+static std::mutex s_registerLock;
+static std::atomic<bool> s_enabled(true);
+
+static thread_local ThreadBuffer* s_thread = 0;
+static thread_local bool s_threadFull = false;
+
+// Frame boundaries, only used from the thread calling Window::Update.
+static uint64_t s_frames[Profiler::FrameHistory];
+static int s_frameCount = 0;
+
+static ThreadBuffer* RegisterThread()
+{
+    std::lock_guard<std::mutex> lock(s_registerLock);
+
+    int index = s_numThreads.load(std::memory_order_relaxed);
+    if (index == Profiler::MaxThreads)
+    {
+        s_threadFull = true;
+        return 0;
+    }
+
+    ThreadBuffer* buffer = new ThreadBuffer;
+    buffer->count.store(0, std::memory_order_relaxed);
+    buffer->depth = 0;
+    buffer->index = index;
+
+    s_threads[index] = buffer;
+    s_numThreads.store(index + 1, std::memory_order_release);
+    return buffer;
+}
+
+void Profiler::SetEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Profiler::IsEnabled()
+{
+    return s_enabled.load(std::memory_order_relaxed);
+}
+
+uint64_t Profiler::GetTime()
+{
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::MarkFrame()
+{
+    s_frames[s_frameCount % FrameHistory] = GetTime();
+    s_frameCount++;
+}
+
+bool Profiler::GetFrame(int framesAgo, uint64_t& start, uint64_t& end)
+{
+    // A complete frame needs a boundary at each end.
+    if (framesAgo < 0 || framesAgo >= FrameHistory - 1 || framesAgo + 2 > s_frameCount)
+        return false;
+
+    int last = s_frameCount - 1 - framesAgo;
+    start = s_frames[(last - 1) % FrameHistory];
+    end = s_frames[last % FrameHistory];
+    return true;
+}
+
+int Profiler::GetNumThreads()
+{
+    return s_numThreads.load(std::memory_order_acquire);
+}
+
+int Profiler::BeginZone()
+{
+    if (!s_enabled.load(std::memory_order_relaxed))
+        return -1;
+
+    ThreadBuffer* thread = s_thread;
+    if (!thread)
+    {
+        if (s_threadFull)
+            return -1;
+        thread = s_thread = RegisterThread();
+        if (!thread)
+            return -1;
+    }
+
+    return thread->depth++;
+}
+
+void Profiler::EndZone(const char* name, uint64_t start, int depth)
+{
+    uint64_t end = GetTime();
+
+    ThreadBuffer* thread = s_thread;
+    assert(thread && thread->depth == depth + 1);
+    thread->depth = depth;
+
+    uint64_t count = thread->count.load(std::memory_order_relaxed);
+    ZoneRecord& zone = thread->zones[count % MaxZonesPerThread];
+    zone.name.store(name, std::memory_order_relaxed);
+    zone.start.store(start, std::memory_order_relaxed);
+    zone.end.store(end, std::memory_order_relaxed);
+    zone.depth.store(depth, std::memory_order_relaxed);
+    thread->count.store(count + 1, std::memory_order_release);
+}
+
+void Profiler::ForEachZone(uint64_t start, uint64_t end, ZoneFunc fn, void* userData)
+{
+    assert(fn);
+
+    int numThreads = GetNumThreads();
+    for (int i = 0; i < numThreads; i++)
+    {
+        const ThreadBuffer* thread = s_threads[i];
+        uint64_t count = thread->count.load(std::memory_order_acquire);
+        uint64_t oldest = count > MaxZonesPerThread ? count - MaxZonesPerThread : 0;
+
+        // Zones are recorded as they end, so end times only go backwards from here.
+        for (uint64_t j = count; j-- > oldest;)
+        {
+            const ZoneRecord& record = thread->zones[j % MaxZonesPerThread];
+
+            Zone zone;
+            zone.name = record.name.load(std::memory_order_relaxed);
+            zone.start = record.start.load(std::memory_order_relaxed);
+            zone.end = record.end.load(std::memory_order_relaxed);
+            zone.depth = record.depth.load(std::memory_order_relaxed);
+            zone.thread = i;
+
+            // If the thread has come all the way round the ring buffer while we were
+            // reading, this zone and everything older may have been overwritten.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (thread->count.load(std::memory_order_relaxed) >= j + MaxZonesPerThread)
+                break;
+
+            if (zone.end < start)
+                break;
+            if (zone.start < end)
+                fn(zone, userData);
+        }
+    }
+}
+
+static void WriteJsonString(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*s >= 32)
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+struct TraceWriter
+{
+    FILE* file;
+    bool first;
+};
+
+static void WriteTraceZone(const Profiler::Zone& zone, void* userData)
+{
+    TraceWriter& writer = *(TraceWriter*)userData;
+
+    // Chrome traces are in microseconds.
+    fprintf(writer.file, "%s\n{\"name\":", writer.first ? "" : ",");
+    WriteJsonString(writer.file, zone.name);
+    fprintf(writer.file, ",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+        zone.thread, zone.start / 1000.0, (zone.end - zone.start) / 1000.0);
+    writer.first = false;
+}
+
+bool Profiler::WriteChromeTrace(const char* filename)
+{
+    assert(filename);
+
+    FILE* file = fopen(filename, "w");
+    if (!file)
+        return false;
+
+    TraceWriter writer;
+    writer.file = file;
+    writer.first = true;
+
+    fprintf(file, "{\"traceEvents\":[");
+
+    int numThreads = GetNumThreads();
+    for (int i = 0; i < numThreads; i++)
+    {
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+            writer.first ? "" : ",", i, i);
+        writer.first = false;
+    }
+
+    // Frame boundaries as global instant events.
+    int numFrames = s_frameCount < FrameHistory ? s_frameCount : FrameHistory;
+    for (int i = s_frameCount - numFrames; i < s_frameCount; i++)
+    {
+        fprintf(file, "%s\n{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":%.3f}",
+            writer.first ? "" : ",", s_frames[i % FrameHistory] / 1000.0);
+        writer.first = false;
+    }
+
+    ForEachZone(0, UINT64_MAX, WriteTraceZone, &writer);
+
+    fprintf(file, "\n]}\n");
+
+    bool result = !ferror(file);
+    result &= fclose(file) == 0;
+    return result;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include "core.h"
+
+// Marks the rest of the enclosing scope as a profiler zone. The name must be a string
+// literal (or otherwise outlive the profiler), as only the pointer is recorded.
+#if PIXIE_PROFILER
+#define PIXIE_PROFILE_CONCAT2(a, b) a##b
+#define PIXIE_PROFILE_CONCAT(a, b) PIXIE_PROFILE_CONCAT2(a, b)
+#define PIXIE_PROFILE_ZONE(name) Pixie::ProfileZone PIXIE_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PIXIE_PROFILE_ZONE(name)
+#endif
+
+namespace Pixie
+{
+    // Lightweight CPU profiler.
+    //
+    // Each thread records the zones it completes into its own fixed-size ring buffer, so
+    // recording a zone takes two timer reads and a handful of stores with no locks or
+    // allocation. The only allocation is the ring buffer itself, the first time a thread
+    // records a zone. Old zones are overwritten once a thread's ring buffer is full.
+    //
+    // Window::Update marks the frame boundaries, so the profiler is read a frame at a
+    // time from the thread that calls Update (see ImGui::ProfilerGraph).
+    namespace Profiler
+    {
+        enum
+        {
+            MaxThreads = 64,            // Threads beyond this many record nothing.
+            MaxZonesPerThread = 8192,   // Size of each thread's ring buffer.
+            MaxDepth = 16,              // Depth of nesting zones are drawn to in the graph.
+            FrameHistory = 64           // Number of frame boundaries remembered.
+        };
+
+        struct Zone
+        {
+            const char* name;
+            uint64_t start;     // Times in nanoseconds, see GetTime.
+            uint64_t end;
+            int depth;          // Number of zones this one is nested inside.
+            int thread;         // Index of the thread that recorded the zone.
+        };
+
+        typedef void(*ZoneFunc)(const Zone& zone, void* userData);
+
+        // Enables or disables recording. Zones started while disabled are not recorded.
+        // Recording is enabled by default.
+        void SetEnabled(bool enabled);
+
+        // Returns true if zones are being recorded.
+        bool IsEnabled();
+
+        // Returns the profiler's clock in nanoseconds.
+        uint64_t GetTime();
+
+        // Marks the end of a frame and the start of the next. Called by Window::Update.
+        void MarkFrame();
+
+        // Gets the start and end times of a recent complete frame, where 0 is the most
+        // recent. Returns false if that many frames haven't been recorded yet.
+        bool GetFrame(int framesAgo, uint64_t& start, uint64_t& end);
+
+        // Returns the number of threads that have recorded zones.
+        int GetNumThreads();
+
+        // Calls fn for each zone still in the ring buffers that overlaps the time from
+        // start to end, most recent first for each thread.
+        void ForEachZone(uint64_t start, uint64_t end, ZoneFunc fn, void* userData);
+
+        // Writes every zone still in the ring buffers to a file in the Chrome trace event
+        // format, which can be loaded in chrome://tracing or Perfetto. Returns false if the
+        // file can't be written.
+        bool WriteChromeTrace(const char* filename);
+
+        // Used by ProfileZone.
+        int BeginZone();
+        void EndZone(const char* name, uint64_t start, int depth);
+    }
+
+    // Records the time from construction to destruction as a zone. Use PIXIE_PROFILE_ZONE
+    // rather than constructing these directly.
+    class ProfileZone
+    {
+        public:
+            ProfileZone(const char* name);
+            ~ProfileZone();
+
+        private:
+            ProfileZone(const ProfileZone&);
+            ProfileZone& operator=(const ProfileZone&);
+
+            const char* m_name;
+            uint64_t m_start;
+            int m_depth;
+    };
+
+    inline ProfileZone::ProfileZone(const char* name)
+    {
+        m_name = name;
+        m_depth = Profiler::BeginZone();
+        m_start = m_depth >= 0 ? Profiler::GetTime() : 0;
+    }
+
+    inline ProfileZone::~ProfileZone()
+    {
+        if (m_depth >= 0)
+            Profiler::EndZone(m_name, m_start, m_depth);
+    }
+}
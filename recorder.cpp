@@ -0,0 +1,650 @@
+#include "recorder.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace Pixie;
+
+// State shared between Capture and the encoder thread.
+struct FrameRecorder::State
+{
+    enum
+    {
+        HashBits = 15,
+    };
+
+    std::thread encoder;
+    std::mutex lock;
+    std::condition_variable queued;
+    std::condition_variable freed;
+
+    // Queue of slots waiting to be written.
+    int head;
+    int count;
+    bool quit;
+    bool recording;
+
+    FILE* file;
+    char* filename;
+
+    std::atomic<uint64_t> capturedFrames;
+    std::atomic<uint64_t> droppedFrames;
+    std::atomic<uint64_t> writtenFrames;
+    std::atomic<bool> failed;
+
+    // The last position each hash of three bytes was seen at while compressing.
+    int32_t hashHead[1 << HashBits];
+};
+
+FrameRecorder::FrameRecorder()
+{
+    m_state = new State;
+    m_state->head = 0;
+    m_state->count = 0;
+    m_state->quit = false;
+    m_state->recording = false;
+    m_state->file = 0;
+    m_state->filename = 0;
+    m_state->capturedFrames = 0;
+    m_state->droppedFrames = 0;
+    m_state->writtenFrames = 0;
+    m_state->failed = false;
+
+    m_format = RecordFormat_Y4M;
+    m_policy = RecordPolicy_Drop;
+    m_width = 0;
+    m_height = 0;
+    m_numSlots = 0;
+    m_slots = 0;
+    m_encodeBuffer = 0;
+    m_compressBuffer = 0;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    Stop();
+    delete m_state;
+}
+
+bool FrameRecorder::Start(const char* filename, RecordFormat format, int width, int height, int numSlots /*= 8*/, RecordPolicy policy /*= RecordPolicy_Drop*/, int frameRate /*= 60*/)
+{
+    Stop();
+    if (width <= 0 || height <= 0 || numSlots <= 0 || frameRate <= 0)
+        return false;
+
+    State* state = m_state;
+    if (format == RecordFormat_PNG)
+    {
+        size_t length = strlen(filename);
+        state->filename = new char[length + 1];
+        memcpy(state->filename, filename, length + 1);
+    }
+    else
+    {
+        state->file = fopen(filename, "wb");
+        if (!state->file)
+            return false;
+    }
+
+    m_format = format;
+    m_policy = policy;
+    m_width = width;
+    m_height = height;
+    m_numSlots = numSlots;
+    m_slots = new uint32_t*[numSlots];
+    for (int i = 0; i < numSlots; i++)
+        m_slots[i] = new uint32_t[(size_t)width * height];
+
+    // Y4M needs the planes of a frame. PNG needs its filtered rows of 3 byte pixels, each
+    // with a filter byte, and room for them to compress to no more than 9 bits a byte.
+    size_t pixels = (size_t)width * height;
+    if (format == RecordFormat_Y4M)
+    {
+        m_encodeBuffer = new uint8_t[pixels + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2)];
+    }
+    else if (format == RecordFormat_PNG)
+    {
+        size_t filteredSize = (size_t)height * (1 + 3 * (size_t)width);
+        m_encodeBuffer = new uint8_t[filteredSize];
+        m_compressBuffer = new uint8_t[filteredSize + (filteredSize / 8) + 64];
+    }
+
+    if (format == RecordFormat_Y4M)
+    {
+        char header[128];
+        int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, frameRate);
+        if (fwrite(header, length, 1, state->file) != 1)
+        {
+            FreeSlots();
+            return false;
+        }
+    }
+
+    state->head = 0;
+    state->count = 0;
+    state->quit = false;
+    state->recording = true;
+    state->capturedFrames = 0;
+    state->droppedFrames = 0;
+    state->writtenFrames = 0;
+    state->failed = false;
+    state->encoder = std::thread(EncoderMain, this);
+    return true;
+}
+
+void FrameRecorder::Stop()
+{
+    State* state = m_state;
+    if (state->recording)
+    {
+        {
+            std::lock_guard<std::mutex> lock(state->lock);
+            state->quit = true;
+        }
+        state->queued.notify_one();
+        state->encoder.join();
+        state->recording = false;
+    }
+
+    FreeSlots();
+}
+
+void FrameRecorder::FreeSlots()
+{
+    State* state = m_state;
+    if (state->file)
+    {
+        if (fclose(state->file) != 0)
+            state->failed = true;
+        state->file = 0;
+    }
+    delete[] state->filename;
+    state->filename = 0;
+
+    for (int i = 0; i < m_numSlots; i++)
+        delete[] m_slots[i];
+    delete[] m_slots;
+    m_slots = 0;
+    m_numSlots = 0;
+
+    delete[] m_encodeBuffer;
+    delete[] m_compressBuffer;
+    m_encodeBuffer = 0;
+    m_compressBuffer = 0;
+}
+
+bool FrameRecorder::IsRecording() const
+{
+    return m_state->recording;
+}
+
+bool FrameRecorder::Capture(const Surface& surface)
+{
+    PIXIE_PROFILE_ZONE("FrameRecorder::Capture");
+    State* state = m_state;
+    if (!state->recording)
+        return false;
+
+    if (surface.GetWidth() != m_width || surface.GetHeight() != m_height || !surface.GetPixels())
+    {
+        state->droppedFrames++;
+        return false;
+    }
+
+    // Only Capture adds to the queue, so the slot after the last queued one stays free
+    // while it's copied into.
+    int slot;
+    {
+        std::unique_lock<std::mutex> lock(state->lock);
+        if (state->count == m_numSlots)
+        {
+            if (m_policy == RecordPolicy_Drop)
+            {
+                state->droppedFrames++;
+                return false;
+            }
+
+            PIXIE_PROFILE_ZONE("FrameRecorder::Wait");
+            state->freed.wait(lock, [state, this] { return state->count < m_numSlots; });
+        }
+        slot = (state->head + state->count) % m_numSlots;
+    }
+
+    uint32_t* dst = m_slots[slot];
+    size_t rowBytes = m_width * sizeof(uint32_t);
+    for (int y = 0; y < m_height; y++)
+        memcpy(dst + (size_t)y * m_width, surface.GetRow(y), rowBytes);
+
+    {
+        std::lock_guard<std::mutex> lock(state->lock);
+        state->count++;
+    }
+    state->queued.notify_one();
+    state->capturedFrames++;
+    return true;
+}
+
+uint64_t FrameRecorder::GetCapturedFrames() const
+{
+    return m_state->capturedFrames;
+}
+
+uint64_t FrameRecorder::GetDroppedFrames() const
+{
+    return m_state->droppedFrames;
+}
+
+uint64_t FrameRecorder::GetWrittenFrames() const
+{
+    return m_state->writtenFrames;
+}
+
+bool FrameRecorder::HasFailed() const
+{
+    return m_state->failed;
+}
+
+void FrameRecorder::EncoderMain(FrameRecorder* recorder)
+{
+    State* state = recorder->m_state;
+    uint64_t frame = 0;
+    for (;;)
+    {
+        // Frames still queued when Stop is called are written before quitting.
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(state->lock);
+            state->queued.wait(lock, [state] { return state->count > 0 || state->quit; });
+            if (state->count == 0)
+                break;
+            slot = state->head;
+        }
+
+        if (!state->failed)
+        {
+            PIXIE_PROFILE_ZONE("FrameRecorder::WriteFrame");
+            if (recorder->WriteFrame(recorder->m_slots[slot], frame))
+                state->writtenFrames++;
+            else
+                state->failed = true;
+        }
+        frame++;
+
+        {
+            std::lock_guard<std::mutex> lock(state->lock);
+            state->head = (state->head + 1) % recorder->m_numSlots;
+            state->count--;
+        }
+        state->freed.notify_one();
+    }
+}
+
+bool FrameRecorder::WriteFrame(const uint32_t* pixels, uint64_t frame)
+{
+    switch (m_format)
+    {
+        case RecordFormat_Y4M:
+            return WriteY4M(pixels);
+        case RecordFormat_Raw:
+            return fwrite(pixels, (size_t)m_width * m_height * sizeof(uint32_t), 1, m_state->file) == 1;
+        case RecordFormat_PNG:
+            return WritePNG(pixels, frame);
+    }
+    return false;
+}
+
+// Converts to BT.601 studio range YUV, as video tools expect from a Y4M stream, with
+// each chroma sample the average of a 2x2 block of pixels.
+static inline uint8_t ToY(int r, int g, int b)
+{
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+bool FrameRecorder::WriteY4M(const uint32_t* pixels)
+{
+    int chromaWidth = (m_width + 1) / 2;
+    int chromaHeight = (m_height + 1) / 2;
+    uint8_t* planeY = m_encodeBuffer;
+    uint8_t* planeU = planeY + (size_t)m_width * m_height;
+    uint8_t* planeV = planeU + (size_t)chromaWidth * chromaHeight;
+
+    for (int cy = 0; cy < chromaHeight; cy++)
+    {
+        int y0 = cy * 2;
+        int y1 = y0 + 1 < m_height ? y0 + 1 : y0;
+        const uint32_t* row0 = pixels + (size_t)y0 * m_width;
+        const uint32_t* row1 = pixels + (size_t)y1 * m_width;
+        uint8_t* outY0 = planeY + (size_t)y0 * m_width;
+        uint8_t* outY1 = planeY + (size_t)y1 * m_width;
+        for (int cx = 0; cx < chromaWidth; cx++)
+        {
+            int x0 = cx * 2;
+            int x1 = x0 + 1 < m_width ? x0 + 1 : x0;
+            uint32_t p[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+            int sumR = 0, sumG = 0, sumB = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                int r = (p[i] >> 16) & 0xff;
+                int g = (p[i] >> 8) & 0xff;
+                int b = p[i] & 0xff;
+                sumR += r;
+                sumG += g;
+                sumB += b;
+                p[i] = ToY(r, g, b);
+            }
+
+            // Odd sizes repeat the last row or column, which writes it twice.
+            outY0[x0] = (uint8_t)p[0];
+            outY0[x1] = (uint8_t)p[1];
+            outY1[x0] = (uint8_t)p[2];
+            outY1[x1] = (uint8_t)p[3];
+
+            int r = (sumR + 2) >> 2;
+            int g = (sumG + 2) >> 2;
+            int b = (sumB + 2) >> 2;
+            planeU[(size_t)cy * chromaWidth + cx] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            planeV[(size_t)cy * chromaWidth + cx] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    static const char FrameHeader[] = "FRAME\n";
+    size_t size = (size_t)m_width * m_height + 2 * (size_t)chromaWidth * chromaHeight;
+    return fwrite(FrameHeader, sizeof(FrameHeader) - 1, 1, m_state->file) == 1 && fwrite(m_encodeBuffer, size, 1, m_state->file) == 1;
+}
+
+// Writes the bits of a deflate stream, least significant first.
+struct BitWriter
+{
+    uint8_t* out;
+    size_t size;
+    uint64_t bits;
+    int count;
+
+    void Put(uint32_t value, int length)
+    {
+        bits |= (uint64_t)value << count;
+        count += length;
+        while (count >= 8)
+        {
+            out[size++] = (uint8_t)bits;
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    void Flush()
+    {
+        if (count > 0)
+            out[size++] = (uint8_t)bits;
+        bits = 0;
+        count = 0;
+    }
+};
+
+// The fixed Huffman codes of deflate, reversed to be written least significant bit first,
+// and the symbols for match lengths and distances.
+struct DeflateTables
+{
+    uint16_t literalCodes[288];
+    uint8_t literalLengths[288];
+    uint16_t lengthSymbols[259];
+    uint16_t distanceCodes[30];
+
+    DeflateTables()
+    {
+        for (int i = 0; i < 288; i++)
+        {
+            uint32_t code;
+            int length;
+            if (i < 144)
+            {
+                code = 0x30 + i;
+                length = 8;
+            }
+            else if (i < 256)
+            {
+                code = 0x190 + (i - 144);
+                length = 9;
+            }
+            else if (i < 280)
+            {
+                code = i - 256;
+                length = 7;
+            }
+            else
+            {
+                code = 0xc0 + (i - 280);
+                length = 8;
+            }
+            literalCodes[i] = (uint16_t)Reverse(code, length);
+            literalLengths[i] = (uint8_t)length;
+        }
+
+        for (int i = 0; i < 29; i++)
+        {
+            int end = i == 28 ? 259 : LengthBase[i + 1];
+            for (int length = LengthBase[i]; length < end; length++)
+                lengthSymbols[length] = (uint16_t)i;
+        }
+        lengthSymbols[258] = 28;
+
+        for (int i = 0; i < 30; i++)
+            distanceCodes[i] = (uint16_t)Reverse(i, 5);
+    }
+
+    static uint32_t Reverse(uint32_t code, int length)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++)
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        return reversed;
+    }
+
+    static const uint16_t LengthBase[29];
+    static const uint8_t LengthExtra[29];
+    static const uint16_t DistanceBase[30];
+    static const uint8_t DistanceExtra[30];
+};
+
+const uint16_t DeflateTables::LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t DeflateTables::LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t DeflateTables::DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t DeflateTables::DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static inline uint32_t HashBytes(const uint8_t* data, int bits)
+{
+    uint32_t value = data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16);
+    return (value * 2654435761u) >> (32 - bits);
+}
+
+// Compresses data as one deflate block with the fixed Huffman codes, finding matches
+// with a hash table of the last place each three bytes were seen. out must have room for
+// 9 bits for each byte of data, which is the most any symbol costs per byte, plus a few
+// bytes. Returns the compressed size.
+static size_t Deflate(const uint8_t* data, size_t size, uint8_t* out, int32_t* hashHead, int hashBits)
+{
+    static const DeflateTables tables;
+    const int WindowSize = 32768;
+    const int MaxMatch = 258;
+
+    BitWriter writer = { out, 0, 0, 0 };
+    writer.Put(1, 1);   // Final block.
+    writer.Put(1, 2);   // Fixed Huffman codes.
+
+    memset(hashHead, 0xff, sizeof(int32_t) << hashBits);
+    size_t i = 0;
+    while (i < size)
+    {
+        int matchLength = 0;
+        size_t distance = 0;
+        if (i + 3 <= size)
+        {
+            uint32_t hash = HashBytes(data + i, hashBits);
+            int32_t candidate = hashHead[hash];
+            hashHead[hash] = (int32_t)i;
+            if (candidate >= 0 && i - candidate <= (size_t)WindowSize)
+            {
+                size_t maxLength = size - i < (size_t)MaxMatch ? size - i : MaxMatch;
+                const uint8_t* a = data + candidate;
+                const uint8_t* b = data + i;
+                size_t length = 0;
+                while (length < maxLength && a[length] == b[length])
+                    length++;
+                if (length >= 3)
+                {
+                    matchLength = (int)length;
+                    distance = i - candidate;
+                }
+            }
+        }
+
+        if (matchLength == 0)
+        {
+            writer.Put(tables.literalCodes[data[i]], tables.literalLengths[data[i]]);
+            i++;
+            continue;
+        }
+
+        int lengthSymbol = tables.lengthSymbols[matchLength];
+        writer.Put(tables.literalCodes[257 + lengthSymbol], tables.literalLengths[257 + lengthSymbol]);
+        writer.Put(matchLength - DeflateTables::LengthBase[lengthSymbol], DeflateTables::LengthExtra[lengthSymbol]);
+
+        int distanceSymbol = 29;
+        while (DeflateTables::DistanceBase[distanceSymbol] > distance)
+            distanceSymbol--;
+        writer.Put(tables.distanceCodes[distanceSymbol], 5);
+        writer.Put((uint32_t)(distance - DeflateTables::DistanceBase[distanceSymbol]), DeflateTables::DistanceExtra[distanceSymbol]);
+
+        // Remember the positions inside the match so later data can match them too.
+        size_t end = i + matchLength;
+        for (i++; i < end; i++)
+        {
+            if (i + 3 <= size)
+                hashHead[HashBytes(data + i, hashBits)] = (int32_t)i;
+        }
+    }
+
+    writer.Put(tables.literalCodes[256], tables.literalLengths[256]);
+    writer.Flush();
+    return writer.size;
+}
+
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    struct Table
+    {
+        uint32_t entries[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    for (size_t i = 0; i < size; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static uint32_t Adler32(const uint8_t* data, size_t size)
+{
+    // 5552 bytes is the most that can be summed before the sums could overflow.
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+        size_t block = size < 5552 ? size : 5552;
+        for (size_t i = 0; i < block; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
+
+static void WriteU32BE(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static bool WriteChunk(FILE* file, const char* type, const uint8_t* data, size_t size)
+{
+    uint8_t header[8];
+    WriteU32BE(header, (uint32_t)size);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = Crc32(0xffffffffu, header + 4, 4);
+    crc = Crc32(crc, data, size) ^ 0xffffffffu;
+    uint8_t footer[4];
+    WriteU32BE(footer, crc);
+    return fwrite(header, sizeof(header), 1, file) == 1 && (size == 0 || fwrite(data, size, 1, file) == 1) && fwrite(footer, sizeof(footer), 1, file) == 1;
+}
+
+bool FrameRecorder::WritePNG(const uint32_t* pixels, uint64_t frame)
+{
+    // Each row is stored as RGB with the Sub filter, so flat runs and gradients compress
+    // to repeated bytes.
+    size_t rowSize = 1 + 3 * (size_t)m_width;
+    for (int y = 0; y < m_height; y++)
+    {
+        const uint32_t* src = pixels + (size_t)y * m_width;
+        uint8_t* dst = m_encodeBuffer + y * rowSize;
+        dst[0] = 1;
+        uint32_t last = 0;
+        for (int x = 0; x < m_width; x++)
+        {
+            uint32_t pixel = src[x];
+            dst[1 + x * 3] = (uint8_t)((pixel >> 16) - (last >> 16));
+            dst[2 + x * 3] = (uint8_t)((pixel >> 8) - (last >> 8));
+            dst[3 + x * 3] = (uint8_t)(pixel - last);
+            last = pixel;
+        }
+    }
+
+    // The zlib stream is a two byte header, the deflate data and an Adler-32 checksum.
+    size_t filteredSize = rowSize * m_height;
+    m_compressBuffer[0] = 0x78;
+    m_compressBuffer[1] = 0x01;
+    size_t size = 2 + Deflate(m_encodeBuffer, filteredSize, m_compressBuffer + 2, m_state->hashHead, State::HashBits);
+    WriteU32BE(m_compressBuffer + size, Adler32(m_encodeBuffer, filteredSize));
+    size += 4;
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), m_state->filename, (int)frame);
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+        return false;
+
+    static const uint8_t Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    uint8_t header[13];
+    WriteU32BE(header, (uint32_t)m_width);
+    WriteU32BE(header + 4, (uint32_t)m_height);
+    header[8] = 8;      // Bits per channel.
+    header[9] = 2;      // RGB.
+    header[10] = 0;     // Deflate.
+    header[11] = 0;     // Adaptive filtering.
+    header[12] = 0;     // Not interlaced.
+
+    bool written = fwrite(Signature, sizeof(Signature), 1, file) == 1 &&
+        WriteChunk(file, "IHDR", header, sizeof(header)) &&
+        WriteChunk(file, "IDAT", m_compressBuffer, size) &&
+        WriteChunk(file, "IEND", 0, 0);
+    return fclose(file) == 0 && written;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include "core.h"
+#include "surface.h"
+
+namespace Pixie
+{
+    enum RecordFormat
+    {
+        RecordFormat_Y4M = 0,       // One YUV4MPEG2 stream of 4:2:0 frames, which video tools read.
+        RecordFormat_Raw,           // One stream of frames as they are in memory, 4 bytes a pixel.
+        RecordFormat_PNG,           // A PNG file for each frame.
+    };
+
+    // What Capture does when every frame slot is waiting to be written.
+    enum RecordPolicy
+    {
+        RecordPolicy_Drop = 0,      // Drops the frame and counts it, so rendering never waits.
+        RecordPolicy_Block,         // Waits for the encoder, so every frame is written.
+    };
+
+    // Records frames to disk without slowing down the thread that draws them. Capture
+    // copies a frame into one of a fixed pool of slots allocated by Start and hands it to
+    // an encoder thread, which converts, compresses and writes it while the next frame
+    // is drawn. Set it on a window with Window::SetFrameRecorder to capture every frame
+    // Update presents.
+    class FrameRecorder
+    {
+        public:
+            FrameRecorder();
+            ~FrameRecorder();
+
+            // Starts recording width by height frames. Y4M and raw streams are written to
+            // filename. For PNG, filename is a printf format for each frame's file name
+            // given the frame number, such as "frame%05d.png". numSlots frames can be
+            // waiting to be written before policy applies. Y4M records frameRate in its
+            // header. Returns false if the file can't be created.
+            bool Start(const char* filename, RecordFormat format, int width, int height, int numSlots = 8, RecordPolicy policy = RecordPolicy_Drop, int frameRate = 60);
+
+            // Writes the frames still waiting and closes the file.
+            void Stop();
+
+            bool IsRecording() const;
+
+            // Copies the surface into a free slot to be written. Returns false if the frame
+            // was dropped, because nothing is being recorded, the surface isn't the size
+            // given to Start, or no slot is free with RecordPolicy_Drop.
+            bool Capture(const Surface& surface);
+
+            // Returns the number of frames captured, dropped and written since Start.
+            uint64_t GetCapturedFrames() const;
+            uint64_t GetDroppedFrames() const;
+            uint64_t GetWrittenFrames() const;
+
+            // Returns true if writing failed. Frames after a failure are thrown away.
+            bool HasFailed() const;
+
+        private:
+            struct State;
+
+            static void EncoderMain(FrameRecorder* recorder);
+            bool WriteFrame(const uint32_t* pixels, uint64_t frame);
+            bool WriteY4M(const uint32_t* pixels);
+            bool WritePNG(const uint32_t* pixels, uint64_t frame);
+            void FreeSlots();
+
+            FrameRecorder(const FrameRecorder&);
+            FrameRecorder& operator=(const FrameRecorder&);
+
+            State* m_state;
+            RecordFormat m_format;
+            RecordPolicy m_policy;
+            int m_width;
+            int m_height;
+            int m_numSlots;
+            uint32_t** m_slots;
+
+            // Scratch space for the encoder thread: the YUV planes of a Y4M frame, or the
+            // filtered rows and compressed data of a PNG.
+            uint8_t* m_encodeBuffer;
+            uint8_t* m_compressBuffer;
+    };
+}
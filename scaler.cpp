@@ -0,0 +1,307 @@
+#include "core.h"
+#include "scaler.h"
+#include "simd.h"
+#include <string.h>
+
+using namespace Pixie;
+
+Scaler::Scaler()
+{
+    m_srcWidth = 0;
+    m_srcHeight = 0;
+    m_dstWidth = 0;
+    m_dstHeight = 0;
+    m_filter = ScaleFilter_Nearest;
+    m_image.left = m_image.top = m_image.right = m_image.bottom = 0;
+    m_factorX = 0;
+    m_factorY = 0;
+    m_columns = 0;
+    m_rows = 0;
+    m_columnWeights = 0;
+    m_rowWeights = 0;
+    m_columnsSize = 0;
+    m_rowsSize = 0;
+}
+
+Scaler::~Scaler()
+{
+    delete[] m_columns;
+    delete[] m_rows;
+    delete[] m_columnWeights;
+    delete[] m_rowWeights;
+}
+
+// Fills in the source pixel for each of dstSize destination pixels, as BlitScaled picks
+// them, or for bilinear the first of the pair either side of the destination pixel's
+// centre, with the weights of the pair out of 256 in the low and high 16 bits.
+static void BuildTable(int* positions, uint32_t* weights, int srcSize, int dstSize, ScaleFilter filter)
+{
+    for (int i = 0; i < dstSize; i++)
+    {
+        int64_t centre = (2 * (int64_t)i + 1) * srcSize;
+        if (filter == ScaleFilter_Nearest)
+        {
+            positions[i] = (int)(centre / (2 * (int64_t)dstSize));
+            weights[i] = 0;
+            continue;
+        }
+
+        // The centre in source pixels, less half a pixel, in 24.8 fixed point.
+        int64_t pos = ((centre - dstSize) * 256) / (2 * (int64_t)dstSize);
+        if (pos < 0)
+            pos = 0;
+        int whole = (int)(pos >> 8);
+        uint32_t weight = (uint32_t)(pos & 255);
+        if (whole >= srcSize - 1)
+        {
+            whole = srcSize - 2;
+            weight = 256;
+        }
+        positions[i] = whole;
+        weights[i] = (weight << 16) | (256 - weight);
+    }
+}
+
+void Scaler::Init(int srcWidth, int srcHeight, int dstWidth, int dstHeight, ScaleFilter filter, bool letterbox)
+{
+    m_srcWidth = srcWidth;
+    m_srcHeight = srcHeight;
+    m_dstWidth = dstWidth;
+    m_dstHeight = dstHeight;
+    m_filter = filter;
+    m_image.left = m_image.top = m_image.right = m_image.bottom = 0;
+    m_factorX = 0;
+    m_factorY = 0;
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+        return;
+
+    // Bilinear blends each pixel with the next, so needs at least two of them each way.
+    if (srcWidth < 2 || srcHeight < 2)
+        m_filter = filter = ScaleFilter_Nearest;
+
+    // Letterboxing fills whichever of the width or height runs out first.
+    int imageWidth = dstWidth;
+    int imageHeight = dstHeight;
+    if (letterbox)
+    {
+        if ((int64_t)dstWidth * srcHeight <= (int64_t)dstHeight * srcWidth)
+            imageHeight = (int)(((int64_t)dstWidth * srcHeight) / srcWidth);
+        else
+            imageWidth = (int)(((int64_t)dstHeight * srcWidth) / srcHeight);
+        if (imageWidth <= 0 || imageHeight <= 0)
+            return;
+    }
+
+    m_image.left = (dstWidth - imageWidth) / 2;
+    m_image.top = (dstHeight - imageHeight) / 2;
+    m_image.right = m_image.left + imageWidth;
+    m_image.bottom = m_image.top + imageHeight;
+
+    if (filter == ScaleFilter_Nearest && imageWidth % srcWidth == 0 && imageHeight % srcHeight == 0)
+    {
+        m_factorX = imageWidth / srcWidth;
+        m_factorY = imageHeight / srcHeight;
+        return;
+    }
+
+    if (m_columnsSize < imageWidth)
+    {
+        delete[] m_columns;
+        delete[] m_columnWeights;
+        m_columns = new int[imageWidth];
+        m_columnWeights = new uint32_t[imageWidth];
+        m_columnsSize = imageWidth;
+    }
+
+    if (m_rowsSize < imageHeight)
+    {
+        delete[] m_rows;
+        delete[] m_rowWeights;
+        m_rows = new int[imageHeight];
+        m_rowWeights = new uint32_t[imageHeight];
+        m_rowsSize = imageHeight;
+    }
+
+    BuildTable(m_columns, m_columnWeights, srcWidth, imageWidth, filter);
+    BuildTable(m_rows, m_rowWeights, srcHeight, imageHeight, filter);
+}
+
+// Returns a destination range covering every pixel that samples the source range from
+// start to end, out of srcSize source pixels scaled to dstSize.
+static void MapRange(int start, int end, int srcSize, int dstSize, int& dstStart, int& dstEnd)
+{
+    dstStart = (int)(((int64_t)start * dstSize) / srcSize) - 1;
+    dstEnd = (int)((((int64_t)end * dstSize) + srcSize - 1) / srcSize) + 1;
+    if (dstStart < 0)
+        dstStart = 0;
+    if (dstEnd > dstSize)
+        dstEnd = dstSize;
+}
+
+SurfaceRect Scaler::MapRect(const SurfaceRect& srcRect) const
+{
+    SurfaceRect rect;
+    int imageWidth = m_image.right - m_image.left;
+    int imageHeight = m_image.bottom - m_image.top;
+    if (imageWidth <= 0 || imageHeight <= 0)
+    {
+        rect.left = rect.top = rect.right = rect.bottom = 0;
+        return rect;
+    }
+
+    if (m_factorX)
+    {
+        rect.left = m_image.left + (srcRect.left * m_factorX);
+        rect.top = m_image.top + (srcRect.top * m_factorY);
+        rect.right = m_image.left + (srcRect.right * m_factorX);
+        rect.bottom = m_image.top + (srcRect.bottom * m_factorY);
+        return rect;
+    }
+
+    // A bilinear pixel also changes when either neighbour it blends with does.
+    int grow = m_filter == ScaleFilter_Bilinear ? 1 : 0;
+    int left = srcRect.left - grow < 0 ? 0 : srcRect.left - grow;
+    int top = srcRect.top - grow < 0 ? 0 : srcRect.top - grow;
+    int right = srcRect.right + grow > m_srcWidth ? m_srcWidth : srcRect.right + grow;
+    int bottom = srcRect.bottom + grow > m_srcHeight ? m_srcHeight : srcRect.bottom + grow;
+
+    MapRange(left, right, m_srcWidth, imageWidth, rect.left, rect.right);
+    MapRange(top, bottom, m_srcHeight, imageHeight, rect.top, rect.bottom);
+    rect.left += m_image.left;
+    rect.right += m_image.left;
+    rect.top += m_image.top;
+    rect.bottom += m_image.top;
+    return rect;
+}
+
+// Divides, rounding towards minus infinity, for positions left of or above the image.
+static inline int64_t FloorDiv(int64_t a, int64_t b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+void Scaler::MapToSource(int dstX, int dstY, int& srcX, int& srcY) const
+{
+    int imageWidth = m_image.right - m_image.left;
+    int imageHeight = m_image.bottom - m_image.top;
+    if (imageWidth <= 0 || imageHeight <= 0)
+    {
+        srcX = srcY = 0;
+        return;
+    }
+
+    int64_t x = dstX - m_image.left;
+    int64_t y = dstY - m_image.top;
+    srcX = (int)FloorDiv((2 * x + 1) * m_srcWidth, 2 * (int64_t)imageWidth);
+    srcY = (int)FloorDiv((2 * y + 1) * m_srcHeight, 2 * (int64_t)imageHeight);
+}
+
+void Scaler::Scale(const Surface& dst, const Surface& src, const SurfaceRect& dstRect) const
+{
+    if (!dst.GetPixels() || !src.GetPixels() || src.GetWidth() < m_srcWidth || src.GetHeight() < m_srcHeight)
+        return;
+
+    SurfaceRect rect;
+    rect.left = dstRect.left < m_image.left ? m_image.left : dstRect.left;
+    rect.top = dstRect.top < m_image.top ? m_image.top : dstRect.top;
+    rect.right = dstRect.right > m_image.right ? m_image.right : dstRect.right;
+    rect.bottom = dstRect.bottom > m_image.bottom ? m_image.bottom : dstRect.bottom;
+    if (rect.right > dst.GetWidth())
+        rect.right = dst.GetWidth();
+    if (rect.bottom > dst.GetHeight())
+        rect.bottom = dst.GetHeight();
+    if (rect.left >= rect.right || rect.top >= rect.bottom)
+        return;
+
+    if (m_factorX)
+        ScaleInteger(dst, src, rect);
+    else if (m_filter == ScaleFilter_Nearest)
+        ScaleNearest(dst, src, rect);
+    else
+        ScaleBilinear(dst, src, rect);
+}
+
+void Scaler::ScaleInteger(const Surface& dst, const Surface& src, const SurfaceRect& rect) const
+{
+    // Widen the rectangle to whole runs of replicated pixels, which stay within the image.
+    int srcLeft = (rect.left - m_image.left) / m_factorX;
+    int srcRight = (rect.right - m_image.left + m_factorX - 1) / m_factorX;
+    int count = srcRight - srcLeft;
+    int x = m_image.left + (srcLeft * m_factorX);
+    size_t rowBytes = (size_t)count * m_factorX * sizeof(uint32_t);
+
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    for (int y = rect.top; y < rect.bottom; y++)
+    {
+        uint32_t* d = dst.GetRow(y) + x;
+        int row = y - m_image.top;
+
+        // Only the first row of each run is scaled, the rest copy the row above.
+        if (y > rect.top && (row % m_factorY) != 0)
+            memcpy(d, d - dst.GetStride(), rowBytes);
+        else if (m_factorX == 1)
+            memcpy(d, src.GetRow(row / m_factorY) + srcLeft, rowBytes);
+        else
+            kernels.replicate(d, src.GetRow(row / m_factorY) + srcLeft, count, m_factorX);
+    }
+}
+
+void Scaler::ScaleNearest(const Surface& dst, const Surface& src, const SurfaceRect& rect) const
+{
+    const int* columns = m_columns - m_image.left;
+    size_t rowBytes = (rect.right - rect.left) * sizeof(uint32_t);
+    int lastSrcY = -1;
+    for (int y = rect.top; y < rect.bottom; y++)
+    {
+        uint32_t* d = dst.GetRow(y);
+        int srcY = m_rows[y - m_image.top];
+        if (srcY == lastSrcY)
+        {
+            memcpy(d + rect.left, d + rect.left - dst.GetStride(), rowBytes);
+            continue;
+        }
+
+        const uint32_t* s = src.GetRow(srcY);
+        for (int x = rect.left; x < rect.right; x++)
+            d[x] = s[columns[x]];
+        lastSrcY = srcY;
+    }
+}
+
+void Scaler::ScaleBilinear(const Surface& dst, const Surface& src, const SurfaceRect& rect) const
+{
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    int column = rect.left - m_image.left;
+    for (int y = rect.top; y < rect.bottom; y++)
+    {
+        int srcY = m_rows[y - m_image.top];
+        uint32_t weightY = m_rowWeights[y - m_image.top] >> 16;
+        const uint32_t* row0 = src.GetRow(srcY);
+        const uint32_t* row1 = weightY ? src.GetRow(srcY + 1) : row0;
+        kernels.bilinearRow(dst.GetRow(y) + rect.left, row0, row1, m_columns + column, m_columnWeights + column, rect.right - rect.left, weightY);
+    }
+}
+
+void Scaler::FillBorders(const Surface& dst) const
+{
+    if (!dst.GetPixels())
+        return;
+
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    int width = m_dstWidth < dst.GetWidth() ? m_dstWidth : dst.GetWidth();
+    int height = m_dstHeight < dst.GetHeight() ? m_dstHeight : dst.GetHeight();
+    for (int y = 0; y < height; y++)
+    {
+        uint32_t* d = dst.GetRow(y);
+        if (y < m_image.top || y >= m_image.bottom)
+        {
+            kernels.fill(d, width, MAKE_RGB(0, 0, 0));
+            continue;
+        }
+
+        if (m_image.left > 0)
+            kernels.fill(d, m_image.left, MAKE_RGB(0, 0, 0));
+        if (m_image.right < width)
+            kernels.fill(d + m_image.right, width - m_image.right, MAKE_RGB(0, 0, 0));
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include "surface.h"
+
+namespace Pixie
+{
+    enum ScaleFilter
+    {
+        ScaleFilter_Nearest = 0,    // Each output pixel takes the nearest source pixel.
+        ScaleFilter_Bilinear,       // Each output pixel blends the four nearest source pixels.
+    };
+
+    // Scales a source image to fill a destination, such as a small backing buffer to a
+    // large window. Whole number scales with ScaleFilter_Nearest replicate pixels with the
+    // SIMD kernels and copy repeated rows; other scales look the source columns up in a
+    // table built by Init. Each destination pixel depends only on the source, so any set
+    // of rectangles, such as bands of rows on different threads, can be scaled
+    // independently.
+    class Scaler
+    {
+        public:
+            Scaler();
+            ~Scaler();
+
+            // Sets up scaling a srcWidth by srcHeight image to dstWidth by dstHeight. With
+            // letterbox the image keeps its aspect ratio and is centred, leaving black bars
+            // either side of it.
+            void Init(int srcWidth, int srcHeight, int dstWidth, int dstHeight, ScaleFilter filter, bool letterbox);
+
+            // Returns the rectangle of the destination the image covers.
+            const SurfaceRect& GetImageRect() const;
+
+            // Returns the rectangle of the destination that changes when the given rectangle
+            // of the source does.
+            SurfaceRect MapRect(const SurfaceRect& srcRect) const;
+
+            // Maps a position in the destination to the source pixel under it. Positions
+            // outside the image map to positions outside the source.
+            void MapToSource(int dstX, int dstY, int& srcX, int& srcY) const;
+
+            // Writes the part of the scaled image within the given rectangle of dst. Integer
+            // scales may write whole runs of replicated pixels beyond the left and right of
+            // the rectangle, but never outside the image or above or below the rectangle.
+            void Scale(const Surface& dst, const Surface& src, const SurfaceRect& dstRect) const;
+
+            // Fills the destination outside the image with black.
+            void FillBorders(const Surface& dst) const;
+
+        private:
+            void ScaleInteger(const Surface& dst, const Surface& src, const SurfaceRect& rect) const;
+            void ScaleNearest(const Surface& dst, const Surface& src, const SurfaceRect& rect) const;
+            void ScaleBilinear(const Surface& dst, const Surface& src, const SurfaceRect& rect) const;
+
+            int m_srcWidth;
+            int m_srcHeight;
+            int m_dstWidth;
+            int m_dstHeight;
+            ScaleFilter m_filter;
+            SurfaceRect m_image;
+
+            // Whole number scales, or 0 if the table based paths are used.
+            int m_factorX;
+            int m_factorY;
+
+            // For each column and row of the image, the source pixel to take, or with
+            // ScaleFilter_Bilinear the first of the two to blend and the weights of the two
+            // out of 256 in the low and high 16 bits.
+            int* m_columns;
+            int* m_rows;
+            uint32_t* m_columnWeights;
+            uint32_t* m_rowWeights;
+            int m_columnsSize;
+            int m_rowsSize;
+    };
+
+    inline const SurfaceRect& Scaler::GetImageRect() const
+    {
+        return m_image;
+    }
+}
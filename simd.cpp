@@ -0,0 +1,1123 @@
+#include "simd.h"
+#include <assert.h>
+#include <string.h>
+#include <atomic>
+
+#if PIXIE_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if PIXIE_SIMD_X86 && !defined(_MSC_VER)
+#define PIXIE_TARGET_SSE2 __attribute__((target("sse2")))
+#define PIXIE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define PIXIE_TARGET_SSE2
+#define PIXIE_TARGET_AVX2
+#endif
+
+using namespace Pixie;
+using namespace Pixie::Simd;
+
+//
+// Scalar kernels.
+//
+
+static void CopyMaskedScalar(uint32_t* dst, const uint32_t* src, uint64_t mask, int count)
+{
+    for (int i = 0; mask; i++, mask >>= 1)
+    {
+        if (mask & 1)
+            dst[i] = src[i];
+    }
+}
+
+static void FillMaskedScalar(uint32_t* dst, uint64_t mask, int count, uint32_t colour)
+{
+    for (int i = 0; mask; i++, mask >>= 1)
+    {
+        if (mask & 1)
+            dst[i] = colour;
+    }
+}
+
+static void FillScalar(uint32_t* dst, int count, uint32_t colour)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = colour;
+}
+
+// dst * factor / 255 + add for each channel. The division rounds to nearest, and is
+// exact for a factor of 255. The SIMD kernels must give the same results.
+static inline uint32_t Div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t BlendPixel(uint32_t dst, uint32_t factor, uint32_t add)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t c = Div255(((dst >> shift) & 0xff) * ((factor >> shift) & 0xff)) + ((add >> shift) & 0xff);
+        result |= (c > 255 ? 255 : c) << shift;
+    }
+    return result;
+}
+
+// Partial coverage moves the factor towards 255 and the add towards 0, so no coverage
+// leaves the pixel alone. The top byte has a factor of 255 and an add of 0, so it's
+// still left alone.
+static inline uint32_t BlendCoveragePixel(uint32_t dst, uint32_t coverage, uint32_t factor, uint32_t add)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t f = 255 - Div255((255 - ((factor >> shift) & 0xff)) * coverage);
+        uint32_t a = Div255(((add >> shift) & 0xff) * coverage);
+        uint32_t c = Div255(((dst >> shift) & 0xff) * f) + a;
+        result |= (c > 255 ? 255 : c) << shift;
+    }
+    return result;
+}
+
+static void BlendFillScalar(uint32_t* dst, int count, Blend blend)
+{
+    for (int i = 0; i < count; i++)
+        dst[i] = BlendPixel(dst[i], blend.factor, blend.add);
+}
+
+static void BlendFillMaskedScalar(uint32_t* dst, uint64_t mask, int count, Blend blend)
+{
+    for (int i = 0; mask; i++, mask >>= 1)
+    {
+        if (mask & 1)
+            dst[i] = BlendPixel(dst[i], blend.factor, blend.add);
+    }
+}
+
+static void BlendCoverageScalar(uint32_t* dst, const uint8_t* coverage, int count, Blend blend)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (coverage[i])
+            dst[i] = BlendCoveragePixel(dst[i], coverage[i], blend.factor, blend.add);
+    }
+}
+
+static void ExpandBGRScalar(uint32_t* dst, const uint8_t* src, int count)
+{
+    for (int i = 0; i < count; i++, src += 3)
+        dst[i] = 0xff000000 | (src[2] << 16) | (src[1] << 8) | src[0];
+}
+
+static void CopyKeyedScalar(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    key &= 0xffffff;
+    for (int i = 0; i < count; i++)
+    {
+        if ((src[i] & 0xffffff) != key)
+            dst[i] = src[i];
+    }
+}
+
+// The same sum as BlendPixel with the factor and add MakeBlend gives for src-over, so an
+// image of one colour draws the same as that colour.
+static inline uint32_t BlendAlphaPixel(uint32_t dst, uint32_t src)
+{
+    uint32_t alpha = src >> 24;
+    uint32_t result = dst & 0xff000000;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        uint32_t c = Div255(((dst >> shift) & 0xff) * (255 - alpha)) + Div255(((src >> shift) & 0xff) * alpha);
+        result |= (c > 255 ? 255 : c) << shift;
+    }
+    return result;
+}
+
+static void BlendAlphaScalar(uint32_t* dst, const uint32_t* src, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (src[i] >> 24)
+            dst[i] = BlendAlphaPixel(dst[i], src[i]);
+    }
+}
+
+static void ReplicateScalar(uint32_t* dst, const uint32_t* src, int count, int factor)
+{
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < factor; j++)
+            *dst++ = src[i];
+    }
+}
+
+// Blends a and b by weights out of 256 that add up to 256, two channels at a time.
+static inline uint32_t LerpPixel(uint32_t a, uint32_t b, uint32_t weightA, uint32_t weightB)
+{
+    uint32_t rb = ((((a & 0xff00ff) * weightA) + ((b & 0xff00ff) * weightB)) >> 8) & 0xff00ff;
+    uint32_t ag = ((((a >> 8) & 0xff00ff) * weightA) + (((b >> 8) & 0xff00ff) * weightB)) & 0xff00ff00;
+    return rb | ag;
+}
+
+static void BilinearRowScalar(uint32_t* dst, const uint32_t* row0, const uint32_t* row1, const int* columns, const uint32_t* weights, int count, uint32_t weightY)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int x = columns[i];
+        uint32_t weightA = weights[i] & 0xffff;
+        uint32_t weightB = weights[i] >> 16;
+        uint32_t pixel = LerpPixel(row0[x], row0[x + 1], weightA, weightB);
+        if (weightY)
+            pixel = LerpPixel(pixel, LerpPixel(row1[x], row1[x + 1], weightA, weightB), 256 - weightY, weightY);
+        dst[i] = pixel;
+    }
+}
+
+static bool EqualScalar(const uint32_t* a, const uint32_t* b, int count)
+{
+    return memcmp(a, b, count * sizeof(uint32_t)) == 0;
+}
+
+#if PIXIE_SIMD_X86
+
+//
+// SSE2 kernels. Four mask bits are expanded to four 32-bit lanes at a time. SSE2
+// has no masked store, so these blend with the destination and write back all four
+// pixels, finishing the row with the scalar kernel.
+//
+
+PIXIE_TARGET_SSE2
+static inline __m128i ExpandMaskSSE2(uint64_t mask)
+{
+    const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+    __m128i bits = _mm_and_si128(_mm_set1_epi32((int)(mask & 0xf)), laneBits);
+    return _mm_cmpeq_epi32(bits, laneBits);
+}
+
+PIXIE_TARGET_SSE2
+static void CopyMaskedSSE2(uint32_t* dst, const uint32_t* src, uint64_t mask, int count)
+{
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4, mask >>= 4)
+    {
+        if (!(mask & 0xf))
+            continue;
+
+        __m128i m = ExpandMaskSSE2(mask);
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, d)));
+    }
+
+    CopyMaskedScalar(dst + i, src + i, mask, count - i);
+}
+
+PIXIE_TARGET_SSE2
+static void FillMaskedSSE2(uint32_t* dst, uint64_t mask, int count, uint32_t colour)
+{
+    const __m128i c = _mm_set1_epi32(colour);
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4, mask >>= 4)
+    {
+        if (!(mask & 0xf))
+            continue;
+
+        __m128i m = ExpandMaskSSE2(mask);
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(m, c), _mm_andnot_si128(m, d)));
+    }
+
+    FillMaskedScalar(dst + i, mask, count - i, colour);
+}
+
+PIXIE_TARGET_SSE2
+static void FillSSE2(uint32_t* dst, int count, uint32_t colour)
+{
+    const __m128i c = _mm_set1_epi32(colour);
+
+    // Align the destination so the main loop uses aligned stores.
+    int i = 0;
+    for ( ; i < count && ((uintptr_t)(dst + i) & 15); i++)
+        dst[i] = colour;
+
+    for ( ; i + 16 <= count; i += 16)
+    {
+        _mm_store_si128((__m128i*)(dst + i), c);
+        _mm_store_si128((__m128i*)(dst + i + 4), c);
+        _mm_store_si128((__m128i*)(dst + i + 8), c);
+        _mm_store_si128((__m128i*)(dst + i + 12), c);
+    }
+
+    for ( ; i + 4 <= count; i += 4)
+        _mm_store_si128((__m128i*)(dst + i), c);
+
+    FillScalar(dst + i, count - i, colour);
+}
+
+// Multiplies 16-bit lanes holding bytes and divides by 255, rounding as Div255.
+PIXIE_TARGET_SSE2
+static inline __m128i MulDiv255SSE2(__m128i a, __m128i b)
+{
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Blends four pixels. Each channel is widened to 16 bits, multiplied by its factor and
+// divided by 255, then packed back to bytes and the add applied with saturation.
+PIXIE_TARGET_SSE2
+static inline __m128i BlendSSE2(__m128i d, __m128i factor, __m128i add)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = MulDiv255SSE2(_mm_unpacklo_epi8(d, zero), factor);
+    __m128i hi = MulDiv255SSE2(_mm_unpackhi_epi8(d, zero), factor);
+    return _mm_adds_epu8(_mm_packus_epi16(lo, hi), add);
+}
+
+// Blends two pixels widened to 16 bits, each channel scaled by its pixel's coverage as
+// BlendCoveragePixel. inverseFactor is 255 - factor.
+PIXIE_TARGET_SSE2
+static inline __m128i BlendCoverageWidenedSSE2(__m128i d, __m128i coverage, __m128i inverseFactor, __m128i add)
+{
+    __m128i f = _mm_sub_epi16(_mm_set1_epi16(255), MulDiv255SSE2(inverseFactor, coverage));
+    return _mm_add_epi16(MulDiv255SSE2(d, f), MulDiv255SSE2(add, coverage));
+}
+
+PIXIE_TARGET_SSE2
+static void BlendFillSSE2(uint32_t* dst, int count, Blend blend)
+{
+    const __m128i f = _mm_unpacklo_epi8(_mm_set1_epi32(blend.factor), _mm_setzero_si128());
+    const __m128i a = _mm_set1_epi32(blend.add);
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), BlendSSE2(d, f, a));
+    }
+
+    BlendFillScalar(dst + i, count - i, blend);
+}
+
+PIXIE_TARGET_SSE2
+static void BlendFillMaskedSSE2(uint32_t* dst, uint64_t mask, int count, Blend blend)
+{
+    const __m128i f = _mm_unpacklo_epi8(_mm_set1_epi32(blend.factor), _mm_setzero_si128());
+    const __m128i a = _mm_set1_epi32(blend.add);
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4, mask >>= 4)
+    {
+        if (!(mask & 0xf))
+            continue;
+
+        __m128i m = ExpandMaskSSE2(mask);
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = BlendSSE2(d, f, a);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, d)));
+    }
+
+    BlendFillMaskedScalar(dst + i, mask, count - i, blend);
+}
+
+// Blends four pixels with the coverage in the four bytes of c4.
+PIXIE_TARGET_SSE2
+static inline __m128i BlendCoverage4SSE2(__m128i d, uint32_t c4, __m128i inverseFactor, __m128i add)
+{
+    // Spread each pixel's coverage over its four channels.
+    const __m128i zero = _mm_setzero_si128();
+    __m128i c = _mm_cvtsi32_si128((int)c4);
+    c = _mm_unpacklo_epi8(c, c);
+    c = _mm_unpacklo_epi16(c, c);
+
+    __m128i lo = BlendCoverageWidenedSSE2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(c, zero), inverseFactor, add);
+    __m128i hi = BlendCoverageWidenedSSE2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(c, zero), inverseFactor, add);
+    return _mm_packus_epi16(lo, hi);
+}
+
+PIXIE_TARGET_SSE2
+static void BlendCoverageSSE2(uint32_t* dst, const uint8_t* coverage, int count, Blend blend)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i inverseFactor = _mm_unpacklo_epi8(_mm_set1_epi32(~blend.factor), zero);
+    const __m128i add = _mm_unpacklo_epi8(_mm_set1_epi32(blend.add), zero);
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        uint32_t c4;
+        memcpy(&c4, coverage + i, sizeof(c4));
+        if (!c4)
+            continue;
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), BlendCoverage4SSE2(d, c4, inverseFactor, add));
+    }
+
+    // Glyph rows are short, so the last few pixels go through a copy rather than a
+    // pixel at a time. The unused lanes have no coverage.
+    int remaining = count - i;
+    if (remaining > 0)
+    {
+        uint32_t c4 = 0, pixels[4];
+        memcpy(&c4, coverage + i, remaining);
+        memcpy(pixels, dst + i, remaining * sizeof(uint32_t));
+        __m128i d = _mm_loadu_si128((const __m128i*)pixels);
+        _mm_storeu_si128((__m128i*)pixels, BlendCoverage4SSE2(d, c4, inverseFactor, add));
+        memcpy(dst + i, pixels, remaining * sizeof(uint32_t));
+    }
+}
+
+PIXIE_TARGET_SSE2
+static void ExpandBGRSSE2(uint32_t* dst, const uint8_t* src, int count)
+{
+    // Without a byte shuffle, pixel n is moved from byte 3n to byte 4n by shifting the
+    // whole register left n bytes and masking out its lane. Each 16-byte load takes four
+    // pixels, so stop while there are still two pixels past them to load safely.
+    const __m128i lane = _mm_set1_epi32(0x00ffffff);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    const __m128i lane0 = _mm_setr_epi32(-1, 0, 0, 0);
+    const __m128i lane1 = _mm_setr_epi32(0, -1, 0, 0);
+    const __m128i lane2 = _mm_setr_epi32(0, 0, -1, 0);
+    const __m128i lane3 = _mm_setr_epi32(0, 0, 0, -1);
+
+    int i = 0;
+    for ( ; i + 6 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + (i * 3)));
+        __m128i p = _mm_and_si128(v, lane0);
+        p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 1), lane1));
+        p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 2), lane2));
+        p = _mm_or_si128(p, _mm_and_si128(_mm_slli_si128(v, 3), lane3));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(p, lane), alpha));
+    }
+
+    ExpandBGRScalar(dst + i, src + (i * 3), count - i);
+}
+
+PIXIE_TARGET_SSE2
+static void CopyKeyedSSE2(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+    const __m128i k = _mm_set1_epi32((int)(key & 0xffffff));
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i keyed = _mm_cmpeq_epi32(_mm_and_si128(s, rgb), k);
+        if (_mm_movemask_epi8(keyed) == 0xffff)
+            continue;
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(keyed, d), _mm_andnot_si128(keyed, s)));
+    }
+
+    CopyKeyedScalar(dst + i, src + i, count - i, key);
+}
+
+// Blends four pixels of s into d by the alpha of each pixel of s, as BlendAlphaPixel.
+PIXIE_TARGET_SSE2
+static inline __m128i BlendAlpha4SSE2(__m128i d, __m128i s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i maxAlpha = _mm_set1_epi16(255);
+
+    // Spread each pixel's alpha over its four channels.
+    __m128i sLo = _mm_unpacklo_epi8(s, zero);
+    __m128i sHi = _mm_unpackhi_epi8(s, zero);
+    __m128i aLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sLo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i aHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sHi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m128i lo = _mm_add_epi16(MulDiv255SSE2(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(maxAlpha, aLo)), MulDiv255SSE2(sLo, aLo));
+    __m128i hi = _mm_add_epi16(MulDiv255SSE2(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(maxAlpha, aHi)), MulDiv255SSE2(sHi, aHi));
+
+    const __m128i top = _mm_set1_epi32((int)0xff000000);
+    return _mm_or_si128(_mm_andnot_si128(top, _mm_packus_epi16(lo, hi)), _mm_and_si128(top, d));
+}
+
+PIXIE_TARGET_SSE2
+static void BlendAlphaSSE2(uint32_t* dst, const uint32_t* src, int count)
+{
+    // Sprites are mostly either clear or solid, so groups of clear pixels are skipped.
+    const __m128i top = _mm_set1_epi32((int)0xff000000);
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, top), zero)) == 0xffff)
+            continue;
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), BlendAlpha4SSE2(d, s));
+    }
+
+    BlendAlphaScalar(dst + i, src + i, count - i);
+}
+
+// Takes two pairs of pixels, A0 A1 B0 B1, and the weights of each pair spread over the
+// channels of its pixels, and returns the blended A and B as 16-bit channels.
+PIXIE_TARGET_SSE2
+static inline __m128i LerpPairsSSE2(__m128i pixels, __m128i weightsA, __m128i weightsB)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i a = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weightsA);
+    __m128i b = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weightsB);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b)), 8);
+}
+
+PIXIE_TARGET_SSE2
+static void BilinearRowSSE2(uint32_t* dst, const uint32_t* row0, const uint32_t* row1, const int* columns, const uint32_t* weights, int count, uint32_t weightY)
+{
+    __m128i weightTop = _mm_set1_epi16((short)(256 - weightY));
+    __m128i weightBottom = _mm_set1_epi16((short)weightY);
+
+    // Two pixels at a time. Each channel is at most 255 * 256, so fits in 16 bits.
+    int i = 0;
+    for ( ; i + 2 <= count; i += 2)
+    {
+        const uint32_t* a = row0 + columns[i];
+        const uint32_t* b = row0 + columns[i + 1];
+        __m128i w = _mm_loadl_epi64((const __m128i*)(weights + i));
+        w = _mm_unpacklo_epi16(w, w);
+        __m128i weightsA = _mm_unpacklo_epi32(w, w);
+        __m128i weightsB = _mm_unpackhi_epi32(w, w);
+
+        __m128i top = LerpPairsSSE2(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)a), _mm_loadl_epi64((const __m128i*)b)), weightsA, weightsB);
+        a += row1 - row0;
+        b += row1 - row0;
+        __m128i bottom = LerpPairsSSE2(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)a), _mm_loadl_epi64((const __m128i*)b)), weightsA, weightsB);
+        __m128i v = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(top, weightTop), _mm_mullo_epi16(bottom, weightBottom)), 8);
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(v, v));
+    }
+
+    BilinearRowScalar(dst + i, row0, row1, columns + i, weights + i, count - i, weightY);
+}
+
+PIXIE_TARGET_SSE2
+static void ReplicateSSE2(uint32_t* dst, const uint32_t* src, int count, int factor)
+{
+    int i = 0;
+    if (factor == 2)
+    {
+        for ( ; i + 4 <= count; i += 4, dst += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(v, v));
+        }
+    }
+    else if (factor == 3)
+    {
+        for ( ; i + 4 <= count; i += 4, dst += 12)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+        }
+    }
+    else if (factor >= 4)
+    {
+        // Each pixel's run is written four at a time, with the last store overlapping the
+        // one before rather than spilling into the next run.
+        for ( ; i < count; i++, dst += factor)
+        {
+            __m128i c = _mm_set1_epi32((int)src[i]);
+            for (int j = 0; j + 4 <= factor; j += 4)
+                _mm_storeu_si128((__m128i*)(dst + j), c);
+            if (factor & 3)
+                _mm_storeu_si128((__m128i*)(dst + factor - 4), c);
+        }
+    }
+
+    ReplicateScalar(dst, src + i, count - i, factor);
+}
+
+// Ors together the differences of 16 pixels at a time, so the loop only branches once
+// per block rather than once per vector.
+PIXIE_TARGET_SSE2
+static bool EqualSSE2(const uint32_t* a, const uint32_t* b, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for ( ; i + 16 <= count; i += 16)
+    {
+        __m128i d0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i d1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 4)), _mm_loadu_si128((const __m128i*)(b + i + 4)));
+        __m128i d2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 8)), _mm_loadu_si128((const __m128i*)(b + i + 8)));
+        __m128i d3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i + 12)), _mm_loadu_si128((const __m128i*)(b + i + 12)));
+        __m128i d = _mm_or_si128(_mm_or_si128(d0, d1), _mm_or_si128(d2, d3));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(d, zero)) != 0xffff)
+            return false;
+    }
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(d, zero)) != 0xffff)
+            return false;
+    }
+
+    return EqualScalar(a + i, b + i, count - i);
+}
+
+//
+// AVX2 kernels. Eight mask bits are expanded to eight 32-bit lanes at a time. Full
+// groups blend with the destination, which is faster than a masked store on most
+// CPUs. The row tail uses a masked store; the mask bits past count are clear, so no
+// separate tail mask is needed and a 9-pixel glyph row is one blend plus one store.
+//
+
+PIXIE_TARGET_AVX2
+static inline __m256i ExpandMaskAVX2(uint64_t mask)
+{
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i bits = _mm256_and_si256(_mm256_set1_epi32((int)(mask & 0xff)), laneBits);
+    return _mm256_cmpeq_epi32(bits, laneBits);
+}
+
+PIXIE_TARGET_AVX2
+static void CopyMaskedAVX2(uint32_t* dst, const uint32_t* src, uint64_t mask, int count)
+{
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8, mask >>= 8)
+    {
+        if (!(mask & 0xff))
+            continue;
+
+        __m256i m = ExpandMaskAVX2(mask);
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(d, s, m));
+    }
+
+    if (mask)
+    {
+        __m256i m = ExpandMaskAVX2(mask);
+        __m256i s = _mm256_maskload_epi32((const int*)(src + i), m);
+        _mm256_maskstore_epi32((int*)(dst + i), m, s);
+    }
+}
+
+PIXIE_TARGET_AVX2
+static void FillMaskedAVX2(uint32_t* dst, uint64_t mask, int count, uint32_t colour)
+{
+    const __m256i c = _mm256_set1_epi32(colour);
+
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8, mask >>= 8)
+    {
+        if (!(mask & 0xff))
+            continue;
+
+        __m256i m = ExpandMaskAVX2(mask);
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(d, c, m));
+    }
+
+    if (mask)
+        _mm256_maskstore_epi32((int*)(dst + i), ExpandMaskAVX2(mask), c);
+}
+
+PIXIE_TARGET_AVX2
+static void FillAVX2(uint32_t* dst, int count, uint32_t colour)
+{
+    const __m256i c = _mm256_set1_epi32(colour);
+
+    // Short spans such as rectangle borders are not worth setting up for.
+    if (count < 8)
+    {
+        FillScalar(dst, count, colour);
+        return;
+    }
+
+    // Write the unaligned head with one unaligned store, then align the destination
+    // so the main loop uses aligned stores.
+    _mm256_storeu_si256((__m256i*)dst, c);
+    int i = (int)((32 - ((uintptr_t)dst & 31)) & 31) >> 2;
+
+    for ( ; i + 32 <= count; i += 32)
+    {
+        _mm256_store_si256((__m256i*)(dst + i), c);
+        _mm256_store_si256((__m256i*)(dst + i + 8), c);
+        _mm256_store_si256((__m256i*)(dst + i + 16), c);
+        _mm256_store_si256((__m256i*)(dst + i + 24), c);
+    }
+
+    for ( ; i + 8 <= count; i += 8)
+        _mm256_store_si256((__m256i*)(dst + i), c);
+
+    // Finish with one unaligned store that overlaps the last full group.
+    if (i < count)
+        _mm256_storeu_si256((__m256i*)(dst + count - 8), c);
+}
+
+PIXIE_TARGET_AVX2
+static inline __m256i MulDiv255AVX2(__m256i a, __m256i b)
+{
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(a, b), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+// Blends eight pixels, as BlendSSE2. The unpacks and pack work within each 128-bit
+// lane, so the pixels come back out in the order they went in.
+PIXIE_TARGET_AVX2
+static inline __m256i BlendAVX2(__m256i d, __m256i factor, __m256i add)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), factor);
+    __m256i hi = MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), factor);
+    return _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), add);
+}
+
+PIXIE_TARGET_AVX2
+static inline __m256i BlendCoverageWidenedAVX2(__m256i d, __m256i coverage, __m256i inverseFactor, __m256i add)
+{
+    __m256i f = _mm256_sub_epi16(_mm256_set1_epi16(255), MulDiv255AVX2(inverseFactor, coverage));
+    return _mm256_add_epi16(MulDiv255AVX2(d, f), MulDiv255AVX2(add, coverage));
+}
+
+PIXIE_TARGET_AVX2
+static void BlendFillAVX2(uint32_t* dst, int count, Blend blend)
+{
+    const __m256i f = _mm256_unpacklo_epi8(_mm256_set1_epi32(blend.factor), _mm256_setzero_si256());
+    const __m256i a = _mm256_set1_epi32(blend.add);
+
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), BlendAVX2(d, f, a));
+    }
+
+    // Blend the tail with a masked load and store.
+    if (i < count)
+    {
+        __m256i m = ExpandMaskAVX2(((uint64_t)1 << (count - i)) - 1);
+        __m256i d = _mm256_maskload_epi32((const int*)(dst + i), m);
+        _mm256_maskstore_epi32((int*)(dst + i), m, BlendAVX2(d, f, a));
+    }
+}
+
+PIXIE_TARGET_AVX2
+static void BlendFillMaskedAVX2(uint32_t* dst, uint64_t mask, int count, Blend blend)
+{
+    const __m256i f = _mm256_unpacklo_epi8(_mm256_set1_epi32(blend.factor), _mm256_setzero_si256());
+    const __m256i a = _mm256_set1_epi32(blend.add);
+
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8, mask >>= 8)
+    {
+        if (!(mask & 0xff))
+            continue;
+
+        __m256i m = ExpandMaskAVX2(mask);
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(d, BlendAVX2(d, f, a), m));
+    }
+
+    if (mask)
+    {
+        __m256i m = ExpandMaskAVX2(mask);
+        __m256i d = _mm256_maskload_epi32((const int*)(dst + i), m);
+        _mm256_maskstore_epi32((int*)(dst + i), m, BlendAVX2(d, f, a));
+    }
+}
+
+// Blends eight pixels with the coverage in the eight bytes of c8.
+PIXIE_TARGET_AVX2
+static inline __m256i BlendCoverage8AVX2(__m256i d, uint64_t c8, __m256i inverseFactor, __m256i add)
+{
+    // Widen each pixel's coverage to 32 bits and copy it into all four bytes.
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i c = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&c8)), _mm256_set1_epi32(0x01010101));
+
+    __m256i lo = BlendCoverageWidenedAVX2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(c, zero), inverseFactor, add);
+    __m256i hi = BlendCoverageWidenedAVX2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(c, zero), inverseFactor, add);
+    return _mm256_packus_epi16(lo, hi);
+}
+
+PIXIE_TARGET_AVX2
+static void BlendCoverageAVX2(uint32_t* dst, const uint8_t* coverage, int count, Blend blend)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i inverseFactor = _mm256_unpacklo_epi8(_mm256_set1_epi32(~blend.factor), zero);
+    const __m256i add = _mm256_unpacklo_epi8(_mm256_set1_epi32(blend.add), zero);
+
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8)
+    {
+        uint64_t c8;
+        memcpy(&c8, coverage + i, sizeof(c8));
+        if (!c8)
+            continue;
+
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), BlendCoverage8AVX2(d, c8, inverseFactor, add));
+    }
+
+    // Glyph rows are short, so the last few pixels are masked rather than done a pixel
+    // at a time. The unused lanes have no coverage.
+    int remaining = count - i;
+    if (remaining > 0)
+    {
+        uint64_t c8 = 0;
+        memcpy(&c8, coverage + i, remaining);
+        __m256i m = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i d = _mm256_maskload_epi32((const int*)(dst + i), m);
+        _mm256_maskstore_epi32((int*)(dst + i), m, BlendCoverage8AVX2(d, c8, inverseFactor, add));
+    }
+}
+
+PIXIE_TARGET_AVX2
+static void ExpandBGRAVX2(uint32_t* dst, const uint8_t* src, int count)
+{
+    // Byte shuffles don't cross the 128-bit lanes, so first move the 12 bytes of pixels
+    // 4-7 up into the high lane. Each 32-byte load takes eight pixels, so stop while
+    // there are still three pixels past them to load safely.
+    const __m256i permute = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+
+    int i = 0;
+    for ( ; i + 11 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + (i * 3)));
+        v = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(v, permute), shuffle);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(v, alpha));
+    }
+
+    ExpandBGRSSE2(dst + i, src + (i * 3), count - i);
+}
+
+PIXIE_TARGET_AVX2
+static void CopyKeyedAVX2(uint32_t* dst, const uint32_t* src, int count, uint32_t key)
+{
+    const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+    const __m256i k = _mm256_set1_epi32((int)(key & 0xffffff));
+
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i keyed = _mm256_cmpeq_epi32(_mm256_and_si256(s, rgb), k);
+        if (_mm256_movemask_epi8(keyed) == -1)
+            continue;
+
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(s, d, keyed));
+    }
+
+    // The tail is a masked store of the pixels that aren't keyed.
+    int remaining = count - i;
+    if (remaining > 0)
+    {
+        __m256i inRow = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i s = _mm256_maskload_epi32((const int*)(src + i), inRow);
+        __m256i keyed = _mm256_cmpeq_epi32(_mm256_and_si256(s, rgb), k);
+        _mm256_maskstore_epi32((int*)(dst + i), _mm256_andnot_si256(keyed, inRow), s);
+    }
+}
+
+// Blends eight pixels, as BlendAlpha4SSE2.
+PIXIE_TARGET_AVX2
+static inline __m256i BlendAlpha8AVX2(__m256i d, __m256i s)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i maxAlpha = _mm256_set1_epi16(255);
+
+    __m256i sLo = _mm256_unpacklo_epi8(s, zero);
+    __m256i sHi = _mm256_unpackhi_epi8(s, zero);
+    __m256i aLo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sLo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i aHi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(sHi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m256i lo = _mm256_add_epi16(MulDiv255AVX2(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(maxAlpha, aLo)), MulDiv255AVX2(sLo, aLo));
+    __m256i hi = _mm256_add_epi16(MulDiv255AVX2(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(maxAlpha, aHi)), MulDiv255AVX2(sHi, aHi));
+
+    const __m256i top = _mm256_set1_epi32((int)0xff000000);
+    return _mm256_or_si256(_mm256_andnot_si256(top, _mm256_packus_epi16(lo, hi)), _mm256_and_si256(top, d));
+}
+
+PIXIE_TARGET_AVX2
+static void BlendAlphaAVX2(uint32_t* dst, const uint32_t* src, int count)
+{
+    const __m256i top = _mm256_set1_epi32((int)0xff000000);
+
+    int i = 0;
+    for ( ; i + 8 <= count; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_testz_si256(s, top))
+            continue;
+
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), BlendAlpha8AVX2(d, s));
+    }
+
+    int remaining = count - i;
+    if (remaining > 0)
+    {
+        __m256i inRow = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256i s = _mm256_maskload_epi32((const int*)(src + i), inRow);
+        __m256i d = _mm256_maskload_epi32((const int*)(dst + i), inRow);
+        _mm256_maskstore_epi32((int*)(dst + i), inRow, BlendAlpha8AVX2(d, s));
+    }
+}
+
+PIXIE_TARGET_AVX2
+static inline __m256i LoadPairsAVX2(const uint32_t* row, const int* columns)
+{
+    __m128i ab = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(row + columns[0])), _mm_loadl_epi64((const __m128i*)(row + columns[1])));
+    __m128i cd = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(row + columns[2])), _mm_loadl_epi64((const __m128i*)(row + columns[3])));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(ab), cd, 1);
+}
+
+// As LerpPairsSSE2, with A and B in the low lane and C and D in the high lane.
+PIXIE_TARGET_AVX2
+static inline __m256i LerpPairsAVX2(__m256i pixels, __m256i weightsAC, __m256i weightsBD)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i ac = _mm256_mullo_epi16(_mm256_unpacklo_epi8(pixels, zero), weightsAC);
+    __m256i bd = _mm256_mullo_epi16(_mm256_unpackhi_epi8(pixels, zero), weightsBD);
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(ac, bd), _mm256_unpackhi_epi64(ac, bd)), 8);
+}
+
+PIXIE_TARGET_AVX2
+static void BilinearRowAVX2(uint32_t* dst, const uint32_t* row0, const uint32_t* row1, const int* columns, const uint32_t* weights, int count, uint32_t weightY)
+{
+    __m256i weightTop = _mm256_set1_epi16((short)(256 - weightY));
+    __m256i weightBottom = _mm256_set1_epi16((short)weightY);
+
+    int i = 0;
+    for ( ; i + 4 <= count; i += 4)
+    {
+        __m128i w = _mm_loadu_si128((const __m128i*)(weights + i));
+        __m128i ab = _mm_unpacklo_epi16(w, w);
+        __m128i cd = _mm_unpackhi_epi16(w, w);
+        __m256i weightsAC = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi32(ab, ab)), _mm_unpacklo_epi32(cd, cd), 1);
+        __m256i weightsBD = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpackhi_epi32(ab, ab)), _mm_unpackhi_epi32(cd, cd), 1);
+
+        __m256i top = LerpPairsAVX2(LoadPairsAVX2(row0, columns + i), weightsAC, weightsBD);
+        __m256i bottom = LerpPairsAVX2(LoadPairsAVX2(row1, columns + i), weightsAC, weightsBD);
+        __m256i v = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(top, weightTop), _mm256_mullo_epi16(bottom, weightBottom)), 8);
+
+        // Packing leaves A B in the low lane and C D in the high lane.
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(v));
+    }
+
+    BilinearRowSSE2(dst + i, row0, row1, columns + i, weights + i, count - i, weightY);
+}
+
+PIXIE_TARGET_AVX2
+static void ReplicateAVX2(uint32_t* dst, const uint32_t* src, int count, int factor)
+{
+    int i = 0;
+    if (factor <= 8)
+    {
+        // Eight source pixels make factor output vectors, each a permute of the eight.
+        __m256i indices[8];
+        for (int k = 0; k < factor; k++)
+        {
+            int lanes[8];
+            for (int j = 0; j < 8; j++)
+                lanes[j] = ((k * 8) + j) / factor;
+            indices[k] = _mm256_loadu_si256((const __m256i*)lanes);
+        }
+
+        for ( ; i + 8 <= count; i += 8, dst += factor * 8)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+            for (int k = 0; k < factor; k++)
+                _mm256_storeu_si256((__m256i*)(dst + (k * 8)), _mm256_permutevar8x32_epi32(v, indices[k]));
+        }
+    }
+    else
+    {
+        for ( ; i < count; i++, dst += factor)
+        {
+            __m256i c = _mm256_set1_epi32((int)src[i]);
+            for (int j = 0; j + 8 <= factor; j += 8)
+                _mm256_storeu_si256((__m256i*)(dst + j), c);
+            if (factor & 7)
+                _mm256_storeu_si256((__m256i*)(dst + factor - 8), c);
+        }
+    }
+
+    ReplicateSSE2(dst, src + i, count - i, factor);
+}
+
+PIXIE_TARGET_AVX2
+static bool EqualAVX2(const uint32_t* a, const uint32_t* b, int count)
+{
+    int i = 0;
+    for ( ; i + 16 <= count; i += 16)
+    {
+        __m256i d0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        __m256i d1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 8)), _mm256_loadu_si256((const __m256i*)(b + i + 8)));
+        __m256i d = _mm256_or_si256(d0, d1);
+        if (!_mm256_testz_si256(d, d))
+            return false;
+    }
+
+    return EqualSSE2(a + i, b + i, count - i);
+}
+
+//
+// CPU feature detection.
+//
+
+static void CpuId(int leaf, int subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    __cpuidex((int*)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t XGetBV(uint32_t index)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(index);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static Level DetectLevel()
+{
+    uint32_t regs[4];
+    CpuId(0, 0, regs);
+    uint32_t maxLeaf = regs[0];
+
+    CpuId(1, 0, regs);
+    bool sse2 = (regs[3] & (1 << 26)) != 0;
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    if (!sse2)
+        return Level_Scalar;
+
+    // AVX2 needs the OS to save the YMM registers as well as the CPU supporting it.
+    if (maxLeaf >= 7 && osxsave && avx && (XGetBV(0) & 6) == 6)
+    {
+        CpuId(7, 0, regs);
+        if (regs[1] & (1 << 5))
+            return Level_AVX2;
+    }
+
+    return Level_SSE2;
+}
+
+#else
+
+static Level DetectLevel()
+{
+    return Level_Scalar;
+}
+
+#endif
+
+static const Kernels s_kernels[Level_Num] =
+{
+    { CopyMaskedScalar, FillMaskedScalar, FillScalar, BlendFillScalar, BlendFillMaskedScalar, BlendCoverageScalar, ExpandBGRScalar, CopyKeyedScalar, BlendAlphaScalar, ReplicateScalar, BilinearRowScalar, EqualScalar },
+#if PIXIE_SIMD_X86
+    { CopyMaskedSSE2, FillMaskedSSE2, FillSSE2, BlendFillSSE2, BlendFillMaskedSSE2, BlendCoverageSSE2, ExpandBGRSSE2, CopyKeyedSSE2, BlendAlphaSSE2, ReplicateSSE2, BilinearRowSSE2, EqualSSE2 },
+    { CopyMaskedAVX2, FillMaskedAVX2, FillAVX2, BlendFillAVX2, BlendFillMaskedAVX2, BlendCoverageAVX2, ExpandBGRAVX2, CopyKeyedAVX2, BlendAlphaAVX2, ReplicateAVX2, BilinearRowAVX2, EqualAVX2 },
+#else
+    { CopyMaskedScalar, FillMaskedScalar, FillScalar, BlendFillScalar, BlendFillMaskedScalar, BlendCoverageScalar, ExpandBGRScalar, CopyKeyedScalar, BlendAlphaScalar, ReplicateScalar, BilinearRowScalar, EqualScalar },
+    { CopyMaskedScalar, FillMaskedScalar, FillScalar, BlendFillScalar, BlendFillMaskedScalar, BlendCoverageScalar, ExpandBGRScalar, CopyKeyedScalar, BlendAlphaScalar, ReplicateScalar, BilinearRowScalar, EqualScalar },
+#endif
+};
+
+// The level in use, or Level_Num until GetLevel first picks the supported one. Job
+// workers read it through GetKernels, so it is atomic.
+static std::atomic<Level> s_level(Level_Num);
+
+Blend Simd::MakeBlend(uint32_t colour, BlendMode mode)
+{
+    assert(mode > BlendMode_Opaque && mode < BlendMode_Num);
+
+    // The factors are packed a byte per channel like a pixel, with a factor of 255 and
+    // an add of 0 for the top byte so that it's left alone.
+    Blend blend;
+    blend.factor = 0xff000000;
+    blend.add = 0;
+
+    uint32_t alpha = colour >> 24;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        // Premultiply, rounding to nearest.
+        uint32_t t = (((colour >> shift) & 0xff) * alpha) + 128;
+        uint32_t premultiplied = (t + (t >> 8)) >> 8;
+
+        // Against an opaque destination, src-over is dst * (1 - alpha) + premultiplied,
+        // additive is dst + premultiplied and multiply is dst * (premultiplied + 1 - alpha).
+        uint32_t factor = 0, add = 0;
+        switch (mode)
+        {
+            case BlendMode_SrcOver:
+                factor = 255 - alpha;
+                add = premultiplied;
+                break;
+            case BlendMode_Additive:
+                factor = 255;
+                add = premultiplied;
+                break;
+            case BlendMode_Multiply:
+                factor = premultiplied + 255 - alpha;
+                break;
+            default:
+                break;
+        }
+
+        blend.factor |= factor << shift;
+        blend.add |= add << shift;
+    }
+
+    return blend;
+}
+
+Level Simd::GetSupportedLevel()
+{
+    static const Level supported = DetectLevel();
+    return supported;
+}
+
+Level Simd::GetLevel()
+{
+    Level level = s_level.load(std::memory_order_relaxed);
+    if (level == Level_Num)
+    {
+        // Only replaces the default, so a SetLevel on another thread isn't undone.
+        Level supported = GetSupportedLevel();
+        if (s_level.compare_exchange_strong(level, supported, std::memory_order_relaxed))
+            level = supported;
+    }
+    return level;
+}
+
+void Simd::SetLevel(Level level)
+{
+    Level supported = GetSupportedLevel();
+    s_level.store(level > supported ? supported : level, std::memory_order_relaxed);
+}
+
+const Kernels& Simd::GetKernels()
+{
+    return s_kernels[GetLevel()];
+}
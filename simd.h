@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include "core.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXIE_SIMD_X86 1
+#endif
+
+namespace Pixie
+{
+    // Row kernels used by the drawing code. Each kernel has a scalar version and, on x86,
+    // SSE2 and AVX2 versions. The best version the CPU supports is selected at runtime.
+    namespace Simd
+    {
+        enum Level
+        {
+            Level_Scalar = 0,
+            Level_SSE2,
+            Level_AVX2,
+            Level_Num
+        };
+
+        // A colour and blend mode prepared for the blend kernels by MakeBlend. Every blend
+        // mode works out as dst * factor / 255 + add for each channel, saturated.
+        struct Blend
+        {
+            uint32_t factor;
+            uint32_t add;
+        };
+
+        struct Kernels
+        {
+            // Copies each of count pixels from src to dst if its bit in mask is set.
+            // Bit n of mask corresponds to pixel n, and bits at or above count must be clear.
+            void (*copyMasked)(uint32_t* dst, const uint32_t* src, uint64_t mask, int count);
+
+            // Writes colour to each of count pixels in dst if its bit in mask is set.
+            void (*fillMasked)(uint32_t* dst, uint64_t mask, int count, uint32_t colour);
+
+            // Writes colour to count pixels in dst.
+            void (*fill)(uint32_t* dst, int count, uint32_t colour);
+
+            // Blends a colour into count pixels in dst. The top byte of each pixel is left
+            // alone.
+            void (*blendFill)(uint32_t* dst, int count, Blend blend);
+
+            // Blends a colour into each of count pixels in dst if its bit in mask is set.
+            void (*blendFillMasked)(uint32_t* dst, uint64_t mask, int count, Blend blend);
+
+            // Blends a colour into count pixels in dst, scaling its effect on each pixel by
+            // the pixel's 8-bit coverage. A coverage of 255 is the same as blendFill.
+            void (*blendCoverage)(uint32_t* dst, const uint8_t* coverage, int count, Blend blend);
+
+            // Converts count 24-bit pixels stored as blue, green and red bytes, as in BMP
+            // files, to 32-bit pixels in dst with an alpha of 255.
+            void (*expandBGR)(uint32_t* dst, const uint8_t* src, int count);
+
+            // Copies each of count pixels from src to dst unless its colour, ignoring the top
+            // byte, is key.
+            void (*copyKeyed)(uint32_t* dst, const uint32_t* src, int count, uint32_t key);
+
+            // Blends count pixels from src into dst by each source pixel's alpha, as
+            // BlendMode_SrcOver does with a colour. The top byte of each pixel is left alone.
+            void (*blendAlpha)(uint32_t* dst, const uint32_t* src, int count);
+
+            // Writes each of count pixels from src factor times in a row to dst, which has
+            // room for count * factor pixels.
+            void (*replicate)(uint32_t* dst, const uint32_t* src, int count, int factor);
+
+            // Writes count bilinear filtered pixels to dst. Pixel i blends the pixels at
+            // columns[i] and the one after it in row0, weighted by the low and high 16 bits
+            // of weights[i], which add up to 256, then blends that with the same in row1 by
+            // weightY out of 256.
+            void (*bilinearRow)(uint32_t* dst, const uint32_t* row0, const uint32_t* row1, const int* columns, const uint32_t* weights, int count, uint32_t weightY);
+
+            // Returns true if count pixels of a and b are the same.
+            bool (*equal)(const uint32_t* a, const uint32_t* b, int count);
+        };
+
+        // Premultiplies an ARGB colour by its alpha and works out the factors for the blend
+        // mode, which must not be BlendMode_Opaque.
+        Blend MakeBlend(uint32_t colour, BlendMode mode);
+
+        // Returns the best instruction set level supported by this CPU.
+        Level GetSupportedLevel();
+
+        // Returns the instruction set level currently in use.
+        Level GetLevel();
+
+        // Forces the kernels to the given level, clamped to what the CPU supports.
+        // Useful for verifying and benchmarking the SIMD kernels against the scalar ones.
+        void SetLevel(Level level);
+
+        // Returns the kernels for the current level.
+        const Kernels& GetKernels();
+    }
+}
@@ -0,0 +1,890 @@
+#include "stream.h"
+#include "simd.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#if PIXIE_PLATFORM_WIN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
+
+using namespace Pixie;
+
+//
+// The stream starts with a header of the magic, version, width, height and tile size.
+// Each frame follows as its number of tiles and their size in bytes, then each tile as
+// its column and row in tiles, encoding and size, then its pixels. All values are little
+// endian. Tiles on the right and bottom edges are cut off at the edge of the frame.
+//
+
+static const uint8_t StreamMagic[4] = { 'P', 'X', 'S', 'T' };
+static const uint32_t StreamVersion = 1;
+static const size_t StreamHeaderSize = 20;
+static const size_t FrameHeaderSize = 8;
+static const size_t TileHeaderSize = 9;
+
+enum TileEncoding
+{
+    TileEncoding_Raw = 0,   // The tile's pixels, row by row.
+    TileEncoding_Runs,      // Runs of the same pixel as a 16-bit count and the pixel.
+};
+
+static const size_t RunSize = 6;
+
+static void WriteU16(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static void WriteU32(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t ReadU16(const uint8_t* data)
+{
+    return data[0] | ((uint32_t)data[1] << 8);
+}
+
+static uint32_t ReadU32(const uint8_t* data)
+{
+    return data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+//
+// A thin layer over BSD sockets and Winsock.
+//
+
+#if PIXIE_PLATFORM_WIN
+typedef SOCKET Socket;
+static const Socket NoSocket = INVALID_SOCKET;
+
+static bool InitSockets()
+{
+    WSADATA data;
+    return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+static void ShutdownSockets()
+{
+    WSACleanup();
+}
+
+static void CloseSocket(Socket s)
+{
+    closesocket(s);
+}
+
+// Stops sends and receives on the socket, which wakes a thread blocked in one.
+static void ShutdownSocket(Socket s)
+{
+    shutdown(s, SD_BOTH);
+}
+
+static void SetNonBlocking(Socket s, bool nonBlocking)
+{
+    u_long mode = nonBlocking ? 1 : 0;
+    ioctlsocket(s, FIONBIO, &mode);
+}
+
+static bool WaitReadable(Socket s, int timeoutMs)
+{
+    WSAPOLLFD fd = { s, POLLRDNORM, 0 };
+    return WSAPoll(&fd, 1, timeoutMs) > 0;
+}
+
+static int SendSome(Socket s, const uint8_t* data, size_t size)
+{
+    return send(s, (const char*)data, (int)(size < 0x40000000 ? size : 0x40000000), 0);
+}
+
+static int ReceiveSome(Socket s, uint8_t* data, size_t size)
+{
+    return recv(s, (char*)data, (int)(size < 0x40000000 ? size : 0x40000000), 0);
+}
+#else
+typedef int Socket;
+static const Socket NoSocket = -1;
+
+static bool InitSockets()
+{
+    return true;
+}
+
+static void ShutdownSockets()
+{
+}
+
+static void CloseSocket(Socket s)
+{
+    close(s);
+}
+
+// Stops sends and receives on the socket, which wakes a thread blocked in one.
+static void ShutdownSocket(Socket s)
+{
+    shutdown(s, SHUT_RDWR);
+}
+
+static void SetNonBlocking(Socket s, bool nonBlocking)
+{
+    int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, nonBlocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+static bool WaitReadable(Socket s, int timeoutMs)
+{
+    pollfd fd = { s, POLLIN, 0 };
+    return poll(&fd, 1, timeoutMs) > 0;
+}
+
+// A viewer that goes away mustn't kill the app with SIGPIPE.
+static int SendSome(Socket s, const uint8_t* data, size_t size)
+{
+#ifdef MSG_NOSIGNAL
+    return (int)send(s, data, size, MSG_NOSIGNAL);
+#else
+    return (int)send(s, data, size, 0);
+#endif
+}
+
+static int ReceiveSome(Socket s, uint8_t* data, size_t size)
+{
+    return (int)recv(s, data, size, 0);
+}
+#endif
+
+static bool SendAll(Socket s, const uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+        int sent = SendSome(s, data, size);
+        if (sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Works out the socket address for an address string, as described in stream.h.
+static bool ResolveAddress(const char* address, sockaddr_storage& storage, socklen_t& size)
+{
+    memset(&storage, 0, sizeof(storage));
+
+#if !PIXIE_PLATFORM_WIN
+    if (strncmp(address, "unix:", 5) == 0)
+    {
+        sockaddr_un* addr = (sockaddr_un*)&storage;
+        const char* path = address + 5;
+        if (strlen(path) >= sizeof(addr->sun_path))
+            return false;
+
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+        size = sizeof(sockaddr_un);
+        return true;
+    }
+#endif
+
+    char host[256] = "127.0.0.1";
+    const char* port = strrchr(address, ':');
+    if (port)
+    {
+        size_t length = port - address;
+        if (length >= sizeof(host))
+            return false;
+        memcpy(host, address, length);
+        host[length] = 0;
+        port++;
+    }
+    else
+    {
+        port = address;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = 0;
+    if (getaddrinfo(host, port, &hints, &result) != 0 || !result)
+        return false;
+
+    memcpy(&storage, result->ai_addr, result->ai_addrlen);
+    size = (socklen_t)result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+static Socket OpenSocket(const sockaddr_storage& storage)
+{
+    Socket s = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (s == NoSocket)
+        return NoSocket;
+
+#ifdef SO_NOSIGPIPE
+    int noSigPipe = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, (const char*)&noSigPipe, sizeof(noSigPipe));
+#endif
+    return s;
+}
+
+// Sends each write as soon as it's made, rather than waiting to fill a packet.
+static void SetNoDelay(Socket s, const sockaddr_storage& storage)
+{
+    if (storage.ss_family != AF_INET)
+        return;
+
+    int noDelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+}
+
+//
+// FrameStreamer
+//
+
+// State shared between Capture and the sender thread.
+struct FrameStreamer::State
+{
+    std::thread sender;
+    std::mutex lock;
+    std::condition_variable captured;
+    bool hasPending;
+    bool quit;
+    bool streaming;
+
+    // Only the sender changes the viewer, under the lock so that Stop can shut it down.
+    Socket listener;
+    Socket viewer;
+    sockaddr_storage address;
+    std::atomic<bool> connected;
+
+    std::atomic<uint64_t> sentFrames;
+    std::atomic<uint64_t> skippedFrames;
+    std::atomic<uint64_t> sentTiles;
+    std::atomic<uint64_t> sentBytes;
+};
+
+FrameStreamer::FrameStreamer()
+{
+    m_state = new State;
+    m_state->hasPending = false;
+    m_state->quit = false;
+    m_state->streaming = false;
+    m_state->listener = NoSocket;
+    m_state->viewer = NoSocket;
+    m_state->connected = false;
+    m_state->sentFrames = 0;
+    m_state->skippedFrames = 0;
+    m_state->sentTiles = 0;
+    m_state->sentBytes = 0;
+
+    m_width = 0;
+    m_height = 0;
+    m_tileSize = 0;
+    m_back = 0;
+    m_pending = 0;
+    m_current = 0;
+    m_previous = 0;
+    m_message = 0;
+}
+
+FrameStreamer::~FrameStreamer()
+{
+    Stop();
+    delete m_state;
+}
+
+bool FrameStreamer::Start(const char* address, int width, int height, int tileSize /*= 16*/)
+{
+    Stop();
+    if (width <= 0 || height <= 0 || width > MaxSize || height > MaxSize || tileSize < MinTileSize || tileSize > MaxTileSize)
+        return false;
+    if (!InitSockets())
+        return false;
+
+    State* state = m_state;
+    socklen_t size;
+    if (!ResolveAddress(address, state->address, size))
+    {
+        ShutdownSockets();
+        return false;
+    }
+
+#if !PIXIE_PLATFORM_WIN
+    // A socket file left by a run that didn't stop cleanly would stop bind working.
+    if (state->address.ss_family == AF_UNIX)
+        unlink(((sockaddr_un*)&state->address)->sun_path);
+#endif
+
+    state->listener = OpenSocket(state->address);
+    if (state->listener == NoSocket)
+    {
+        ShutdownSockets();
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(state->listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    if (bind(state->listener, (const sockaddr*)&state->address, size) != 0 || listen(state->listener, 1) != 0)
+    {
+        CloseSocket(state->listener);
+        state->listener = NoSocket;
+        ShutdownSockets();
+        return false;
+    }
+
+    // The sender checks for a viewer each frame, so accepting mustn't wait for one.
+    SetNonBlocking(state->listener, true);
+
+    m_width = width;
+    m_height = height;
+    m_tileSize = tileSize;
+    size_t pixels = (size_t)width * height;
+    m_back = new uint32_t[pixels];
+    m_pending = new uint32_t[pixels];
+    m_current = new uint32_t[pixels];
+    m_previous = new uint32_t[pixels];
+
+    // Tiles are only run length encoded when that's smaller, so a frame is never more
+    // than its pixels plus the headers.
+    size_t numTiles = (size_t)((width + tileSize - 1) / tileSize) * ((height + tileSize - 1) / tileSize);
+    m_message = new uint8_t[FrameHeaderSize + (numTiles * TileHeaderSize) + (pixels * sizeof(uint32_t))];
+
+    state->hasPending = false;
+    state->quit = false;
+    state->streaming = true;
+    state->sentFrames = 0;
+    state->skippedFrames = 0;
+    state->sentTiles = 0;
+    state->sentBytes = 0;
+    state->sender = std::thread(SenderMain, this);
+    return true;
+}
+
+void FrameStreamer::Stop()
+{
+    State* state = m_state;
+    if (!state->streaming)
+        return;
+
+    // A viewer that has stopped reading leaves the sender waiting to send to it, so its
+    // socket is shut down to wake the sender.
+    {
+        std::lock_guard<std::mutex> lock(state->lock);
+        state->quit = true;
+        if (state->viewer != NoSocket)
+            ShutdownSocket(state->viewer);
+    }
+    state->captured.notify_one();
+    state->sender.join();
+
+    if (state->viewer != NoSocket)
+        CloseSocket(state->viewer);
+    CloseSocket(state->listener);
+    state->viewer = NoSocket;
+    state->listener = NoSocket;
+    state->connected = false;
+#if !PIXIE_PLATFORM_WIN
+    if (state->address.ss_family == AF_UNIX)
+        unlink(((sockaddr_un*)&state->address)->sun_path);
+#endif
+    ShutdownSockets();
+
+    delete[] m_back;
+    delete[] m_pending;
+    delete[] m_current;
+    delete[] m_previous;
+    delete[] m_message;
+    m_back = m_pending = m_current = m_previous = 0;
+    m_message = 0;
+    state->streaming = false;
+}
+
+bool FrameStreamer::IsStreaming() const
+{
+    return m_state->streaming;
+}
+
+bool FrameStreamer::IsConnected() const
+{
+    return m_state->connected;
+}
+
+bool FrameStreamer::Capture(const Surface& surface)
+{
+    PIXIE_PROFILE_ZONE("FrameStreamer::Capture");
+    State* state = m_state;
+    if (!state->streaming || surface.GetWidth() != m_width || surface.GetHeight() != m_height || !surface.GetPixels())
+        return false;
+
+    size_t rowBytes = m_width * sizeof(uint32_t);
+    for (int y = 0; y < m_height; y++)
+        memcpy(m_back + (size_t)y * m_width, surface.GetRow(y), rowBytes);
+
+    {
+        std::lock_guard<std::mutex> lock(state->lock);
+        uint32_t* pending = m_pending;
+        m_pending = m_back;
+        m_back = pending;
+        if (state->hasPending)
+            state->skippedFrames++;
+        state->hasPending = true;
+    }
+    state->captured.notify_one();
+    return true;
+}
+
+uint64_t FrameStreamer::GetSentFrames() const
+{
+    return m_state->sentFrames;
+}
+
+uint64_t FrameStreamer::GetSkippedFrames() const
+{
+    return m_state->skippedFrames;
+}
+
+uint64_t FrameStreamer::GetSentTiles() const
+{
+    return m_state->sentTiles;
+}
+
+uint64_t FrameStreamer::GetSentBytes() const
+{
+    return m_state->sentBytes;
+}
+
+void FrameStreamer::SenderMain(FrameStreamer* streamer)
+{
+    State* state = streamer->m_state;
+    bool wholeFrame = true;
+    for (;;)
+    {
+        // Wake up now and then without a frame to pick up a viewer anyway.
+        bool hasFrame;
+        {
+            std::unique_lock<std::mutex> lock(state->lock);
+            state->captured.wait_for(lock, std::chrono::milliseconds(100), [state] { return state->hasPending || state->quit; });
+            if (state->quit)
+                break;
+
+            hasFrame = state->hasPending;
+            if (hasFrame)
+            {
+                uint32_t* current = streamer->m_current;
+                streamer->m_current = streamer->m_pending;
+                streamer->m_pending = current;
+                state->hasPending = false;
+            }
+        }
+
+        if (state->viewer == NoSocket)
+        {
+            Socket viewer = accept(state->listener, 0, 0);
+            if (viewer != NoSocket)
+            {
+                // Sockets accepted from a non-blocking listener are non-blocking on some
+                // platforms, but the sender wants to wait until each frame is sent.
+                SetNonBlocking(viewer, false);
+                SetNoDelay(viewer, state->address);
+
+                uint8_t header[StreamHeaderSize];
+                memcpy(header, StreamMagic, sizeof(StreamMagic));
+                WriteU32(header + 4, StreamVersion);
+                WriteU32(header + 8, (uint32_t)streamer->m_width);
+                WriteU32(header + 12, (uint32_t)streamer->m_height);
+                WriteU32(header + 16, (uint32_t)streamer->m_tileSize);
+                bool accepted = SendAll(viewer, header, sizeof(header));
+                if (accepted)
+                {
+                    // Stop may have been called since the sender woke, too soon to shut
+                    // this viewer down.
+                    std::lock_guard<std::mutex> lock(state->lock);
+                    accepted = !state->quit;
+                    if (accepted)
+                        state->viewer = viewer;
+                }
+
+                if (accepted)
+                {
+                    state->connected = true;
+                    wholeFrame = true;
+                }
+                else
+                {
+                    CloseSocket(viewer);
+                }
+            }
+        }
+
+        if (!hasFrame)
+            continue;
+
+        if (state->viewer != NoSocket)
+        {
+            size_t size = streamer->EncodeFrame(wholeFrame);
+            if (size > 0)
+            {
+                PIXIE_PROFILE_ZONE("FrameStreamer::Send");
+                if (SendAll(state->viewer, streamer->m_message, size))
+                {
+                    state->sentFrames++;
+                    state->sentBytes += size;
+                    wholeFrame = false;
+                }
+                else
+                {
+                    Socket viewer = state->viewer;
+                    {
+                        std::lock_guard<std::mutex> lock(state->lock);
+                        state->viewer = NoSocket;
+                    }
+                    CloseSocket(viewer);
+                    state->connected = false;
+                }
+            }
+        }
+
+        // Whether or not it was sent, the next frame is compared with this one. A viewer
+        // that connects later gets a whole frame first.
+        uint32_t* previous = streamer->m_previous;
+        streamer->m_previous = streamer->m_current;
+        streamer->m_current = previous;
+    }
+}
+
+// Run length encodes a tile into out, giving up if that wouldn't be smaller than its
+// pixels. Returns the size of the runs, or 0 if it gave up.
+static size_t EncodeRuns(const uint32_t* pixels, int stride, int width, int height, uint8_t* out)
+{
+    size_t limit = (size_t)width * height * sizeof(uint32_t);
+    size_t size = 0;
+    uint32_t pixel = pixels[0];
+    uint32_t count = 0;
+    for (int y = 0; y < height; y++)
+    {
+        const uint32_t* row = pixels + (size_t)y * stride;
+        for (int x = 0; x < width; x++)
+        {
+            if (row[x] == pixel && count < 0xffff)
+            {
+                count++;
+                continue;
+            }
+
+            if (size + RunSize >= limit)
+                return 0;
+            WriteU16(out + size, count);
+            WriteU32(out + size + 2, pixel);
+            size += RunSize;
+            pixel = row[x];
+            count = 1;
+        }
+    }
+
+    if (size + RunSize >= limit)
+        return 0;
+    WriteU16(out + size, count);
+    WriteU32(out + size + 2, pixel);
+    return size + RunSize;
+}
+
+size_t FrameStreamer::EncodeFrame(bool wholeFrame)
+{
+    PIXIE_PROFILE_ZONE("FrameStreamer::EncodeFrame");
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    uint8_t* out = m_message + FrameHeaderSize;
+    uint32_t numTiles = 0;
+    for (int tileY = 0; tileY < m_height; tileY += m_tileSize)
+    {
+        int height = m_height - tileY < m_tileSize ? m_height - tileY : m_tileSize;
+        for (int tileX = 0; tileX < m_width; tileX += m_tileSize)
+        {
+            int width = m_width - tileX < m_tileSize ? m_width - tileX : m_tileSize;
+            size_t offset = (size_t)tileY * m_width + tileX;
+            const uint32_t* current = m_current + offset;
+            if (!wholeFrame)
+            {
+                const uint32_t* previous = m_previous + offset;
+                bool changed = false;
+                for (int y = 0; y < height && !changed; y++)
+                    changed = !kernels.equal(current + (size_t)y * m_width, previous + (size_t)y * m_width, width);
+                if (!changed)
+                    continue;
+            }
+
+            uint8_t* header = out;
+            uint8_t* data = out + TileHeaderSize;
+            size_t size = EncodeRuns(current, m_width, width, height, data);
+            uint8_t encoding = TileEncoding_Runs;
+            if (size == 0)
+            {
+                for (int y = 0; y < height; y++)
+                    memcpy(data + (size_t)y * width * sizeof(uint32_t), current + (size_t)y * m_width, width * sizeof(uint32_t));
+                size = (size_t)width * height * sizeof(uint32_t);
+                encoding = TileEncoding_Raw;
+            }
+
+            WriteU16(header, tileX / m_tileSize);
+            WriteU16(header + 2, tileY / m_tileSize);
+            header[4] = encoding;
+            WriteU32(header + 5, (uint32_t)size);
+            out = data + size;
+            numTiles++;
+        }
+    }
+
+    if (numTiles == 0)
+        return 0;
+
+    size_t size = out - m_message;
+    WriteU32(m_message, numTiles);
+    WriteU32(m_message + 4, (uint32_t)(size - FrameHeaderSize));
+    m_state->sentTiles += numTiles;
+    return size;
+}
+
+//
+// StreamClient
+//
+
+StreamClient::StreamClient()
+{
+    m_socket = -1;
+    m_pixels = 0;
+    m_width = 0;
+    m_height = 0;
+    m_tileSize = 0;
+    m_message = 0;
+    m_messageCapacity = 0;
+    m_receivedFrames = 0;
+    m_receivedTiles = 0;
+    m_receivedBytes = 0;
+}
+
+StreamClient::~StreamClient()
+{
+    Disconnect();
+    delete[] m_pixels;
+    free(m_message);
+}
+
+bool StreamClient::Connect(const char* address)
+{
+    Disconnect();
+    if (!InitSockets())
+        return false;
+
+    sockaddr_storage storage;
+    socklen_t size;
+    Socket s = NoSocket;
+    if (ResolveAddress(address, storage, size))
+        s = OpenSocket(storage);
+    if (s == NoSocket)
+    {
+        ShutdownSockets();
+        return false;
+    }
+
+    if (connect(s, (const sockaddr*)&storage, size) != 0)
+    {
+        CloseSocket(s);
+        ShutdownSockets();
+        return false;
+    }
+
+    m_socket = (intptr_t)s;
+    uint8_t header[StreamHeaderSize];
+    if (!ReadAll(header, sizeof(header)) || memcmp(header, StreamMagic, sizeof(StreamMagic)) != 0 || ReadU32(header + 4) != StreamVersion)
+    {
+        Disconnect();
+        return false;
+    }
+
+    int width = (int)ReadU32(header + 8);
+    int height = (int)ReadU32(header + 12);
+    int tileSize = (int)ReadU32(header + 16);
+    // The size comes from the other end of the connection, so it's checked before
+    // allocating a frame that size.
+    if (width <= 0 || height <= 0 || width > FrameStreamer::MaxSize || height > FrameStreamer::MaxSize ||
+        tileSize < FrameStreamer::MinTileSize || tileSize > FrameStreamer::MaxTileSize)
+    {
+        Disconnect();
+        return false;
+    }
+
+    if (width != m_width || height != m_height)
+    {
+        delete[] m_pixels;
+        m_pixels = new uint32_t[(size_t)width * height];
+    }
+    memset(m_pixels, 0, (size_t)width * height * sizeof(uint32_t));
+    m_width = width;
+    m_height = height;
+    m_tileSize = tileSize;
+    m_receivedFrames = 0;
+    m_receivedTiles = 0;
+    m_receivedBytes = sizeof(header);
+    return true;
+}
+
+void StreamClient::Disconnect()
+{
+    if (m_socket == -1)
+        return;
+
+    CloseSocket((Socket)m_socket);
+    m_socket = -1;
+    ShutdownSockets();
+}
+
+bool StreamClient::ReadAll(void* data, size_t size)
+{
+    uint8_t* bytes = (uint8_t*)data;
+    while (size > 0)
+    {
+        int received = ReceiveSome((Socket)m_socket, bytes, size);
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool StreamClient::Receive(int timeoutMs /*= -1*/)
+{
+    if (m_socket == -1)
+        return false;
+
+    // Only waiting for a frame to start times out. Once it has, the rest follows.
+    if (timeoutMs >= 0 && !WaitReadable((Socket)m_socket, timeoutMs))
+        return false;
+
+    uint8_t header[FrameHeaderSize];
+    if (!ReadAll(header, sizeof(header)))
+    {
+        Disconnect();
+        return false;
+    }
+
+    uint32_t numTiles = ReadU32(header);
+    uint32_t size = ReadU32(header + 4);
+    size_t maxTiles = (size_t)((m_width + m_tileSize - 1) / m_tileSize) * ((m_height + m_tileSize - 1) / m_tileSize);
+    size_t maxSize = (size_t)m_width * m_height * sizeof(uint32_t) + (size_t)numTiles * TileHeaderSize;
+    if (numTiles > maxTiles || size > maxSize)
+    {
+        Disconnect();
+        return false;
+    }
+
+    if (size > m_messageCapacity)
+    {
+        uint8_t* message = (uint8_t*)realloc(m_message, size);
+        if (!message)
+        {
+            Disconnect();
+            return false;
+        }
+        m_message = message;
+        m_messageCapacity = size;
+    }
+
+    if (!ReadAll(m_message, size) || !ApplyTiles(m_message, size, numTiles))
+    {
+        Disconnect();
+        return false;
+    }
+
+    m_receivedFrames++;
+    m_receivedTiles += numTiles;
+    m_receivedBytes += sizeof(header) + size;
+    return true;
+}
+
+bool StreamClient::ApplyTiles(const uint8_t* data, size_t size, uint32_t numTiles)
+{
+    const uint8_t* end = data + size;
+    for (uint32_t i = 0; i < numTiles; i++)
+    {
+        if ((size_t)(end - data) < TileHeaderSize)
+            return false;
+
+        int tileX = (int)ReadU16(data) * m_tileSize;
+        int tileY = (int)ReadU16(data + 2) * m_tileSize;
+        uint8_t encoding = data[4];
+        uint32_t tileSize = ReadU32(data + 5);
+        data += TileHeaderSize;
+        if (tileX >= m_width || tileY >= m_height || (size_t)(end - data) < tileSize)
+            return false;
+
+        int width = m_width - tileX < m_tileSize ? m_width - tileX : m_tileSize;
+        int height = m_height - tileY < m_tileSize ? m_height - tileY : m_tileSize;
+        uint32_t* pixels = m_pixels + (size_t)tileY * m_width + tileX;
+        if (encoding == TileEncoding_Raw)
+        {
+            if (tileSize != (size_t)width * height * sizeof(uint32_t))
+                return false;
+            for (int y = 0; y < height; y++)
+                memcpy(pixels + (size_t)y * m_width, data + (size_t)y * width * sizeof(uint32_t), width * sizeof(uint32_t));
+        }
+        else if (encoding == TileEncoding_Runs)
+        {
+            // Runs carry on from one row of the tile to the next.
+            if (tileSize % RunSize != 0)
+                return false;
+            int x = 0, y = 0;
+            for (const uint8_t* run = data; run < data + tileSize; run += RunSize)
+            {
+                uint32_t count = ReadU16(run);
+                uint32_t pixel = ReadU32(run + 2);
+                if (count > (uint32_t)((height - y) * width - x))
+                    return false;
+                for ( ; count > 0; count--)
+                {
+                    pixels[(size_t)y * m_width + x] = pixel;
+                    if (++x == width)
+                    {
+                        x = 0;
+                        y++;
+                    }
+                }
+            }
+            if (y != height)
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+
+        data += tileSize;
+    }
+
+    return data == end;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+#include "surface.h"
+
+namespace Pixie
+{
+    // Streams frames to a viewer in another process over a Unix domain or TCP socket.
+    // Capture copies a frame for a sender thread, which compares it with the last frame
+    // it sent a tile at a time with the SIMD kernels and sends only the tiles that
+    // changed, each run length encoded when that's smaller. The cost of streaming
+    // follows how much of the screen changes rather than its size. Set it on a window
+    // with Window::SetFrameStreamer to stream every frame Update presents.
+    //
+    // Addresses are "unix:<path>" for a Unix domain socket (not on Windows), or
+    // "<host>:<port>" or just "<port>" for TCP, where the host defaults to 127.0.0.1.
+    class FrameStreamer
+    {
+        public:
+            enum
+            {
+                MinTileSize = 8,
+                MaxTileSize = 128,
+                MaxSize = 16384,        // The largest width or height that can be streamed.
+            };
+
+            FrameStreamer();
+            ~FrameStreamer();
+
+            // Listens on address for a viewer to stream width by height frames to, in
+            // tileSize square tiles. One viewer is served at a time; the first frame
+            // after it connects is sent whole. Returns false if the size or tile size is
+            // out of range or the address can't be listened on.
+            bool Start(const char* address, int width, int height, int tileSize = 16);
+
+            // Disconnects the viewer and stops listening.
+            void Stop();
+
+            bool IsStreaming() const;
+            bool IsConnected() const;
+
+            // Copies the surface to be sent. If the sender hasn't taken the last frame
+            // captured yet it's replaced and counted as skipped, so a slow viewer skips
+            // frames rather than holding up rendering. Returns false if nothing is
+            // streaming or the surface isn't the size given to Start.
+            bool Capture(const Surface& surface);
+
+            // Returns the number of frames sent, frames skipped, tiles sent and bytes sent
+            // since Start.
+            uint64_t GetSentFrames() const;
+            uint64_t GetSkippedFrames() const;
+            uint64_t GetSentTiles() const;
+            uint64_t GetSentBytes() const;
+
+        private:
+            struct State;
+
+            static void SenderMain(FrameStreamer* streamer);
+            size_t EncodeFrame(bool wholeFrame);
+
+            FrameStreamer(const FrameStreamer&);
+            FrameStreamer& operator=(const FrameStreamer&);
+
+            State* m_state;
+            int m_width;
+            int m_height;
+            int m_tileSize;
+
+            // Capture copies into m_back and swaps it with m_pending. The sender swaps
+            // m_pending with m_current, sends what changed from m_previous, then swaps
+            // m_current and m_previous.
+            uint32_t* m_back;
+            uint32_t* m_pending;
+            uint32_t* m_current;
+            uint32_t* m_previous;
+
+            uint8_t* m_message;
+    };
+
+    // Connects to a FrameStreamer and rebuilds the frames it sends.
+    class StreamClient
+    {
+        public:
+            StreamClient();
+            ~StreamClient();
+
+            // Connects to the streamer listening on address, which is in the same form as
+            // for FrameStreamer::Start. Returns false if the connection fails or the stream
+            // isn't a size FrameStreamer can send.
+            bool Connect(const char* address);
+            void Disconnect();
+            bool IsConnected() const;
+
+            // Waits up to timeoutMs, or forever if it's negative, for the next frame and
+            // applies the tiles it changes. Returns false if no frame came in time or the
+            // connection closed, which disconnects.
+            bool Receive(int timeoutMs = -1);
+
+            // Returns the frame as of the last Receive.
+            int GetWidth() const;
+            int GetHeight() const;
+            const uint32_t* GetPixels() const;
+            Surface GetSurface() const;
+
+            // Returns the number of frames, tiles and bytes received since Connect.
+            uint64_t GetReceivedFrames() const;
+            uint64_t GetReceivedTiles() const;
+            uint64_t GetReceivedBytes() const;
+
+        private:
+            bool ReadAll(void* data, size_t size);
+            bool ApplyTiles(const uint8_t* data, size_t size, uint32_t numTiles);
+
+            StreamClient(const StreamClient&);
+            StreamClient& operator=(const StreamClient&);
+
+            intptr_t m_socket;
+            uint32_t* m_pixels;
+            int m_width;
+            int m_height;
+            int m_tileSize;
+            uint8_t* m_message;
+            size_t m_messageCapacity;
+
+            uint64_t m_receivedFrames;
+            uint64_t m_receivedTiles;
+            uint64_t m_receivedBytes;
+    };
+
+    inline int StreamClient::GetWidth() const
+    {
+        return m_width;
+    }
+
+    inline int StreamClient::GetHeight() const
+    {
+        return m_height;
+    }
+
+    inline const uint32_t* StreamClient::GetPixels() const
+    {
+        return m_pixels;
+    }
+
+    inline Surface StreamClient::GetSurface() const
+    {
+        return Surface(m_pixels, m_width, m_height, m_width);
+    }
+
+    inline bool StreamClient::IsConnected() const
+    {
+        return m_socket != -1;
+    }
+
+    inline uint64_t StreamClient::GetReceivedFrames() const
+    {
+        return m_receivedFrames;
+    }
+
+    inline uint64_t StreamClient::GetReceivedTiles() const
+    {
+        return m_receivedTiles;
+    }
+
+    inline uint64_t StreamClient::GetReceivedBytes() const
+    {
+        return m_receivedBytes;
+    }
+}
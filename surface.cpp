@@ -0,0 +1,175 @@
+#include "surface.h"
+#include "pixie.h"
+#include "simd.h"
+#include <string.h>
+
+using namespace Pixie;
+
+Surface Surface::GetSubSurface(int x, int y, int width, int height) const
+{
+    int left = x < 0 ? 0 : x;
+    int top = y < 0 ? 0 : y;
+    int right = x + width > m_width ? m_width : x + width;
+    int bottom = y + height > m_height ? m_height : y + height;
+    if (left >= right || top >= bottom)
+        return Surface();
+
+    Surface surface(GetRow(top) + left, right - left, bottom - top, m_stride, m_window);
+    surface.m_windowX = m_windowX + left;
+    surface.m_windowY = m_windowY + top;
+    surface.SetClipRect(m_clip.left - left, m_clip.top - top, m_clip.right - m_clip.left, m_clip.bottom - m_clip.top);
+    return surface;
+}
+
+void Surface::SetClipRect(int x, int y, int width, int height)
+{
+    m_clip.left = x < 0 ? 0 : x;
+    m_clip.top = y < 0 ? 0 : y;
+    m_clip.right = x + width > m_width ? m_width : x + width;
+    m_clip.bottom = y + height > m_height ? m_height : y + height;
+
+    // An empty clip rectangle is kept at the top left, so it's still inside the surface.
+    if (m_clip.left >= m_clip.right || m_clip.top >= m_clip.bottom)
+        m_clip.left = m_clip.top = m_clip.right = m_clip.bottom = 0;
+}
+
+void Surface::MarkDirty(int x, int y, int width, int height) const
+{
+    if (!m_window)
+        return;
+
+    int left = x < m_clip.left ? m_clip.left : x;
+    int top = y < m_clip.top ? m_clip.top : y;
+    int right = x + width > m_clip.right ? m_clip.right : x + width;
+    int bottom = y + height > m_clip.bottom ? m_clip.bottom : y + height;
+    if (left < right && top < bottom)
+        m_window->AddDirtyRect(m_windowX + left, m_windowY + top, right - left, bottom - top);
+}
+
+// The part of a blit left after clipping to the destination.
+struct BlitRect
+{
+    int dstX;
+    int dstY;
+    int srcX;
+    int srcY;
+    int width;
+    int height;
+};
+
+// Clips a width by height rectangle drawn at x, y to the destination's clip rectangle.
+// Returns false if nothing is left to draw.
+static bool ClipBlit(const Surface& dst, int x, int y, int width, int height, BlitRect& rect)
+{
+    const SurfaceRect& clip = dst.GetClipRect();
+    rect.srcX = x < clip.left ? clip.left - x : 0;
+    rect.srcY = y < clip.top ? clip.top - y : 0;
+    rect.dstX = x + rect.srcX;
+    rect.dstY = y + rect.srcY;
+
+    int right = x + width > clip.right ? clip.right : x + width;
+    int bottom = y + height > clip.bottom ? clip.bottom : y + height;
+    rect.width = right - rect.dstX;
+    rect.height = bottom - rect.dstY;
+    return rect.width > 0 && rect.height > 0 && dst.GetPixels();
+}
+
+void Pixie::Blit(const Surface& dst, int x, int y, const Surface& src)
+{
+    BlitRect rect;
+    if (!src.GetPixels() || !ClipBlit(dst, x, y, src.GetWidth(), src.GetHeight(), rect))
+        return;
+
+    for (int row = 0; row < rect.height; row++)
+        memcpy(dst.GetRow(rect.dstY + row) + rect.dstX, src.GetRow(rect.srcY + row) + rect.srcX, rect.width * sizeof(uint32_t));
+
+    dst.MarkDirty(rect.dstX, rect.dstY, rect.width, rect.height);
+}
+
+void Pixie::BlitKeyed(const Surface& dst, int x, int y, const Surface& src, uint32_t key)
+{
+    BlitRect rect;
+    if (!src.GetPixels() || !ClipBlit(dst, x, y, src.GetWidth(), src.GetHeight(), rect))
+        return;
+
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    for (int row = 0; row < rect.height; row++)
+        kernels.copyKeyed(dst.GetRow(rect.dstY + row) + rect.dstX, src.GetRow(rect.srcY + row) + rect.srcX, rect.width, key);
+
+    dst.MarkDirty(rect.dstX, rect.dstY, rect.width, rect.height);
+}
+
+void Pixie::BlitAlpha(const Surface& dst, int x, int y, const Surface& src)
+{
+    BlitRect rect;
+    if (!src.GetPixels() || !ClipBlit(dst, x, y, src.GetWidth(), src.GetHeight(), rect))
+        return;
+
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    for (int row = 0; row < rect.height; row++)
+        kernels.blendAlpha(dst.GetRow(rect.dstY + row) + rect.dstX, src.GetRow(rect.srcY + row) + rect.srcX, rect.width);
+
+    dst.MarkDirty(rect.dstX, rect.dstY, rect.width, rect.height);
+}
+
+// Steps through the source pixels nearest the centres of the destination pixels. The
+// destination pixel i takes the source pixel ((2i + 1) * srcSize) / (2 * dstSize), which
+// is worked out exactly with a whole step and a remainder rather than in fixed point.
+struct NearestStep
+{
+    NearestStep(int srcSize, int dstSize, int start)
+    {
+        denom = 2 * (int64_t)dstSize;
+        int64_t n = (2 * (int64_t)start + 1) * srcSize;
+        pos = (int)(n / denom);
+        rem = n % denom;
+        whole = (int)((2 * (int64_t)srcSize) / denom);
+        frac = (2 * (int64_t)srcSize) % denom;
+    }
+
+    void Next()
+    {
+        pos += whole;
+        rem += frac;
+        if (rem >= denom)
+        {
+            rem -= denom;
+            pos++;
+        }
+    }
+
+    int pos;
+    int whole;
+    int64_t rem;
+    int64_t frac;
+    int64_t denom;
+};
+
+void Pixie::BlitScaled(const Surface& dst, int x, int y, int width, int height, const Surface& src)
+{
+    BlitRect rect;
+    if (!src.GetPixels() || src.GetWidth() <= 0 || src.GetHeight() <= 0 || !ClipBlit(dst, x, y, width, height, rect))
+        return;
+
+    // When scaling up, runs of destination rows come from the same source row, so after
+    // the first the row is copied from the one above.
+    NearestStep stepY(src.GetHeight(), height, rect.srcY);
+    int lastSrcY = -1;
+    for (int row = 0; row < rect.height; row++, stepY.Next())
+    {
+        uint32_t* d = dst.GetRow(rect.dstY + row) + rect.dstX;
+        if (stepY.pos == lastSrcY)
+        {
+            memcpy(d, d - dst.GetStride(), rect.width * sizeof(uint32_t));
+            continue;
+        }
+
+        const uint32_t* s = src.GetRow(stepY.pos);
+        NearestStep stepX(src.GetWidth(), width, rect.srcX);
+        for (int i = 0; i < rect.width; i++, stepX.Next())
+            d[i] = s[stepX.pos];
+        lastSrcY = stepY.pos;
+    }
+
+    dst.MarkDirty(rect.dstX, rect.dstY, rect.width, rect.height);
+}
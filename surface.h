@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Pixie
+{
+    class Window;
+
+    // A rectangle of a surface, with exclusive right and bottom edges.
+    struct SurfaceRect
+    {
+        int left;
+        int top;
+        int right;
+        int bottom;
+    };
+
+    // A view of 32-bit ARGB pixels to draw to or draw from. A surface doesn't own its
+    // pixels. Rows are stride pixels apart, so a surface can be a rectangle of a larger
+    // one, such as a sprite in a sprite sheet, or a buffer owned by something else with
+    // padded rows. Drawing to a surface is limited to its clip rectangle, which starts out
+    // as the whole surface.
+    class Surface
+    {
+        public:
+            Surface();
+
+            // If window is given, what's drawn to the surface is marked dirty in the window.
+            Surface(uint32_t* pixels, int width, int height, int stride, Window* window = 0);
+
+            // Returns the given rectangle of this surface, clipped to it. The sub-surface's
+            // clip rectangle is the part of this surface's clip rectangle within it.
+            Surface GetSubSurface(int x, int y, int width, int height) const;
+
+            // Limits drawing to the given rectangle, clipped to the surface.
+            void SetClipRect(int x, int y, int width, int height);
+
+            // Lets drawing cover the whole surface again.
+            void ResetClipRect();
+
+            // Marks a rectangle of the surface, clipped to the clip rectangle, as changed in
+            // its window, if it has one.
+            void MarkDirty(int x, int y, int width, int height) const;
+
+            uint32_t* GetPixels() const;
+            uint32_t* GetRow(int y) const;
+            int GetWidth() const;
+            int GetHeight() const;
+            int GetStride() const;
+            const SurfaceRect& GetClipRect() const;
+
+            // Returns the window the surface is part of, if any, and where its top left is
+            // in the window.
+            Window* GetWindow() const;
+            int GetWindowX() const;
+            int GetWindowY() const;
+
+        private:
+            uint32_t* m_pixels;
+            int m_width;
+            int m_height;
+            int m_stride;
+            SurfaceRect m_clip;
+
+            // The window and where this surface is within it.
+            Window* m_window;
+            int m_windowX;
+            int m_windowY;
+    };
+
+    // Each blit clips the source rectangle to the destination's clip rectangle once and
+    // then works a row at a time. Blitting to a window's surface marks the rectangle drawn
+    // as dirty. The source and destination must not overlap.
+
+    // Copies src to dst with its top left at x, y.
+    void Blit(const Surface& dst, int x, int y, const Surface& src);
+
+    // Copies the pixels of src whose colour, ignoring the top byte, isn't key.
+    void BlitKeyed(const Surface& dst, int x, int y, const Surface& src, uint32_t key);
+
+    // Blends src into dst by the alpha of each source pixel, as BlendMode_SrcOver does
+    // with a colour. The top byte of dst is left alone.
+    void BlitAlpha(const Surface& dst, int x, int y, const Surface& src);
+
+    // Stretches src to width by height pixels, taking the nearest source pixel.
+    void BlitScaled(const Surface& dst, int x, int y, int width, int height, const Surface& src);
+
+    inline Surface::Surface()
+    {
+        m_pixels = 0;
+        m_width = 0;
+        m_height = 0;
+        m_stride = 0;
+        ResetClipRect();
+        m_window = 0;
+        m_windowX = 0;
+        m_windowY = 0;
+    }
+
+    inline Surface::Surface(uint32_t* pixels, int width, int height, int stride, Window* window)
+    {
+        m_pixels = pixels;
+        m_width = width;
+        m_height = height;
+        m_stride = stride;
+        ResetClipRect();
+        m_window = window;
+        m_windowX = 0;
+        m_windowY = 0;
+    }
+
+    inline void Surface::ResetClipRect()
+    {
+        m_clip.left = 0;
+        m_clip.top = 0;
+        m_clip.right = m_width;
+        m_clip.bottom = m_height;
+    }
+
+    inline uint32_t* Surface::GetPixels() const
+    {
+        return m_pixels;
+    }
+
+    inline uint32_t* Surface::GetRow(int y) const
+    {
+        return m_pixels + ((intptr_t)y * m_stride);
+    }
+
+    inline int Surface::GetWidth() const
+    {
+        return m_width;
+    }
+
+    inline int Surface::GetHeight() const
+    {
+        return m_height;
+    }
+
+    inline int Surface::GetStride() const
+    {
+        return m_stride;
+    }
+
+    inline const SurfaceRect& Surface::GetClipRect() const
+    {
+        return m_clip;
+    }
+
+    inline Window* Surface::GetWindow() const
+    {
+        return m_window;
+    }
+
+    inline int Surface::GetWindowX() const
+    {
+        return m_windowX;
+    }
+
+    inline int Surface::GetWindowY() const
+    {
+        return m_windowY;
+    }
+}
@@ -0,0 +1,153 @@
+#include "core.h"
+#include <string.h>
+#include <algorithm>
+#include "textlayout.h"
+
+using namespace Pixie;
+
+uint32_t Pixie::DecodeUtf8(const char*& text)
+{
+    const uint8_t* p = (const uint8_t*)text;
+    uint32_t codepoint = p[0];
+    if (codepoint < 0x80)
+    {
+        text++;
+        return codepoint;
+    }
+
+    int length = 0;
+    uint32_t minimum = 0;
+    if ((codepoint & 0xe0) == 0xc0)
+    {
+        length = 2;
+        minimum = 0x80;
+        codepoint &= 0x1f;
+    }
+    else if ((codepoint & 0xf0) == 0xe0)
+    {
+        length = 3;
+        minimum = 0x800;
+        codepoint &= 0x0f;
+    }
+    else if ((codepoint & 0xf8) == 0xf0)
+    {
+        length = 4;
+        minimum = 0x10000;
+        codepoint &= 0x07;
+    }
+
+    // A continuation byte is 10xxxxxx, so this also stops at the terminator.
+    for (int i = 1; i < length; i++)
+    {
+        if ((p[i] & 0xc0) != 0x80)
+        {
+            length = 0;
+            break;
+        }
+        codepoint = (codepoint << 6) | (p[i] & 0x3f);
+    }
+
+    if (length == 0 || codepoint < minimum || codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff))
+    {
+        text++;
+        return RawByteBase + p[0];
+    }
+
+    text += length;
+    return codepoint;
+}
+
+template <typename T> static void Grow(T*& data, int& capacity, int needed)
+{
+    if (needed <= capacity)
+        return;
+
+    int newCapacity = std::max(needed, capacity * 2);
+    T* newData = new T[newCapacity];
+    if (data)
+        memcpy(newData, data, capacity * sizeof(T));
+    delete[] data;
+    data = newData;
+    capacity = newCapacity;
+}
+
+TextLayoutCache::TextLayoutCache()
+{
+    m_layouts = 0;
+    m_tick = 0;
+    m_numHits = 0;
+    m_numMisses = 0;
+}
+
+TextLayoutCache::~TextLayoutCache()
+{
+    if (m_layouts)
+    {
+        for (int i = 0; i < MaxLayouts; i++)
+        {
+            delete[] m_layouts[i].text;
+            delete[] m_layouts[i].glyphs;
+        }
+    }
+    delete[] m_layouts;
+}
+
+void TextLayoutCache::Clear()
+{
+    if (!m_layouts)
+        return;
+
+    // Keep the buffers for reuse.
+    for (int i = 0; i < MaxLayouts; i++)
+        m_layouts[i].lastUsed = 0;
+}
+
+TextLayoutCache::Layout* TextLayoutCache::Find(const char* msg, int key, bool& added)
+{
+    // Fonts that are never drawn don't need the cache.
+    if (!m_layouts)
+    {
+        m_layouts = new Layout[MaxLayouts];
+        memset(m_layouts, 0, MaxLayouts * sizeof(Layout));
+    }
+
+    m_tick++;
+
+    // FNV-1a of the string and key.
+    uint64_t hash = 14695981039346656037ull;
+    int length = 0;
+    for ( ; msg[length]; length++)
+        hash = (hash ^ (uint8_t)msg[length]) * 1099511628211ull;
+    hash = (hash ^ (uint32_t)key) * 1099511628211ull;
+
+    Layout* set = m_layouts + ((hash % (MaxLayouts / Ways)) * Ways);
+    Layout* layout = set;
+    for (int i = 0; i < Ways; i++)
+    {
+        Layout& entry = set[i];
+        if (entry.lastUsed && entry.hash == hash && entry.key == key && strcmp(entry.text, msg) == 0)
+        {
+            entry.lastUsed = m_tick;
+            m_numHits++;
+            added = false;
+            return &entry;
+        }
+
+        // Replace an unused entry, or the least recently used.
+        if (entry.lastUsed < layout->lastUsed)
+            layout = &entry;
+    }
+
+    Grow(layout->text, layout->textCapacity, length + 1);
+    Grow(layout->glyphs, layout->glyphCapacity, std::max(length, 1));
+    memcpy(layout->text, msg, length + 1);
+    layout->hash = hash;
+    layout->key = key;
+    layout->lastUsed = m_tick;
+    layout->numGlyphs = 0;
+    layout->width = 0;
+
+    m_numMisses++;
+    added = true;
+    return layout;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Pixie
+{
+    enum
+    {
+        // Bytes that aren't part of valid UTF-8 decode to RawByteBase plus the byte. These
+        // are lone surrogates, which valid UTF-8 never decodes to, so fonts can tell them
+        // apart and fall back to treating the byte as a character of their own.
+        RawByteBase = 0xdc00,
+    };
+
+    // Decodes the UTF-8 character at text and moves text past it. Overlong encodings,
+    // surrogates and truncated sequences are invalid, and decode a byte at a time.
+    uint32_t DecodeUtf8(const char*& text);
+
+    // Returns true if the codepoint is a byte that wasn't valid UTF-8.
+    bool IsRawByte(uint32_t codepoint);
+
+    // Caches the layout of recently drawn strings, so that drawing or measuring the same
+    // string again doesn't decode it again. Strings are looked up by their contents and a
+    // key chosen by the font, such as the size. Lookups change the cache, so a font that
+    // uses one can only be drawn or measured from one thread at a time.
+    class TextLayoutCache
+    {
+        public:
+            enum
+            {
+                MaxLayouts = 256,
+                Ways = 4,               // Layouts are replaced within sets of this many.
+            };
+
+            struct Glyph
+            {
+                uint32_t codepoint;
+                int index;              // The font's glyph.
+                int x;                  // Position relative to the start of the string.
+            };
+
+            struct Layout
+            {
+                Glyph* glyphs;
+                int numGlyphs;
+                int width;
+
+                // Used by the cache.
+                uint64_t hash;
+                uint64_t lastUsed;      // 0 if the entry is unused.
+                char* text;
+                int key;
+                int textCapacity;
+                int glyphCapacity;
+            };
+
+            TextLayoutCache();
+            ~TextLayoutCache();
+
+            // Returns the layout of the string with the given key. If it isn't cached, the
+            // least recently used layout in its set is replaced and added is set to true, and
+            // the caller lays the string out into it. There is room for a glyph per byte.
+            Layout* Find(const char* msg, int key, bool& added);
+
+            // Empties the cache, such as when the font changes.
+            void Clear();
+
+            // Returns the number of lookups that found a cached layout, and that didn't.
+            uint64_t GetNumHits() const;
+            uint64_t GetNumMisses() const;
+
+        private:
+            Layout* m_layouts;
+            uint64_t m_tick;
+            uint64_t m_numHits;
+            uint64_t m_numMisses;
+    };
+
+    inline bool IsRawByte(uint32_t codepoint)
+    {
+        return codepoint >= RawByteBase + 0x80 && codepoint <= RawByteBase + 0xff;
+    }
+
+    inline uint64_t TextLayoutCache::GetNumHits() const
+    {
+        return m_numHits;
+    }
+
+    inline uint64_t TextLayoutCache::GetNumMisses() const
+    {
+        return m_numMisses;
+    }
+}
@@ -0,0 +1,1165 @@
+#include "core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+#include "truetype.h"
+#include "pixie.h"
+#include "simd.h"
+#include "profiler.h"
+
+using namespace Pixie;
+
+// Rows of glyphs in the atlas. Heights are rounded up so that glyphs of similar sizes
+// share shelves. When the atlas is full, the least recently used shelf is emptied.
+struct TrueTypeFont::Shelf
+{
+    int y;
+    int height;
+    int x;                      // Left of the free space at the end of the shelf.
+    uint64_t lastUsed;
+};
+
+struct TrueTypeFont::Glyph
+{
+    uint32_t key;               // Glyph index and size, see GlyphKey.
+    int shelf;                  // -1 if nothing was drawn, as for a space.
+    int next;                   // Next unused glyph, when unused.
+    uint16_t atlasX;
+    uint16_t atlasY;
+    uint16_t width;
+    uint16_t height;
+    int16_t left;               // Offset of the bitmap from the pen position.
+    int16_t top;                // Offset of the bitmap from the baseline.
+    bool used;
+};
+
+// A point of a glyph outline, used while rasterizing.
+struct TrueTypeFont::Point
+{
+    float x;
+    float y;
+    bool onCurve;
+};
+
+static const int GlyphTableSize = TrueTypeFont::MaxGlyphs * 2;
+static const int ShelfRounding = 4;
+static const int MaxShelves = TrueTypeFont::AtlasSize / ShelfRounding;
+static const int MaxCompositeDepth = 8;
+
+template <typename T> static void Grow(T*& data, int& capacity, int needed)
+{
+    if (needed <= capacity)
+        return;
+
+    int newCapacity = std::max(needed, capacity * 2);
+    T* newData = new T[newCapacity];
+    if (data)
+        memcpy(newData, data, capacity * sizeof(T));
+    delete[] data;
+    data = newData;
+    capacity = newCapacity;
+}
+
+// TrueType data is big endian.
+static inline uint16_t ReadU16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline int16_t ReadS16(const uint8_t* p)
+{
+    return (int16_t)ReadU16(p);
+}
+
+static inline uint32_t ReadU32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint32_t GlyphKey(int glyphIndex, int size)
+{
+    return (uint32_t)glyphIndex | ((uint32_t)size << 16);
+}
+
+static inline int GlyphSlot(uint32_t key)
+{
+    return (int)((key * 2654435761u) >> 20) & (GlyphTableSize - 1);
+}
+
+TrueTypeFont::TrueTypeFont()
+{
+    m_data = 0;
+    m_size = 0;
+    m_atlas = 0;
+    m_shelves = 0;
+    m_glyphs = 0;
+    m_glyphTable = 0;
+    m_points = 0;
+    m_numPoints = m_maxPoints = 0;
+    m_flags = 0;
+    m_maxFlags = 0;
+    m_contourEnds = 0;
+    m_numContours = m_maxContours = 0;
+    m_coverage = 0;
+    m_maxCoverage = 0;
+    m_numRasterized = 0;
+    m_numEvicted = 0;
+}
+
+TrueTypeFont::~TrueTypeFont()
+{
+    Unload();
+    delete[] m_points;
+    delete[] m_flags;
+    delete[] m_contourEnds;
+    delete[] m_coverage;
+}
+
+void TrueTypeFont::Unload()
+{
+    delete[] m_data;
+    delete[] m_atlas;
+    delete[] m_shelves;
+    delete[] m_glyphs;
+    delete[] m_glyphTable;
+    m_data = 0;
+    m_size = 0;
+    m_atlas = 0;
+    m_shelves = 0;
+    m_glyphs = 0;
+    m_glyphTable = 0;
+    m_layouts.Clear();
+}
+
+bool TrueTypeFont::Load(const char* filename)
+{
+    assert(filename);
+
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    uint8_t* data = new uint8_t[size];
+    bool result = fread(data, 1, size, file) == (size_t)size;
+    fclose(file);
+
+    if (result)
+        result = LoadMemory(data, size);
+
+    delete[] data;
+    return result;
+}
+
+bool TrueTypeFont::LoadMemory(const void* data, size_t size)
+{
+    assert(data);
+
+    Unload();
+
+    m_data = new uint8_t[size];
+    m_size = size;
+    memcpy(m_data, data, size);
+
+    if (!Parse())
+    {
+        Unload();
+        return false;
+    }
+
+    m_atlas = new uint8_t[AtlasSize * AtlasSize];
+    memset(m_atlas, 0, AtlasSize * AtlasSize);
+    m_shelves = new Shelf[MaxShelves];
+    m_numShelves = 0;
+    m_atlasBottom = 0;
+
+    m_glyphs = new Glyph[MaxGlyphs];
+    for (int i = 0; i < MaxGlyphs; i++)
+    {
+        m_glyphs[i].used = false;
+        m_glyphs[i].next = i + 1 < MaxGlyphs ? i + 1 : -1;
+    }
+    m_freeGlyph = 0;
+    m_glyphTable = new int16_t[GlyphTableSize];
+    RebuildGlyphTable();
+
+    m_tick = 0;
+    m_numRasterized = 0;
+    m_numEvicted = 0;
+    return true;
+}
+
+bool TrueTypeFont::Parse()
+{
+    if (m_size < 12)
+        return false;
+
+    // Only TrueType outlines, not CFF ('OTTO') or collections ('ttcf').
+    uint32_t version = ReadU32(m_data);
+    if (version != 0x00010000 && version != 0x74727565) // 'true'
+        return false;
+
+    uint32_t head = 0, hhea = 0, maxp = 0, cmap = 0, loca = 0, glyf = 0, hmtx = 0, kern = 0;
+    uint32_t glyfSize = 0, hmtxSize = 0, locaSize = 0, cmapSize = 0, kernSize = 0;
+
+    int numTables = ReadU16(m_data + 4);
+    if (12 + (size_t)numTables * 16 > m_size)
+        return false;
+
+    for (int i = 0; i < numTables; i++)
+    {
+        const uint8_t* record = m_data + 12 + (i * 16);
+        uint32_t tag = ReadU32(record);
+        uint32_t offset = ReadU32(record + 8);
+        uint32_t length = ReadU32(record + 12);
+        if (offset > m_size || length > m_size - offset)
+            return false;
+
+        switch (tag)
+        {
+            case 0x68656164: head = offset; if (length < 54) return false; break;    // 'head'
+            case 0x68686561: hhea = offset; if (length < 36) return false; break;    // 'hhea'
+            case 0x6d617870: maxp = offset; if (length < 6) return false; break;     // 'maxp'
+            case 0x636d6170: cmap = offset; cmapSize = length; break;                // 'cmap'
+            case 0x6c6f6361: loca = offset; locaSize = length; break;                // 'loca'
+            case 0x676c7966: glyf = offset; glyfSize = length; break;                // 'glyf'
+            case 0x686d7478: hmtx = offset; hmtxSize = length; break;                // 'hmtx'
+            case 0x6b65726e: kern = offset; kernSize = length; break;                // 'kern'
+        }
+    }
+
+    if (!head || !hhea || !maxp || !cmap || !loca || !glyf || !hmtx)
+        return false;
+
+    m_unitsPerEm = ReadU16(m_data + head + 18);
+    m_indexToLocFormat = ReadS16(m_data + head + 50);
+    m_ascent = ReadS16(m_data + hhea + 4);
+    m_descent = ReadS16(m_data + hhea + 6);
+    m_lineGap = ReadS16(m_data + hhea + 8);
+    m_numHMetrics = ReadU16(m_data + hhea + 34);
+    m_numGlyphs = ReadU16(m_data + maxp + 4);
+    if (m_unitsPerEm == 0 || m_numGlyphs == 0 || m_numHMetrics == 0)
+        return false;
+
+    uint32_t locaEntrySize = m_indexToLocFormat ? 4 : 2;
+    if ((uint32_t)(m_numGlyphs + 1) * locaEntrySize > locaSize || (uint32_t)m_numHMetrics * 4 > hmtxSize)
+        return false;
+
+    m_loca = loca;
+    m_glyf = glyf;
+    m_glyfSize = glyfSize;
+    m_hmtx = hmtx;
+
+    // Pick the best Unicode subtable: full Unicode (format 12), then the Basic
+    // Multilingual Plane (format 4).
+    if (cmapSize < 4)
+        return false;
+
+    int numSubtables = ReadU16(m_data + cmap + 2);
+    if (4 + (uint32_t)numSubtables * 8 > cmapSize)
+        return false;
+
+    int bestScore = 0;
+    for (int i = 0; i < numSubtables; i++)
+    {
+        const uint8_t* record = m_data + cmap + 4 + (i * 8);
+        int platform = ReadU16(record);
+        int encoding = ReadU16(record + 2);
+        uint32_t offset = ReadU32(record + 4);
+        if (cmapSize < 8 || offset > cmapSize - 8)
+            continue;
+
+        uint32_t subtable = cmap + offset;
+        int format = ReadU16(m_data + subtable);
+        bool unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+        if (!unicode)
+            continue;
+
+        int score = 0;
+        if (format == 12 && cmapSize - offset >= 16 && ReadU32(m_data + subtable + 12) <= (cmapSize - offset - 16) / 12)
+            score = 2;
+        else if (format == 4 && cmapSize - offset >= 14 && ReadU16(m_data + subtable + 2) <= cmapSize - offset)
+            score = 1;
+
+        if (score > bestScore)
+        {
+            bestScore = score;
+            m_cmap = subtable;
+            m_cmapFormat = format;
+        }
+    }
+
+    if (bestScore == 0)
+        return false;
+
+    // Format 4 needs its four arrays to fit in the subtable.
+    if (m_cmapFormat == 4)
+    {
+        uint32_t segCountX2 = ReadU16(m_data + m_cmap + 6);
+        if (16 + (segCountX2 * 4) > ReadU16(m_data + m_cmap + 2))
+            return false;
+    }
+
+    // Kerning comes from the first horizontal format 0 subtable of the kern table, if
+    // there is one. Kerning in GPOS isn't supported.
+    m_kernPairs = 0;
+    m_numKernPairs = 0;
+    if (kern && kernSize >= 4 && ReadU16(m_data + kern) == 0)
+    {
+        int numSubtables = ReadU16(m_data + kern + 2);
+        uint32_t offset = 4;
+        for (int i = 0; i < numSubtables && kernSize >= 14 && offset <= kernSize - 14; i++)
+        {
+            const uint8_t* subtable = m_data + kern + offset;
+            uint32_t length = ReadU16(subtable + 2);
+            int coverage = ReadU16(subtable + 4);
+
+            // Format 0, horizontal, and neither minimum values nor cross-stream.
+            if ((coverage & 0xff07) == 0x0001)
+            {
+                // The subtable length overflows in large tables, so check the pairs
+                // against the table instead.
+                uint32_t numPairs = ReadU16(subtable + 6);
+                if (numPairs * 6 <= kernSize - offset - 14)
+                {
+                    m_kernPairs = kern + offset + 14;
+                    m_numKernPairs = numPairs;
+                }
+                break;
+            }
+
+            if (length < 6)
+                break;
+            offset += length;
+        }
+    }
+
+    return true;
+}
+
+int TrueTypeFont::ClampSize(int size) const
+{
+    return std::min(std::max(size, (int)MinSize), (int)MaxSize);
+}
+
+float TrueTypeFont::GetScale(int size) const
+{
+    return (float)ClampSize(size) / m_unitsPerEm;
+}
+
+int TrueTypeFont::GetAscent(int size) const
+{
+    return m_data ? (int)ceilf(m_ascent * GetScale(size)) : 0;
+}
+
+int TrueTypeFont::GetLineHeight(int size) const
+{
+    return m_data ? (int)ceilf((m_ascent - m_descent + m_lineGap) * GetScale(size)) : 0;
+}
+
+int TrueTypeFont::FindGlyphIndex(uint32_t codepoint) const
+{
+    const uint8_t* subtable = m_data + m_cmap;
+
+    if (m_cmapFormat == 12)
+    {
+        // Groups of consecutive codepoints, sorted by start.
+        uint32_t numGroups = ReadU32(subtable + 12);
+        const uint8_t* groups = subtable + 16;
+        uint32_t low = 0, high = numGroups;
+        while (low < high)
+        {
+            uint32_t mid = (low + high) / 2;
+            const uint8_t* group = groups + (mid * 12);
+            if (codepoint < ReadU32(group))
+                high = mid;
+            else if (codepoint > ReadU32(group + 4))
+                low = mid + 1;
+            else
+            {
+                // A malformed cmap can map past the glyphs the font has.
+                uint32_t glyphIndex = ReadU32(group + 8) + (codepoint - ReadU32(group));
+                return glyphIndex < (uint32_t)m_numGlyphs ? (int)glyphIndex : 0;
+            }
+        }
+        return 0;
+    }
+
+    // Format 4: segments of 16-bit codepoints, sorted by end.
+    if (codepoint > 0xffff)
+        return 0;
+
+    int segCountX2 = ReadU16(subtable + 6);
+    int segCount = segCountX2 / 2;
+    const uint8_t* endCodes = subtable + 14;
+    const uint8_t* startCodes = endCodes + segCountX2 + 2;
+    const uint8_t* idDeltas = startCodes + segCountX2;
+    const uint8_t* idRangeOffsets = idDeltas + segCountX2;
+
+    int low = 0, high = segCount;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (ReadU16(endCodes + (mid * 2)) < codepoint)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == segCount)
+        return 0;
+
+    uint32_t start = ReadU16(startCodes + (low * 2));
+    if (codepoint < start)
+        return 0;
+
+    int delta = ReadS16(idDeltas + (low * 2));
+    int rangeOffset = ReadU16(idRangeOffsets + (low * 2));
+    if (rangeOffset == 0)
+    {
+        int glyphIndex = (codepoint + delta) & 0xffff;
+        return glyphIndex < m_numGlyphs ? glyphIndex : 0;
+    }
+
+    // The offset is relative to its own position in the idRangeOffset array.
+    size_t position = (idRangeOffsets - m_data) + (low * 2) + rangeOffset + ((codepoint - start) * 2);
+    if (position > m_size - 2)
+        return 0;
+
+    int glyphIndex = ReadU16(m_data + position);
+    if (glyphIndex)
+        glyphIndex = (glyphIndex + delta) & 0xffff;
+    return glyphIndex < m_numGlyphs ? glyphIndex : 0;
+}
+
+int TrueTypeFont::GetAdvance(int glyphIndex) const
+{
+    // Glyphs past the last metric share its advance.
+    int metric = std::min(glyphIndex, m_numHMetrics - 1);
+    return ReadU16(m_data + m_hmtx + (metric * 4));
+}
+
+int TrueTypeFont::GetKerning(int left, int right) const
+{
+    // The pairs are sorted by the left and right glyphs together.
+    uint32_t key = ((uint32_t)left << 16) | (uint32_t)right;
+    int low = 0, high = m_numKernPairs;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        const uint8_t* pair = m_data + m_kernPairs + (mid * 6);
+        uint32_t pairKey = ReadU32(pair);
+        if (pairKey < key)
+            low = mid + 1;
+        else if (pairKey > key)
+            high = mid;
+        else
+            return ReadS16(pair + 4);
+    }
+
+    return 0;
+}
+
+const TextLayoutCache::Layout* TrueTypeFont::GetLayout(const char* msg, int size)
+{
+    bool added;
+    TextLayoutCache::Layout* layout = m_layouts.Find(msg, size, added);
+    if (!added)
+        return layout;
+
+    // Lay out on a fractional pen position so that rounding doesn't add up along the string.
+    float scale = GetScale(size);
+    float pen = 0.0f;
+    int count = 0, previous = -1;
+    while (*msg)
+    {
+        // Bytes that aren't UTF-8 are taken as Latin-1.
+        uint32_t codepoint = DecodeUtf8(msg);
+        if (IsRawByte(codepoint))
+            codepoint -= RawByteBase;
+
+        int glyphIndex = FindGlyphIndex(codepoint);
+        if (previous >= 0 && m_numKernPairs)
+            pen += GetKerning(previous, glyphIndex) * scale;
+
+        TextLayoutCache::Glyph& glyph = layout->glyphs[count++];
+        glyph.codepoint = codepoint;
+        glyph.index = glyphIndex;
+        glyph.x = (int)floorf(pen + 0.5f);
+        pen += GetAdvance(glyphIndex) * scale;
+        previous = glyphIndex;
+    }
+
+    layout->numGlyphs = count;
+    layout->width = (int)floorf(pen + 0.5f);
+    return layout;
+}
+
+int TrueTypeFont::GetStringWidth(const char* msg, int size)
+{
+    assert(msg);
+    if (!m_data)
+        return 0;
+
+    return GetLayout(msg, ClampSize(size))->width;
+}
+
+void TrueTypeFont::RebuildGlyphTable()
+{
+    for (int i = 0; i < GlyphTableSize; i++)
+        m_glyphTable[i] = -1;
+
+    for (int i = 0; i < MaxGlyphs; i++)
+    {
+        if (!m_glyphs[i].used)
+            continue;
+
+        int slot = GlyphSlot(m_glyphs[i].key);
+        while (m_glyphTable[slot] >= 0)
+            slot = (slot + 1) & (GlyphTableSize - 1);
+        m_glyphTable[slot] = (int16_t)i;
+    }
+}
+
+void TrueTypeFont::EvictShelf(int shelfIndex)
+{
+    for (int i = 0; i < MaxGlyphs; i++)
+    {
+        Glyph& glyph = m_glyphs[i];
+        if (glyph.used && glyph.shelf == shelfIndex)
+        {
+            glyph.used = false;
+            glyph.next = m_freeGlyph;
+            m_freeGlyph = i;
+            m_numEvicted++;
+        }
+    }
+
+    m_shelves[shelfIndex].x = 0;
+    RebuildGlyphTable();
+}
+
+int TrueTypeFont::AllocateGlyph()
+{
+    // Out of glyphs, so empty the least recently used shelf with glyphs on it. Glyphs with
+    // nothing to draw aren't on a shelf, so if there are none, start again.
+    if (m_freeGlyph < 0)
+    {
+        int oldest = -1;
+        for (int i = 0; i < m_numShelves; i++)
+        {
+            if (m_shelves[i].x > 0 && (oldest < 0 || m_shelves[i].lastUsed < m_shelves[oldest].lastUsed))
+                oldest = i;
+        }
+
+        if (oldest >= 0)
+        {
+            EvictShelf(oldest);
+        }
+        else
+        {
+            for (int i = 0; i < MaxGlyphs; i++)
+            {
+                m_glyphs[i].used = false;
+                m_glyphs[i].next = i + 1 < MaxGlyphs ? i + 1 : -1;
+            }
+            m_freeGlyph = 0;
+            m_numEvicted += MaxGlyphs;
+            RebuildGlyphTable();
+        }
+    }
+
+    int index = m_freeGlyph;
+    m_freeGlyph = m_glyphs[index].next;
+    return index;
+}
+
+bool TrueTypeFont::AllocateAtlas(int width, int height, int& shelfIndex, int& x, int& y)
+{
+    shelfIndex = -1;
+    if (width > AtlasSize || height > AtlasSize)
+        return false;
+
+    int shelfHeight = ((height + ShelfRounding - 1) / ShelfRounding) * ShelfRounding;
+
+    // A shelf of the same height with room left.
+    for (int i = 0; i < m_numShelves; i++)
+    {
+        Shelf& shelf = m_shelves[i];
+        if (shelf.height == shelfHeight && shelf.x + width <= AtlasSize)
+        {
+            shelfIndex = i;
+            break;
+        }
+    }
+
+    // A new shelf at the bottom.
+    if (shelfIndex < 0 && m_atlasBottom + shelfHeight <= AtlasSize && m_numShelves < MaxShelves)
+    {
+        Shelf& shelf = m_shelves[m_numShelves];
+        shelf.y = m_atlasBottom;
+        shelf.height = shelfHeight;
+        shelf.x = 0;
+        shelf.lastUsed = m_tick;
+        m_atlasBottom += shelfHeight;
+        shelfIndex = m_numShelves++;
+    }
+
+    // Otherwise empty the least recently used shelf that's tall enough, not counting
+    // those used for this draw.
+    if (shelfIndex < 0)
+    {
+        for (int i = 0; i < m_numShelves; i++)
+        {
+            const Shelf& shelf = m_shelves[i];
+            if (shelf.height >= height && shelf.lastUsed < m_tick && (shelfIndex < 0 || shelf.lastUsed < m_shelves[shelfIndex].lastUsed))
+                shelfIndex = i;
+        }
+
+        if (shelfIndex < 0)
+            return false;
+
+        EvictShelf(shelfIndex);
+    }
+
+    Shelf& shelf = m_shelves[shelfIndex];
+    x = shelf.x;
+    y = shelf.y;
+    shelf.x += width;
+    shelf.lastUsed = m_tick;
+    return true;
+}
+
+const TrueTypeFont::Glyph* TrueTypeFont::GetGlyph(int glyphIndex, int size)
+{
+    uint32_t key = GlyphKey(glyphIndex, size);
+    int slot = GlyphSlot(key);
+    for ( ; m_glyphTable[slot] >= 0; slot = (slot + 1) & (GlyphTableSize - 1))
+    {
+        Glyph& glyph = m_glyphs[m_glyphTable[slot]];
+        if (glyph.key == key)
+        {
+            if (glyph.shelf >= 0)
+                m_shelves[glyph.shelf].lastUsed = m_tick;
+            return &glyph;
+        }
+    }
+
+    // The glyph isn't marked as used until it's in the table, as rasterizing may evict a
+    // shelf and rebuild the table.
+    int index = AllocateGlyph();
+    Glyph& glyph = m_glyphs[index];
+    glyph.key = key;
+    if (!Rasterize(glyph, glyphIndex, size))
+    {
+        // The atlas is full of glyphs from this draw, so skip the glyph this time.
+        glyph.next = m_freeGlyph;
+        m_freeGlyph = index;
+        return &glyph;
+    }
+
+    glyph.used = true;
+    m_numRasterized++;
+    slot = GlyphSlot(key);
+    while (m_glyphTable[slot] >= 0)
+        slot = (slot + 1) & (GlyphTableSize - 1);
+    m_glyphTable[slot] = (int16_t)index;
+    return &glyph;
+}
+
+// Appends the glyph's contours to m_points and m_contourEnds, in font units. Returns
+// false if the glyph data is malformed.
+bool TrueTypeFont::AddOutline(int glyphIndex, int depth)
+{
+    if (glyphIndex >= m_numGlyphs || depth > MaxCompositeDepth)
+        return false;
+
+    uint32_t start, end;
+    if (m_indexToLocFormat)
+    {
+        start = ReadU32(m_data + m_loca + (glyphIndex * 4));
+        end = ReadU32(m_data + m_loca + (glyphIndex * 4) + 4);
+    }
+    else
+    {
+        start = ReadU16(m_data + m_loca + (glyphIndex * 2)) * 2;
+        end = ReadU16(m_data + m_loca + (glyphIndex * 2) + 2) * 2;
+    }
+
+    // Glyphs with no outline, such as spaces, have no data.
+    if (start >= end)
+        return true;
+    if (end > m_glyfSize || end - start < 10)
+        return false;
+
+    const uint8_t* data = m_data + m_glyf + start;
+    const uint8_t* dataEnd = m_data + m_glyf + end;
+    int numContours = ReadS16(data);
+
+    if (numContours >= 0)
+    {
+        const uint8_t* endPoints = data + 10;
+        if ((size_t)numContours * 2 + 2 > (size_t)(dataEnd - endPoints))
+            return false;
+
+        const uint8_t* p = endPoints + (numContours * 2);
+        int numPoints = numContours ? ReadU16(p - 2) + 1 : 0;
+        size_t instructionSize = ReadU16(p);
+        if (instructionSize > (size_t)(dataEnd - p) - 2)
+            return false;
+        p += 2 + instructionSize;   // Skip the instructions.
+
+        int firstPoint = m_numPoints;
+        Grow(m_points, m_maxPoints, m_numPoints + numPoints);
+        Grow(m_contourEnds, m_maxContours, m_numContours + numContours);
+        Grow(m_flags, m_maxFlags, numPoints);
+
+        // Flags, with runs of repeated flags.
+        for (int i = 0; i < numPoints; )
+        {
+            if (p >= dataEnd)
+                return false;
+
+            uint8_t flags = *p++;
+            int repeat = 1;
+            if (flags & 8)
+            {
+                if (p >= dataEnd)
+                    return false;
+                repeat += *p++;
+            }
+
+            for ( ; repeat > 0 && i < numPoints; repeat--, i++)
+                m_flags[i] = flags;
+        }
+
+        // X coordinates, then Y coordinates, as deltas that are either a byte with a
+        // sign flag or a 16-bit value that may be omitted when the same as the last.
+        for (int axis = 0; axis < 2; axis++)
+        {
+            int shortFlag = axis ? 4 : 2;
+            int sameFlag = axis ? 32 : 16;
+            int value = 0;
+            for (int i = 0; i < numPoints; i++)
+            {
+                int flags = m_flags[i];
+                if (flags & shortFlag)
+                {
+                    if (p >= dataEnd)
+                        return false;
+                    value += (flags & sameFlag) ? *p : -*p;
+                    p++;
+                }
+                else if (!(flags & sameFlag))
+                {
+                    if (dataEnd - p < 2)
+                        return false;
+                    value += ReadS16(p);
+                    p += 2;
+                }
+
+                Point& point = m_points[firstPoint + i];
+                if (axis == 0)
+                    point.x = (float)value;
+                else
+                    point.y = (float)value;
+                point.onCurve = (flags & 1) != 0;
+            }
+        }
+
+        for (int i = 0; i < numContours; i++)
+        {
+            int contourEnd = ReadU16(endPoints + (i * 2));
+            if (contourEnd >= numPoints)
+                return false;
+            m_contourEnds[m_numContours++] = firstPoint + contourEnd;
+        }
+
+        m_numPoints += numPoints;
+        return true;
+    }
+
+    // A composite glyph made of other glyphs, each with a transform.
+    const int Arg1And2AreWords = 1, ArgsAreXYValues = 2, HaveScale = 8, MoreComponents = 32, HaveXAndYScale = 64, HaveTwoByTwo = 128;
+
+    const uint8_t* p = data + 10;
+    for (;;)
+    {
+        if (dataEnd - p < 4)
+            return false;
+
+        int flags = ReadU16(p);
+        int component = ReadU16(p + 2);
+        p += 4;
+
+        float dx = 0.0f, dy = 0.0f;
+        if (flags & Arg1And2AreWords)
+        {
+            if (dataEnd - p < 4)
+                return false;
+            dx = ReadS16(p);
+            dy = ReadS16(p + 2);
+            p += 4;
+        }
+        else
+        {
+            if (dataEnd - p < 2)
+                return false;
+            dx = (int8_t)p[0];
+            dy = (int8_t)p[1];
+            p += 2;
+        }
+
+        // Aligning components by matching points isn't supported, so they're placed with
+        // no offset.
+        if (!(flags & ArgsAreXYValues))
+            dx = dy = 0.0f;
+
+        // The 2x2 transform is in 2.14 fixed point.
+        float a = 1.0f, b = 0.0f, c = 0.0f, d = 1.0f;
+        int numValues = (flags & HaveTwoByTwo) ? 4 : (flags & HaveXAndYScale) ? 2 : (flags & HaveScale) ? 1 : 0;
+        if (dataEnd - p < numValues * 2)
+            return false;
+
+        if (numValues == 1)
+        {
+            a = d = ReadS16(p) / 16384.0f;
+        }
+        else if (numValues == 2)
+        {
+            a = ReadS16(p) / 16384.0f;
+            d = ReadS16(p + 2) / 16384.0f;
+        }
+        else if (numValues == 4)
+        {
+            a = ReadS16(p) / 16384.0f;
+            b = ReadS16(p + 2) / 16384.0f;
+            c = ReadS16(p + 4) / 16384.0f;
+            d = ReadS16(p + 6) / 16384.0f;
+        }
+        p += numValues * 2;
+
+        int firstPoint = m_numPoints;
+        if (!AddOutline(component, depth + 1))
+            return false;
+
+        for (int i = firstPoint; i < m_numPoints; i++)
+        {
+            Point& point = m_points[i];
+            float x = point.x, y = point.y;
+            point.x = (a * x) + (c * y) + dx;
+            point.y = (b * x) + (d * y) + dy;
+        }
+
+        if (!(flags & MoreComponents))
+            return true;
+    }
+}
+
+// Accumulates the signed area the line covers in each cell of the coverage buffer, so
+// that a running sum along each row gives the coverage of each pixel. Lines are in
+// pixels, with y down, and stride is the width of the buffer.
+static void AccumulateLine(float* coverage, int stride, int height, float x0, float y0, float x1, float y1)
+{
+    if (y0 == y1)
+        return;
+
+    float direction = 1.0f;
+    if (y0 > y1)
+    {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+        direction = -1.0f;
+    }
+
+    float dxdy = (x1 - x0) / (y1 - y0);
+    float x = x0;
+    int rowStart = std::max((int)y0, 0);
+    int rowEnd = std::min((int)ceilf(y1), height);
+    if (y0 < 0.0f)
+        x -= y0 * dxdy;
+
+    for (int row = rowStart; row < rowEnd; row++)
+    {
+        float* cells = coverage + (row * stride);
+        float dy = std::min((float)(row + 1), y1) - std::max((float)row, y0);
+        float xNext = x + (dxdy * dy);
+        float d = dy * direction;
+
+        float left = std::min(x, xNext);
+        float right = std::max(x, xNext);
+        float leftFloor = floorf(left);
+        int leftCell = (int)leftFloor;
+        float rightCeil = ceilf(right);
+        int rightCell = (int)rightCeil;
+
+        if (rightCell <= leftCell + 1)
+        {
+            // Within one cell: split the area by the middle of the line.
+            float middle = (0.5f * (x + xNext)) - leftFloor;
+            cells[leftCell] += d - (d * middle);
+            cells[leftCell + 1] += d * middle;
+        }
+        else
+        {
+            // Across several cells: a triangle in the first and last, and a constant
+            // amount in between.
+            float slope = 1.0f / (right - left);
+            float leftFraction = left - leftFloor;
+            float first = 0.5f * slope * (1.0f - leftFraction) * (1.0f - leftFraction);
+            float rightFraction = right - rightCeil + 1.0f;
+            float last = 0.5f * slope * rightFraction * rightFraction;
+
+            cells[leftCell] += d * first;
+            if (rightCell == leftCell + 2)
+            {
+                cells[leftCell + 1] += d * (1.0f - first - last);
+            }
+            else
+            {
+                float second = slope * (1.5f - leftFraction);
+                cells[leftCell + 1] += d * (second - first);
+                for (int cell = leftCell + 2; cell < rightCell - 1; cell++)
+                    cells[cell] += d * slope;
+                float beforeLast = second + ((rightCell - leftCell - 3) * slope);
+                cells[rightCell - 1] += d * (1.0f - beforeLast - last);
+            }
+            cells[rightCell] += d * last;
+        }
+
+        x = xNext;
+    }
+}
+
+// Splits a quadratic curve into enough lines to stay within about a tenth of a pixel.
+static void AccumulateCurve(float* coverage, int stride, int height, float x0, float y0, float x1, float y1, float x2, float y2)
+{
+    float ddx = x0 - (2.0f * x1) + x2;
+    float ddy = y0 - (2.0f * y1) + y2;
+    int segments = std::min(1 + (int)sqrtf(sqrtf((ddx * ddx) + (ddy * ddy)) * 2.5f), 32);
+
+    float x = x0, y = y0;
+    for (int i = 1; i <= segments; i++)
+    {
+        float t = (float)i / segments;
+        float u = 1.0f - t;
+        float nextX = (u * u * x0) + (2.0f * u * t * x1) + (t * t * x2);
+        float nextY = (u * u * y0) + (2.0f * u * t * y1) + (t * t * y2);
+        AccumulateLine(coverage, stride, height, x, y, nextX, nextY);
+        x = nextX;
+        y = nextY;
+    }
+}
+
+bool TrueTypeFont::Rasterize(Glyph& glyph, int glyphIndex, int size)
+{
+    PIXIE_PROFILE_ZONE("TrueTypeFont::Rasterize");
+
+    glyph.shelf = -1;
+    glyph.width = glyph.height = 0;
+    glyph.left = glyph.top = 0;
+
+    m_numPoints = 0;
+    m_numContours = 0;
+    if (!AddOutline(glyphIndex, 0) || m_numPoints == 0)
+        return true;
+
+    // Scale to pixels with y down, and find the bounds. Curves lie within their control
+    // points, so the bounds of the points cover the outline.
+    float scale = GetScale(size);
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+    for (int i = 0; i < m_numPoints; i++)
+    {
+        Point& point = m_points[i];
+        point.x *= scale;
+        point.y *= -scale;
+        minX = std::min(minX, point.x);
+        minY = std::min(minY, point.y);
+        maxX = std::max(maxX, point.x);
+        maxY = std::max(maxY, point.y);
+    }
+
+    int left = (int)floorf(minX);
+    int top = (int)floorf(minY);
+    int width = (int)ceilf(maxX) - left;
+    int height = (int)ceilf(maxY) - top;
+    if (width <= 0 || height <= 0)
+        return true;
+
+    int shelf, atlasX, atlasY;
+    if (!AllocateAtlas(width, height, shelf, atlasX, atlasY))
+        return false;
+
+    // Move the outline to the bitmap's origin. Clamping only catches rounding.
+    for (int i = 0; i < m_numPoints; i++)
+    {
+        Point& point = m_points[i];
+        point.x = std::min(std::max(point.x - left, 0.0f), (float)width);
+        point.y = std::min(std::max(point.y - top, 0.0f), (float)height);
+    }
+
+    // Two spare cells on each row take the area that spills past the right edge.
+    int stride = width + 2;
+    Grow(m_coverage, m_maxCoverage, stride * height);
+    memset(m_coverage, 0, stride * height * sizeof(float));
+
+    // Walk each contour as lines and quadratic curves, with an on-curve point implied
+    // between consecutive off-curve points. Start from an on-curve point, or from the
+    // point implied between the last and first if there are none.
+    int contourStart = 0;
+    for (int c = 0; c < m_numContours; c++)
+    {
+        const Point* points = m_points + contourStart;
+        int count = m_contourEnds[c] - contourStart + 1;
+        contourStart = m_contourEnds[c] + 1;
+        if (count < 2)
+            continue;
+
+        int first = 0;
+        while (first < count && !points[first].onCurve)
+            first++;
+
+        Point start;
+        int next = first + 1, remaining = count - 1;
+        if (first == count)
+        {
+            start.x = 0.5f * (points[0].x + points[count - 1].x);
+            start.y = 0.5f * (points[0].y + points[count - 1].y);
+            next = 0;
+            remaining = count;
+        }
+        else
+        {
+            start = points[first];
+        }
+
+        Point current = start, control = start;
+        bool haveControl = false;
+        for ( ; remaining > 0; remaining--, next++)
+        {
+            const Point& point = points[next % count];
+            if (point.onCurve)
+            {
+                if (haveControl)
+                    AccumulateCurve(m_coverage, stride, height, current.x, current.y, control.x, control.y, point.x, point.y);
+                else
+                    AccumulateLine(m_coverage, stride, height, current.x, current.y, point.x, point.y);
+                current = point;
+                haveControl = false;
+            }
+            else if (haveControl)
+            {
+                Point middle;
+                middle.x = 0.5f * (control.x + point.x);
+                middle.y = 0.5f * (control.y + point.y);
+                AccumulateCurve(m_coverage, stride, height, current.x, current.y, control.x, control.y, middle.x, middle.y);
+                current = middle;
+                control = point;
+            }
+            else
+            {
+                control = point;
+                haveControl = true;
+            }
+        }
+
+        if (haveControl)
+            AccumulateCurve(m_coverage, stride, height, current.x, current.y, control.x, control.y, start.x, start.y);
+        else
+            AccumulateLine(m_coverage, stride, height, current.x, current.y, start.x, start.y);
+    }
+
+    // Sum along each row. Overlapping contours add up, so the coverage is clamped.
+    for (int row = 0; row < height; row++)
+    {
+        const float* cells = m_coverage + (row * stride);
+        uint8_t* texels = m_atlas + atlasX + ((atlasY + row) * AtlasSize);
+        float sum = 0.0f;
+        for (int column = 0; column < width; column++)
+        {
+            sum += cells[column];
+            float coverage = std::min(fabsf(sum), 1.0f);
+            texels[column] = (uint8_t)((coverage * 255.0f) + 0.5f);
+        }
+    }
+
+    glyph.shelf = shelf;
+    glyph.atlasX = (uint16_t)atlasX;
+    glyph.atlasY = (uint16_t)atlasY;
+    glyph.width = (uint16_t)width;
+    glyph.height = (uint16_t)height;
+    glyph.left = (int16_t)left;
+    glyph.top = (int16_t)top;
+    return true;
+}
+
+void TrueTypeFont::DrawColour(const char* msg, int x, int y, int size, uint32_t colour, Pixie::Window* window, BlendMode mode)
+{
+    assert(window);
+    DrawColour(msg, x, y, size, colour, window->GetSurface(), mode);
+}
+
+void TrueTypeFont::DrawColour(const char* msg, int x, int y, int size, uint32_t colour, const Surface& target, BlendMode mode)
+{
+    assert(msg);
+    PIXIE_PROFILE_ZONE("TrueTypeFont::Draw");
+
+    if (!m_data)
+        return;
+
+    size = ClampSize(size);
+    m_tick++;
+
+    // Opaque text still blends its anti-aliased edges.
+    const Simd::Kernels& kernels = Simd::GetKernels();
+    Simd::Blend blend = mode == BlendMode_Opaque ? Simd::MakeBlend(colour | 0xff000000, BlendMode_SrcOver) : Simd::MakeBlend(colour, mode);
+
+    const SurfaceRect& clip = target.GetClipRect();
+    int pitch = target.GetStride();
+    int baseline = y + GetAscent(size);
+
+    int dirtyLeft = clip.right, dirtyTop = clip.bottom, dirtyRight = clip.left, dirtyBottom = clip.top;
+
+    const TextLayoutCache::Layout* layout = GetLayout(msg, size);
+    for (int i = 0; i < layout->numGlyphs; i++)
+    {
+        const TextLayoutCache::Glyph& layoutGlyph = layout->glyphs[i];
+        const Glyph* glyph = GetGlyph(layoutGlyph.index, size);
+        if (glyph->shelf < 0)
+            continue;
+
+        // Clip the glyph's bitmap to the surface.
+        int glyphX = x + layoutGlyph.x + glyph->left;
+        int glyphY = baseline + glyph->top;
+        int left = std::max(glyphX, clip.left);
+        int top = std::max(glyphY, clip.top);
+        int right = std::min(glyphX + glyph->width, clip.right);
+        int bottom = std::min(glyphY + glyph->height, clip.bottom);
+        if (left >= right || top >= bottom)
+            continue;
+
+        const uint8_t* src = m_atlas + glyph->atlasX + (left - glyphX) + ((glyph->atlasY + (top - glyphY)) * AtlasSize);
+        uint32_t* dst = target.GetRow(top) + left;
+        for (int row = top; row < bottom; row++, src += AtlasSize, dst += pitch)
+            kernels.blendCoverage(dst, src, right - left, blend);
+
+        dirtyLeft = std::min(dirtyLeft, left);
+        dirtyTop = std::min(dirtyTop, top);
+        dirtyRight = std::max(dirtyRight, right);
+        dirtyBottom = std::max(dirtyBottom, bottom);
+    }
+
+    if (dirtyLeft < dirtyRight && dirtyTop < dirtyBottom)
+        target.MarkDirty(dirtyLeft, dirtyTop, dirtyRight - dirtyLeft, dirtyBottom - dirtyTop);
+}
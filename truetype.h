@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "core.h"
+#include "textlayout.h"
+#include "surface.h"
+
+namespace Pixie
+{
+    class Window;
+
+    // TrueType font loader and anti-aliased rasterizer. Glyphs are rasterized the first
+    // time they are drawn at a size and kept in an 8-bit coverage atlas, which evicts the
+    // least recently used glyphs when it fills up. The layout of recently drawn strings is
+    // cached as well, so drawing a string again is one blit per glyph.
+    //
+    // Only fonts with TrueType outlines are supported, not CFF. Strings are UTF-8, with
+    // bytes that aren't valid UTF-8 taken as Latin-1, and are kerned with the font's kern
+    // table. Sizes are the em size in pixels. The caches are updated while drawing, so a
+    // font can't be drawn from several threads at once.
+    class TrueTypeFont
+    {
+        public:
+            enum
+            {
+                AtlasSize = 1024,       // The atlas is AtlasSize x AtlasSize texels.
+                MaxGlyphs = 2048,       // Glyphs the atlas can hold at once.
+                MinSize = 4,
+                MaxSize = 256,
+            };
+
+            TrueTypeFont();
+            ~TrueTypeFont();
+
+            // Loads the font in the given .ttf file.
+            bool Load(const char* filename);
+
+            // Loads a font from memory, such as a font embedded in the program. The data is
+            // copied.
+            bool LoadMemory(const void* data, size_t size);
+
+            // Draws the string with its top left at x, y at the given size. With
+            // BlendMode_Opaque the colour's alpha is ignored and only the glyph edges are
+            // blended; with the other blend modes the colour is ARGB.
+            void DrawColour(const char* msg, int x, int y, int size, uint32_t colour, Pixie::Window* window, BlendMode mode = BlendMode_Opaque);
+
+            // Draws the string to the surface, within its clip rectangle.
+            void DrawColour(const char* msg, int x, int y, int size, uint32_t colour, const Surface& target, BlendMode mode = BlendMode_Opaque);
+
+            // Returns the width of the string at the given size.
+            int GetStringWidth(const char* msg, int size);
+
+            // Returns the distance from the top of a line to the baseline at the given size.
+            int GetAscent(int size) const;
+
+            // Returns the distance between lines at the given size.
+            int GetLineHeight(int size) const;
+
+            // Returns the number of glyphs rasterized since the font was loaded, and how many
+            // of them were evicted from the atlas to make room for others.
+            uint64_t GetNumRasterizedGlyphs() const;
+            uint64_t GetNumEvictedGlyphs() const;
+
+            // Returns the coverage atlas, AtlasSize texels square.
+            const uint8_t* GetAtlas() const;
+
+        private:
+            struct Shelf;
+            struct Glyph;
+            struct Point;
+
+            void Unload();
+            bool Parse();
+            int ClampSize(int size) const;
+            float GetScale(int size) const;
+            int FindGlyphIndex(uint32_t codepoint) const;
+            int GetAdvance(int glyphIndex) const;
+
+            int GetKerning(int left, int right) const;
+
+            const TextLayoutCache::Layout* GetLayout(const char* msg, int size);
+            const Glyph* GetGlyph(int glyphIndex, int size);
+            bool AddOutline(int glyphIndex, int depth);
+            bool Rasterize(Glyph& glyph, int glyphIndex, int size);
+            bool AllocateAtlas(int width, int height, int& shelfIndex, int& x, int& y);
+            void EvictShelf(int shelfIndex);
+            int AllocateGlyph();
+            void RebuildGlyphTable();
+
+            uint8_t* m_data;
+            size_t m_size;
+
+            // Offsets of the tables used, from the start of the data.
+            uint32_t m_cmap;            // The cmap subtable used.
+            uint32_t m_loca;
+            uint32_t m_glyf;
+            uint32_t m_glyfSize;
+            uint32_t m_hmtx;
+            int m_cmapFormat;
+            int m_numGlyphs;
+            int m_numHMetrics;
+            int m_indexToLocFormat;
+            int m_unitsPerEm;
+            int m_ascent;
+            int m_descent;
+            int m_lineGap;
+            uint32_t m_kernPairs;       // Sorted pairs of glyphs and their kerning.
+            int m_numKernPairs;
+
+            uint8_t* m_atlas;
+            Shelf* m_shelves;
+            int m_numShelves;
+            int m_atlasBottom;          // Top of the space below the last shelf.
+
+            Glyph* m_glyphs;
+            int m_freeGlyph;            // Start of the list of unused glyphs, or -1.
+            int16_t* m_glyphTable;      // Open addressed, indexes m_glyphs or -1.
+
+            TextLayoutCache m_layouts;
+
+            // Scratch space for rasterizing.
+            Point* m_points;
+            int m_numPoints;
+            int m_maxPoints;
+            uint8_t* m_flags;
+            int m_maxFlags;
+            int* m_contourEnds;
+            int m_numContours;
+            int m_maxContours;
+            float* m_coverage;
+            int m_maxCoverage;
+
+            uint64_t m_tick;            // Counts draws, to find the least recently used.
+            uint64_t m_numRasterized;
+            uint64_t m_numEvicted;
+    };
+
+    inline uint64_t TrueTypeFont::GetNumRasterizedGlyphs() const
+    {
+        return m_numRasterized;
+    }
+
+    inline uint64_t TrueTypeFont::GetNumEvictedGlyphs() const
+    {
+        return m_numEvicted;
+    }
+
+    inline const uint8_t* TrueTypeFont::GetAtlas() const
+    {
+        return m_atlas;
+    }
+}
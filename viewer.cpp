@@ -0,0 +1,57 @@
+// pixie_viewer: shows the frames a Pixie app streams with FrameStreamer, such as the
+// example run with --stream, in a window of its own.
+//
+//   pixie_viewer [ADDRESS] [--frames N]
+//
+// ADDRESS is "unix:<path>", "<host>:<port>" or "<port>", and defaults to 7070 on the
+// local machine. The viewer exits when the window is closed, the stream ends, or after
+// --frames frames, then prints how much of the stream it received, which makes it a
+// test client for headless runs too.
+
+#include "pixie.h"
+#include "stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char** argv)
+{
+    const char* address = "7070";
+    long long maxFrames = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            maxFrames = atoll(argv[++i]);
+        else
+            address = argv[i];
+    }
+
+    Pixie::StreamClient client;
+    if (!client.Connect(address))
+    {
+        printf("pixie_viewer: failed to connect to %s\n", address);
+        return 1;
+    }
+
+    Pixie::Window window;
+    if (!window.Open(TEXT("Pixie Viewer"), client.GetWidth(), client.GetHeight(), false))
+        return 1;
+
+    // Keep the window responsive while the stream is idle, which it is whenever nothing
+    // on the streamed screen changes.
+    while (client.IsConnected() && (maxFrames < 0 || (long long)client.GetReceivedFrames() < maxFrames))
+    {
+        if (client.Receive(16))
+            Pixie::Blit(window.GetSurface(), 0, 0, client.GetSurface());
+        if (!window.Update())
+            break;
+    }
+
+    window.Close();
+
+    uint64_t frames = client.GetReceivedFrames();
+    printf("received %llu frames, %llu tiles, %llu bytes (%.1f KB per frame)\n",
+        (unsigned long long)frames, (unsigned long long)client.GetReceivedTiles(), (unsigned long long)client.GetReceivedBytes(),
+        frames ? client.GetReceivedBytes() / (1024.0 * frames) : 0.0);
+    return 0;
+}